@@ -0,0 +1,138 @@
+### Python script to run the Lox68k benchmarks in bench/ and compare results between commits
+#
+# python3 bench/bench.py [options] [<bench>.lox ...]
+#
+# Each benchmark is run once with the debug build for the deterministic counters
+# (steps, bytes allocated, GCs, peak heap), then warmup + repetitions with the
+# release build for timing. Output is checked against <bench>.out.
+#
+#   --json FILE      write results to FILE
+#   --compare FILE   compare results with an earlier --json FILE
+#   --update         write <bench>.out from current output instead of checking it
+#   --m68k IMAGE     also run IMAGE built by m68k/build on m68k/emu68k for the Kit's cycles
+
+import argparse, glob, json, os, statistics, subprocess, sys, time
+
+bench_dir = os.path.dirname(os.path.abspath(__file__))
+
+parser = argparse.ArgumentParser(description = "Run Lox68k benchmarks.")
+parser.add_argument("files", nargs = "*", help = "benchmarks, default all in bench/")
+parser.add_argument("--llox",    default = "./llox",  help = "release build used for timing")
+parser.add_argument("--lloxd",   default = "./lloxd", help = "debug build used for counters")
+parser.add_argument("--warmup",  type = int, default = 1, help = "untimed runs per benchmark")
+parser.add_argument("--reps",    type = int, default = 5, help = "timed runs per benchmark")
+parser.add_argument("--json",    help = "write results to this file")
+parser.add_argument("--compare", help = "compare with results of an earlier --json")
+parser.add_argument("--update",  action = "store_true", help = "write expected output files")
+parser.add_argument("--m68k",    help = "Kit image run on m68k/emu68k for cycles")
+parser.add_argument("--emu68k",  default = os.path.join(bench_dir, "..", "m68k", "emu68k"),
+                    help = "emulator used with --m68k")
+args = parser.parse_args()
+
+files = args.files or sorted(glob.glob(os.path.join(bench_dir, "*.lox")))
+
+
+## Run one benchmark, return program output without banner and the stats line.
+def run(binary, file):
+    proc = subprocess.run([binary, "--bench", file], capture_output = True, text = True)
+    stats = None
+    for line in proc.stderr.splitlines():
+        if line.startswith("{"):
+            stats = json.loads(line)
+    lines = [l for l in proc.stdout.splitlines()[1:] if l != "Loading " + file]
+    if stats is None or not stats["ok"] or proc.returncode != 0:
+        print("{} failed:\n{}{}".format(file, proc.stdout, proc.stderr))
+        sys.exit(10)
+    return "\n".join(lines) + "\n", stats
+
+
+## Run one benchmark on the emulated Kit, return its output and cycles.
+def run_m68k(file):
+    proc = subprocess.run([args.emu68k, args.m68k, file], capture_output = True, text = True)
+    stats = None
+    for line in proc.stderr.splitlines():
+        if line.startswith("{"):
+            stats = json.loads(line)
+    if stats is None or not stats["ok"] or proc.returncode != 0:
+        print("{} failed on emu68k:\n{}{}".format(file, proc.stdout, proc.stderr))
+        sys.exit(10)
+    return proc.stdout, stats["cycles"]
+
+
+def check(file, output):
+    expected_file = os.path.splitext(file)[0] + ".out"
+    if args.update:
+        with open(expected_file, "w") as dest:
+            dest.write(output)
+        return
+    try:
+        with open(expected_file) as src:
+            expected = src.read()
+    except FileNotFoundError:
+        print("{} not found, use --update.".format(expected_file))
+        sys.exit(10)
+    if output != expected:
+        print("{}: output differs from {}".format(file, expected_file))
+        sys.exit(10)
+
+
+results = {}
+for file in files:
+    name   = os.path.splitext(os.path.basename(file))[0]
+    result = {}
+
+    if os.path.exists(args.lloxd):
+        output, stats = run(args.lloxd, file)
+        check(file, output)
+        for key in ("steps", "bytes", "gcs", "peak"):
+            result[key] = stats[key]
+
+    if args.m68k:
+        output, result["cycles"] = run_m68k(file)
+        check(file, output)
+
+    for i in range(args.warmup):
+        run(args.llox, file)
+    walls = []
+    cpus  = []
+    for i in range(args.reps):
+        start = time.perf_counter()
+        output, stats = run(args.llox, file)
+        walls.append(time.perf_counter() - start)
+        cpus.append(stats["sec"])
+    check(file, output)
+
+    result["wall_min"]    = min(walls)
+    result["wall_median"] = statistics.median(walls)
+    result["cpu_median"]  = statistics.median(cpus)
+    results[name] = result
+
+
+## Report, relative to earlier results if given.
+base = {}
+if args.compare:
+    with open(args.compare) as src:
+        base = json.load(src)["benchmarks"]
+
+print("{:12} {:>9} {:>9} {:>12} {:>10} {:>5} {:>7} {:>12} {:>8}".format(
+      "benchmark", "wall min", "wall med", "steps", "bytes", "GCs", "peak", "cycles", "vs base"))
+for name, r in results.items():
+    ratio = ""
+    if name in base:
+        ratio = "{:7.3f}x".format(r["wall_median"] / base[name]["wall_median"])
+        if "steps" in r and "steps" in base[name] and r["steps"] != base[name]["steps"]:
+            ratio += " steps {:+d}".format(r["steps"] - base[name]["steps"])
+        if "cycles" in r and "cycles" in base[name]:
+            ratio += " cycles {:.3f}x".format(r["cycles"] / base[name]["cycles"])
+    print("{:12} {:9.4f} {:9.4f} {:>12} {:>10} {:>5} {:>7} {:>12} {:>8}".format(
+          name, r["wall_min"], r["wall_median"], r.get("steps", "-"), r.get("bytes", "-"),
+          r.get("gcs", "-"), r.get("peak", "-"), r.get("cycles", "-"), ratio))
+
+if args.json:
+    try:
+        commit = subprocess.run(["git", "describe", "--always", "--dirty"],
+                                capture_output = True, text = True).stdout.strip()
+    except OSError:
+        commit = ""
+    with open(args.json, "w") as dest:
+        json.dump({"commit": commit, "reps": args.reps, "benchmarks": results}, dest, indent = 2)
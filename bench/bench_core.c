@@ -0,0 +1,407 @@
+// Microbenchmarks for the core data structures: hash tables, string interning and nano_malloc.
+// Linked with all interpreter sources except main.c, see build script.
+//
+// Usage: bench_core [--trace <gc log>] [<source>*]
+// - sources (default none) are split into identifiers, which are interned in order.
+// - a gc log is written by lloxd after dbg_gc(6), its allocations are replayed with nano_malloc.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "memory.h"
+#include "nano_malloc.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define MIN_SECONDS 0.2 // repeat each benchmark at least this long
+
+static uint32_t randomState = 4711;
+
+static uint32_t nextRandom(void) {
+    // xorshift32, independent of vm.randomState
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static double seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void report(const char* name, long ops, double secs, const char* extra) {
+    printf("%-24s %10ld ops %9.1f ns/op  %s\n", name, ops, 1e9 * secs / ops, extra);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Probe lengths, measured from the table layout
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define HASH_VALUE(val) (IS_STRING(val) ? AS_STRING(val)->hash : (val)) // same as table.c
+
+static char probeInfo[128];
+
+// Distance of each key from its home bucket for hits, distance to the next
+// really empty bucket from each home bucket for misses.
+static const char* probeStats(Table* table) {
+    int    mask = table->capacity - 1;
+    int    keys = 0, tombstones = 0, maxHit = 0;
+    long   hits = 0, misses = 0;
+    int    i, j, dist;
+    Entry* entry;
+
+    for (i = 0; i < table->capacity; i++) {
+        entry = &table->entries[i];
+        if (IS_EMPTY(entry->key)) {
+            if (!IS_NIL(entry->value))
+                tombstones++;
+        } else {
+            keys++;
+            dist  = (i - (int)(HASH_VALUE(entry->key) & mask)) & mask;
+            hits += dist + 1;
+            if (dist + 1 > maxHit)
+                maxHit = dist + 1;
+        }
+        for (j = i; !(IS_EMPTY(table->entries[j].key) && IS_NIL(table->entries[j].value)); j = (j + 1) & mask)
+            misses++;
+        misses++;
+    }
+
+    sprintf(probeInfo, "cap %5d keys %5d tomb %4d | probes hit %.2f (max %d) miss %.2f",
+            table->capacity, keys, tombstones,
+            keys ? (double)hits / keys : 0.0, maxHit,
+            table->capacity ? (double)misses / table->capacity : 0.0);
+    return probeInfo;
+}
+
+static char heapInfo[128];
+
+static const char* heapSummary(void) {
+    int    blocks;
+    size_t total, largest;
+
+    nano_stats(&blocks, &total, &largest);
+    sprintf(heapInfo, "free list %4d blocks, %6lu bytes, largest %6lu",
+            blocks, (unsigned long)total, (unsigned long)largest);
+    return heapInfo;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// nano_malloc
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define POOL_SIZE 256
+
+// Random sizes, mostly small objects, some lists and tables, rarely a large array
+static size_t randomSize(void) {
+    uint32_t r = nextRandom() % 100;
+    if (r < 70)
+        return 8 + nextRandom() % 25;
+    if (r < 95)
+        return 33 + nextRandom() % 224;
+    return 257 + nextRandom() % 1792;
+}
+
+static void benchAllocChurn(void) {
+    void*   pool[POOL_SIZE];
+    long    ops = 0;
+    int     i, slot;
+    clock_t start;
+
+    init_freelist();
+    mem_clear(pool, sizeof(pool));
+    start = clock();
+    do {
+        for (i = 0; i < 10000; i++) {
+            slot = nextRandom() % POOL_SIZE;
+            if (pool[slot]) {
+                nano_free(pool[slot]);
+                pool[slot] = NULL;
+            } else
+                pool[slot] = nano_malloc(randomSize()); // NULL if heap exhausted, retried later
+        }
+        ops += i;
+    } while (seconds(start) < MIN_SECONDS);
+    report("alloc churn", ops, seconds(start), heapSummary());
+}
+
+// Many small blocks, every other one freed, then larger requests must walk past the holes.
+static void benchAllocFragmented(void) {
+    void*   pool[POOL_SIZE * 4];
+    void*   big;
+    long    ops = 0;
+    int     i, count;
+    clock_t start;
+
+    init_freelist();
+    for (count = 0; count < POOL_SIZE * 4; count++)
+        if ((pool[count] = nano_malloc(24)) == NULL)
+            break;
+    for (i = 0; i < count; i += 2)
+        nano_free(pool[i]);
+
+    start = clock();
+    do {
+        for (i = 0; i < 10000; i++) {
+            big = nano_malloc(64);
+            nano_free(big);
+        }
+        ops += i;
+    } while (seconds(start) < MIN_SECONDS);
+    report("alloc past holes", ops, seconds(start), heapSummary());
+}
+
+typedef struct {
+    uint32_t address; // address logged by lloxd
+    void*    block;   // replayed allocation
+} TraceEntry;
+
+#define TRACE_MAX 8192 // power of 2, more than live objects fitting in heap
+
+// Replay "GC xxxxx aloc <size> <type>" and "GC xxxxx free <type>" lines.
+static void benchAllocTrace(const char* path) {
+    static TraceEntry live[TRACE_MAX];
+    static char       line[256];
+    uint32_t*         addresses;
+    int*              sizes;    // negative for free
+    int               count = 0, capacity = 0;
+    unsigned          address;
+    int               size, i, j, pass;
+    long              ops = 0;
+    char              kind[8];
+    clock_t           start;
+    FILE*             file = fopen(path, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not open \"%s\".\n", path);
+        return;
+    }
+
+    addresses = NULL;
+    sizes     = NULL;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "GC %x %7s %d", &address, kind, &size) < 2)
+            continue;
+        if (strcmp(kind, "aloc") && strcmp(kind, "free"))
+            continue;
+        if (count == capacity) {
+            capacity  = capacity ? 2 * capacity : 1024;
+            addresses = (uint32_t*)realloc(addresses, capacity * sizeof(uint32_t));
+            sizes     = (int*)realloc(sizes, capacity * sizeof(int));
+            if (addresses == NULL || sizes == NULL) {
+                fprintf(stderr, "Out of memory reading trace.\n");
+                exit(1);
+            }
+        }
+        addresses[count] = address;
+        sizes[count]     = strcmp(kind, "aloc") ? -1 : size;
+        count++;
+    }
+    fclose(file);
+
+    start = clock();
+    for (pass = 0; count && (pass == 0 || seconds(start) < MIN_SECONDS); pass++) {
+        init_freelist();
+        mem_clear(live, sizeof(live));
+        for (i = 0; i < count; i++) {
+            for (j = (addresses[i] >> 1) & (TRACE_MAX - 1);
+                 live[j].block && live[j].address != addresses[i];
+                 j = (j + 1) & (TRACE_MAX - 1))
+                ;
+            if (sizes[i] >= 0) {
+                if (live[j].block)
+                    nano_free(live[j].block);
+                live[j].address = addresses[i];
+                live[j].block   = nano_malloc(sizes[i]);
+            } else if (live[j].block) {
+                nano_free(live[j].block);
+                live[j].block = NULL;
+                // re-insert following entries of the probe sequence
+                for (j = (j + 1) & (TRACE_MAX - 1); live[j].block; j = (j + 1) & (TRACE_MAX - 1)) {
+                    TraceEntry moved = live[j];
+                    int        k;
+                    live[j].block = NULL;
+                    for (k = (moved.address >> 1) & (TRACE_MAX - 1); live[k].block; k = (k + 1) & (TRACE_MAX - 1))
+                        ;
+                    live[k] = moved;
+                }
+            }
+        }
+        ops += count;
+    }
+    report("alloc trace replay", ops, seconds(start), heapSummary());
+    free(addresses);
+    free(sizes);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tables
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define KEY_RANGE 1024
+#define LIVE_KEYS 512
+
+// Random inserts and deletes around a constant number of live keys, leaving tombstones.
+static void benchTableChurn(void) {
+    Table   table;
+    Value   value;
+    long    ops = 0;
+    int     i;
+    clock_t start;
+
+    initTable(&table);
+    for (i = 0; i < LIVE_KEYS; i++)
+        tableSet(&table, INT_VAL(nextRandom() % KEY_RANGE), NIL_VAL);
+
+    start = clock();
+    do {
+        for (i = 0; i < 10000; i++) {
+            tableSet(&table, INT_VAL(nextRandom() % KEY_RANGE), TRUE_VAL);
+            tableDelete(&table, INT_VAL(nextRandom() % KEY_RANGE));
+            tableGet(&table, INT_VAL(nextRandom() % KEY_RANGE), &value);
+        }
+        ops += 3 * i;
+    } while (seconds(start) < MIN_SECONDS);
+    report("table churn", ops, seconds(start), probeStats(&table));
+    freeTable(&table);
+}
+
+// Lookups in a table grown by sequential inserts, as globals and fields are.
+static void benchTableLookup(bool hit) {
+    Table   table;
+    Value   value;
+    long    ops = 0;
+    int     i, n = 0;
+    clock_t start;
+
+    initTable(&table);
+    for (i = 0; i < 768; i++)
+        tableSet(&table, INT_VAL(2 * i), NIL_VAL);
+
+    start = clock();
+    do {
+        for (i = 0; i < 10000; i++)
+            n += tableGet(&table, INT_VAL(2 * (i % 768) + !hit), &value);
+        ops += i;
+    } while (seconds(start) < MIN_SECONDS);
+    report(hit ? "table lookup hit" : "table lookup miss", ops, seconds(start), probeStats(&table));
+    if (n < 0)
+        putstr(""); // keep lookups from being optimized away
+    freeTable(&table);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// String interning
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SHORT_STRINGS 1000
+
+static void benchInternShort(void) {
+    char    name[16];
+    long    ops = 0;
+    int     i;
+    clock_t start;
+
+    start = clock();
+    for (i = 0; i < SHORT_STRINGS; i++) {
+        sprintf(name, "s%d", i);
+        makeString0(name);
+    }
+    report("intern new short", SHORT_STRINGS, seconds(start), probeStats(&vm.strings));
+
+    start = clock();
+    do {
+        for (i = 0; i < 10000; i++) {
+            sprintf(name, "s%d", i % SHORT_STRINGS);
+            makeString0(name);
+        }
+        ops += i;
+    } while (seconds(start) < MIN_SECONDS);
+    report("intern hit short", ops, seconds(start), probeStats(&vm.strings));
+}
+
+// Identifiers of real sources, interned in the order of appearance.
+static void benchInternSources(int count, const char* paths[]) {
+    char*   text = NULL;
+    size_t  length = 0, size;
+    long    ops = 0, words;
+    int     i;
+    char*   p;
+    char*   begin;
+    clock_t start;
+    FILE*   file;
+
+    for (i = 0; i < count; i++) {
+        file = fopen(paths[i], "rb");
+        if (file == NULL) {
+            fprintf(stderr, "Could not open \"%s\".\n", paths[i]);
+            continue;
+        }
+        fseek(file, 0L, SEEK_END);
+        size = ftell(file);
+        text = (char*)realloc(text, length + size + 2);
+        if (text == NULL) {
+            fprintf(stderr, "Out of memory reading sources.\n");
+            exit(1);
+        }
+        rewind(file);
+        length += fread(text + length, 1, size, file);
+        text[length++] = '\n';
+        fclose(file);
+    }
+    if (text == NULL)
+        return;
+    text[length] = '\0';
+
+    start = clock();
+    do {
+        words = 0;
+        for (p = text; *p; ) {
+            if (isalpha((unsigned char)*p) || *p == '_') {
+                for (begin = p; isalnum((unsigned char)*p) || *p == '_'; p++)
+                    ;
+                makeString(begin, p - begin);
+                words++;
+            } else
+                p++;
+        }
+        ops += words;
+    } while (words && seconds(start) < MIN_SECONDS);
+    if (words)
+        report("intern identifiers", ops, seconds(start), probeStats(&vm.strings));
+    free(text);
+}
+
+
+int main(int argc, const char* argv[]) {
+    const char* trace = NULL;
+    int         arg   = 1;
+
+    if (arg + 1 < argc && !strcmp(argv[arg], "--trace")) {
+        trace = argv[arg + 1];
+        arg  += 2;
+    }
+
+    // nano_malloc alone, the heap is reset for each benchmark
+    benchAllocChurn();
+    benchAllocFragmented();
+    if (trace)
+        benchAllocTrace(trace);
+
+    // now with VM, for tables and strings using the heap
+    init_freelist();
+    initVM();
+    benchTableChurn();
+    benchTableLookup(true);
+    benchTableLookup(false);
+    benchInternShort();
+    benchInternSources(argc - arg, argv + arg);
+    return 0;
+}
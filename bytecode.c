@@ -0,0 +1,915 @@
+#ifndef KIT68K
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "compiler.h"
+#include "memory.h"
+#include "native.h"
+#include "peephole.h"
+#include "vm.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// File format, all numbers big endian
+//
+// header:   "LOXC", version, NUM_OPCODES, sizeof(Real), 0, source length (4), source hash (4)
+// function: arity, upvalueCount, name (constant), code count (2), code bytes,
+//           line count (2), line starts (2+2 each), constant count (2), constants
+// constant: 'v' immediate value (4) | 's' length (2), chars | 'r' Real in host byte order
+//           | 'f' function | 'c' function of a closure without upvalues
+//
+// A file is only used when its source length and hash match the source, so a stale .loxc is
+// ignored. It contains the script function of the source with all nested functions. A function
+// inlined by OP_INLINE is written as a copy, see resolveInlined().
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define BYTECODE_VERSION 1
+
+static const char magic[4] = {'L', 'O', 'X', 'C'};
+
+// FNV-1a, independent of the string hash, which may change
+static uint32_t hashSource(const char* source) {
+    uint32_t hash = 2166136261u;
+    while (*source)
+        hash = (hash ^ (uint8_t)*source++) * 16777619u;
+    return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writing
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static FILE* out;
+
+static void writeU8(int n) {
+    putc(n, out);
+}
+
+static void writeU16(int n) {
+    putc((n >> 8) & 0xff, out);
+    putc(n & 0xff, out);
+}
+
+static void writeU32(uint32_t n) {
+    writeU16(n >> 16);
+    writeU16(n & 0xffff);
+}
+
+static bool writeFunction(ObjFunction* function);
+
+static bool writeConstant(Value value) {
+    ObjString* string;
+
+    if (IS_STRING(value)) {
+        string = AS_STRING(value);
+        writeU8('s');
+        writeU16(string->length);
+        fwrite(string->chars, 1, string->length, out);
+    } else if (IS_REAL(value)) {
+        Real real = AS_REAL(value);
+        writeU8('r');
+        fwrite(&real, sizeof(Real), 1, out);
+    } else if (IS_FUNCTION(value)) {
+        writeU8('f');
+        return writeFunction(AS_FUNCTION(value));
+    } else if (IS_CLOSURE(value) && AS_CLOSURE(value)->upvalueCount == 0) {
+        writeU8('c');
+        return writeFunction(AS_CLOSURE(value)->function);
+    } else if (!IS_OBJ(value)) {
+        writeU8('v');
+        writeU32((uint32_t)value);
+    } else
+        return false; // not produced by the compiler
+    return true;
+}
+
+// Code and line starts of chunk, without constants
+static void writeCode(Chunk* chunk) {
+    int i;
+
+    writeU16(chunk->count);
+    fwrite(chunk->code, 1, chunk->count, out);
+    writeU16(chunk->lineCount);
+    for (i = 0; i < chunk->lineCount; i++) {
+        writeU16(chunk->lines[i].offset);
+        writeU16(chunk->lines[i].line);
+    }
+}
+
+static bool writeFunction(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    int    i;
+
+    writeU8(function->arity);
+    writeU8(function->upvalueCount);
+    if (!writeConstant(function->name))
+        return false;
+
+    writeCode(chunk);
+    writeU16(chunk->constants.count);
+    for (i = 0; i < chunk->constants.count; i++)
+        if (!writeConstant(chunk->constants.values[i]))
+            return false;
+    return true;
+}
+
+bool saveBytecode(ObjFunction* function, const char* path, const char* source) {
+    bool ok;
+
+    out = fopen(path, "wb");
+    if (out == NULL)
+        return false;
+    fwrite(magic, 1, sizeof(magic), out);
+    writeU8(BYTECODE_VERSION);
+    writeU8(NUM_OPCODES);
+    writeU8(sizeof(Real));
+    writeU8(0);
+    writeU32((uint32_t)strlen(source));
+    writeU32(hashSource(source));
+    ok = writeFunction(function);
+    ok = !ferror(out) && ok;
+    if (fclose(out) != 0 || !ok) {
+        remove(path);
+        return false;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reading, with all objects created in the Lox heap like the compiler does
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const uint8_t* in;    // next byte to read
+static const uint8_t* inEnd;
+static bool           failed;
+
+static bool available(size_t n) {
+    if (failed || (size_t)(inEnd - in) < n) {
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+static int readU8(void) {
+    return available(1) ? *in++ : 0;
+}
+
+static int readU16(void) {
+    int n;
+    if (!available(2))
+        return 0;
+    n   = (in[0] << 8) | in[1];
+    in += 2;
+    return n;
+}
+
+static uint32_t readU32(void) {
+    uint32_t n = (uint32_t)readU16() << 16;
+    return n | readU16();
+}
+
+static ObjFunction* readFunction(void);
+
+static Value readConstant(void) {
+    int          length;
+    Real         real;
+    ObjFunction* function;
+    ObjClosure*  closure;
+
+    switch (readU8()) {
+        case 's':
+            length = readU16();
+            if (!available(length))
+                return NIL_VAL;
+            in += length;
+            return OBJ_VAL(makeString((const char*)in - length, length));
+
+        case 'r':
+            if (!available(sizeof(Real)))
+                return NIL_VAL;
+            mem_copy(&real, in, sizeof(Real));
+            in += sizeof(Real);
+            return makeReal(real);
+
+        case 'f':
+            function = readFunction();
+            return function ? OBJ_VAL(function) : NIL_VAL;
+
+        case 'c':
+            function = readFunction();
+            if (function == NULL || function->upvalueCount > 0) {
+                failed = true;
+                return NIL_VAL;
+            }
+            pushUnchecked(OBJ_VAL(function));
+            closure = makeClosure(function);
+            drop();
+            return OBJ_VAL(closure);
+
+        case 'v':
+            return (Value)readU32();
+
+        default:
+            failed = true;
+            return NIL_VAL;
+    }
+}
+
+// Counterpart of writeCode()
+static void readCode(Chunk* chunk) {
+    int        count, i;
+    uint8_t*   code;
+    LineStart* lines;
+
+    count = readU16();
+    if (available(count)) {
+        code = ALLOCATE(uint8_t, count);
+        mem_copy(code, in, count);
+        in += count;
+        chunk->code     = code;
+        chunk->count    = count;
+        chunk->capacity = count;
+    }
+
+    count = readU16();
+    if (available(4 * count)) {
+        lines = ALLOCATE(LineStart, count);
+        for (i = 0; i < count; i++) {
+            lines[i].offset = readU16();
+            lines[i].line   = readU16();
+        }
+        chunk->lines        = lines;
+        chunk->lineCount    = count;
+        chunk->lineCapacity = count;
+    }
+}
+
+static bool sameCode(ObjFunction* a, ObjFunction* b) {
+    int i;
+
+    if (a->arity != b->arity || a->upvalueCount != b->upvalueCount
+            || a->chunk.count != b->chunk.count
+            || a->chunk.constants.count != b->chunk.constants.count
+            || !mem_equal(a->chunk.code, b->chunk.code, a->chunk.count))
+        return false;
+    for (i = 0; i < a->chunk.constants.count; i++)
+        if (!constantsEqual(a->chunk.constants.values[i], b->chunk.constants.values[i]))
+            return false;
+    return true;
+}
+
+// The copy of an inlined function read is never the function of the global its OP_INLINE guard
+// compares, so the guard would always call the global. It's replaced by the function the global
+// is bound to when loading, e.g. by a library run before, if that has the same code.
+static void resolveInlined(Chunk* chunk) {
+    Value  global;
+    Value* inlined;
+    int    offset;
+
+    for (offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] != OP_INLINE)
+            continue;
+        inlined = &chunk->constants.values[chunk->code[offset + 2]];
+        if (tableGet(&vm.globals, chunk->constants.values[chunk->code[offset + 1]], &global)
+                && IS_CLOSURE(global)
+                && sameCode(AS_CLOSURE(global)->function, AS_FUNCTION(*inlined)))
+            *inlined = OBJ_VAL(AS_CLOSURE(global)->function);
+    }
+}
+
+static ObjFunction* readFunction(void) {
+    ObjFunction* function = makeFunction();
+    Chunk*       chunk    = &function->chunk;
+    int          count, i;
+    Value        constant;
+
+    push(OBJ_VAL(function)); // protect from GC while loading
+    function->arity        = readU8();
+    function->upvalueCount = readU8();
+    function->name         = readConstant();
+    readCode(chunk);
+
+    count = readU16();
+    for (i = 0; i < count && !failed; i++) {
+        constant = readConstant();
+        pushUnchecked(constant);
+        appendValueArray(&chunk->constants, constant);
+        drop();
+    }
+    freezeValueArray(&chunk->constants);
+    if (!failed)
+        resolveInlined(chunk);
+
+    drop();
+    return failed ? NULL : function;
+}
+
+// Whole file with a single read into a malloced buffer, which becomes the input
+static uint8_t* readAll(const char* path) {
+    FILE*    file = fopen(path, "rb");
+    uint8_t* buffer;
+    long     size;
+
+    if (file == NULL)
+        return NULL;
+    fseek(file, 0L, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    buffer = (uint8_t*)malloc(size > 0 ? size : 1);
+    if (buffer == NULL || fread(buffer, 1, size, file) != (size_t)size) {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    in     = buffer;
+    inEnd  = buffer + size;
+    failed = false;
+    return buffer;
+}
+
+ObjFunction* loadBytecode(const char* path, const char* source) {
+    uint8_t*     buffer = readAll(path);
+    ObjFunction* function = NULL;
+
+    if (buffer == NULL)
+        return NULL;
+    failed = !available(16) || !mem_equal(in, magic, sizeof(magic));
+    if (!failed) {
+        in += sizeof(magic);
+        failed = readU8() != BYTECODE_VERSION || readU8() != NUM_OPCODES
+              || readU8() != sizeof(Real)     || readU8() != 0
+              || readU32() != strlen(source)  || readU32() != hashSource(source);
+    }
+    if (!failed) {
+#ifdef LOX_DBG
+        // like compile(), statistics start with loading
+        vm.allocatedBefore = vm.totallyAllocated;
+        vm.gcsBefore       = vm.numGCs;
+#endif
+        function = readFunction();
+    }
+    free(buffer);
+    return failed ? NULL : function;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Heap images
+//
+// header:  "LOXI", version, NUM_OPCODES, sizeof(Real), 0, object count (4)
+// objects: all objects reachable from the globals and constants, grouped by type in ObjType order,
+//          in two passes: first type and contents without references, creating all objects, then
+//          their references. Objects are referred to by their number, so the image doesn't depend
+//          on addresses. Natives are written by name and bound to the natives of the reading build.
+// globals: count (2), pairs of key and value references
+// constants: like globals, the global constants substituted by the compiler
+// reference: 'o' object number (4) | 'v' immediate value (4)
+//
+// Upvalues are always closed after running a file. Iterators restart before the first slot,
+// as tables are rebuilt, which moves slots with object keys.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define IMAGE_VERSION 2
+
+static const char imageMagic[4] = {'L', 'O', 'X', 'I'};
+
+static Obj**    objects;      // reachable objects, in image order after sorting
+static int32_t* objectIndex;  // hash set of object pointers to their image number
+static Obj**    objectKeys;
+static int      objectCount;
+static int      objectCapacity;
+static int      indexCapacity;
+
+static uint32_t hashPointer(Obj* object) {
+    return ((uint32_t)(size_t)object >> 2) * 2654435761u;
+}
+
+// Number of object, -1 when added just now
+static int32_t* findIndex(Obj* object) {
+    uint32_t i = hashPointer(object) & (indexCapacity - 1);
+
+    while (objectKeys[i] != NULL && objectKeys[i] != object)
+        i = (i + 1) & (indexCapacity - 1);
+    if (objectKeys[i] == NULL) {
+        objectKeys[i]  = object;
+        objectIndex[i] = -1;
+    }
+    return &objectIndex[i];
+}
+
+static bool growObjects(void) {
+    Obj**    oldKeys     = objectKeys;
+    int32_t* oldIndex    = objectIndex;
+    int      oldCapacity = indexCapacity;
+    int      i;
+
+    objectCapacity = objectCapacity ? 2 * objectCapacity : 256;
+    objects        = (Obj**)realloc(objects, objectCapacity * sizeof(Obj*));
+    indexCapacity  = 2 * objectCapacity;
+    objectKeys     = (Obj**)calloc(indexCapacity, sizeof(Obj*));
+    objectIndex    = (int32_t*)malloc(indexCapacity * sizeof(int32_t));
+    if (objects == NULL || objectKeys == NULL || objectIndex == NULL)
+        return false;
+    for (i = 0; i < oldCapacity; i++)
+        if (oldKeys[i] != NULL)
+            *findIndex(oldKeys[i]) = oldIndex[i];
+    free(oldKeys);
+    free(oldIndex);
+    return true;
+}
+
+static void releaseObjects(void) {
+    free(objects);
+    free(objectKeys);
+    free(objectIndex);
+    objects        = objectKeys = NULL;
+    objectIndex    = NULL;
+    objectCount    = objectCapacity = indexCapacity = 0;
+}
+
+// Adds object to the objects still to visit
+static bool visitValue(Value value) {
+    Obj*     object;
+    int32_t* index;
+
+    if (!IS_OBJ(value))
+        return true;
+    object = AS_OBJ(value);
+    if (objectCount == objectCapacity && !growObjects())
+        return false;
+    index = findIndex(object);
+    if (*index >= 0)
+        return true;
+    *index                 = objectCount;
+    objects[objectCount++] = object;
+    return true;
+}
+
+static bool visitTable(Table* table) {
+    int i;
+
+    for (i = 0; i < table->capacity; i++)
+        if (!IS_EMPTY(table->entries[i].key) &&
+            !(visitValue(table->entries[i].key) && visitValue(table->entries[i].value)))
+            return false;
+    return true;
+}
+
+// Visits all objects referenced by object, like blackenObject()
+static bool visitChildren(Obj* object) {
+    ObjFunction* function;
+    ObjClosure*  closure;
+    int          i;
+
+    switch (object->type) {
+        case OBJ_BOUND:
+            return visitValue(((ObjBound*)object)->receiver)
+                && visitValue(OBJ_VAL(((ObjBound*)object)->method));
+
+        case OBJ_CLASS:
+            return visitValue(OBJ_VAL(((ObjClass*)object)->name))
+                && visitValue(OBJ_VAL(((ObjClass*)object)->superClass))
+                && visitTable(&((ObjClass*)object)->methods);
+
+        case OBJ_CLOSURE:
+            closure = (ObjClosure*)object;
+            if (!visitValue(OBJ_VAL(closure->function)))
+                return false;
+            for (i = 0; i < closure->upvalueCount; i++)
+                if (!visitValue(closure->upvalues[i]))
+                    return false;
+            return true;
+
+        case OBJ_DYNVAR:
+            return visitValue(((ObjDynvar*)object)->varName)
+                && visitValue(((ObjDynvar*)object)->previous);
+
+        case OBJ_FUNCTION:
+            function = (ObjFunction*)object;
+            if (function->lazy && !compileBody(function))
+                return false; // lazy body refers to source
+            if (!visitValue(function->name) || !visitValue(OBJ_VAL(function->klass)))
+                return false;
+            for (i = 0; i < function->chunk.constants.count; i++)
+                if (!visitValue(function->chunk.constants.values[i]))
+                    return false;
+            return true;
+
+        case OBJ_INSTANCE:
+            return visitValue(OBJ_VAL(((ObjInstance*)object)->klass))
+                && visitTable(&((ObjInstance*)object)->fields);
+
+        case OBJ_ITERATOR:
+            return visitValue(OBJ_VAL(((ObjIterator*)object)->instance));
+
+        case OBJ_LIST:
+            for (i = 0; i < ((ObjList*)object)->arr.count; i++)
+                if (!visitValue(((ObjList*)object)->arr.values[i]))
+                    return false;
+            return true;
+
+        case OBJ_UPVALUE:
+            return visitValue(*((ObjUpvalue*)object)->location);
+
+        default:
+            return true;
+    }
+}
+
+// Collects all objects reachable from the globals and constants, numbered in image order
+static bool collectObjects(void) {
+    Obj** visited;
+    int   i, type, count;
+
+    releaseObjects();
+    if (!visitTable(&vm.globals) || !visitTable(&vm.constants))
+        return false;
+    for (i = 0; i < objectCount; i++) // objects grows while visiting
+        if (!visitChildren(objects[i]))
+            return false;
+
+    // Group by type, so functions are created before their closures
+    visited = (Obj**)malloc(objectCount * sizeof(Obj*));
+    if (visited == NULL)
+        return false;
+    mem_copy(visited, objects, objectCount * sizeof(Obj*));
+    count = 0;
+    for (type = OBJ_DYNVAR; type <= OBJ_STRING; type++)
+        for (i = 0; i < objectCount; i++)
+            if (visited[i]->type == type) {
+                *findIndex(visited[i]) = count;
+                objects[count++]       = visited[i];
+            }
+    free(visited);
+    return true;
+}
+
+static void writeRef(Value value) {
+    if (IS_OBJ(value)) {
+        writeU8('o');
+        writeU32(*findIndex(AS_OBJ(value)));
+    } else {
+        writeU8('v');
+        writeU32((uint32_t)value);
+    }
+}
+
+static void writeTable(Table* table) {
+    int i, count = 0;
+
+    for (i = 0; i < table->capacity; i++) // count includes tombstones
+        count += !IS_EMPTY(table->entries[i].key);
+    writeU16(count);
+    for (i = 0; i < table->capacity; i++)
+        if (!IS_EMPTY(table->entries[i].key)) {
+            writeRef(table->entries[i].key);
+            writeRef(table->entries[i].value);
+        }
+}
+
+// Contents without references
+static void writeContents(Obj* object) {
+    ObjString*    string;
+    ObjFunction*  function;
+    const Native* native;
+    Real          real;
+
+    writeU8(object->type);
+    switch (object->type) {
+        case OBJ_STRING:
+            string = (ObjString*)object;
+            writeU16(string->length);
+            fwrite(string->chars, 1, string->length, out);
+            break;
+
+        case OBJ_REAL:
+            real = ((ObjReal*)object)->content;
+            fwrite(&real, sizeof(Real), 1, out);
+            break;
+
+        case OBJ_NATIVE:
+            native = (const Native*)object;
+            writeU8(strlen(native->name));
+            fwrite(native->name, 1, strlen(native->name), out);
+            break;
+
+        case OBJ_FUNCTION:
+            function = (ObjFunction*)object;
+            writeU8(function->arity);
+            writeU8(function->upvalueCount);
+            writeCode(&function->chunk);
+            break;
+
+        case OBJ_CLOSURE:
+            writeU32(*findIndex((Obj*)((ObjClosure*)object)->function));
+            break;
+    }
+}
+
+static void writeReferences(Obj* object) {
+    ObjFunction* function;
+    ObjClosure*  closure;
+    int          i;
+
+    switch (object->type) {
+        case OBJ_BOUND:
+            writeRef(((ObjBound*)object)->receiver);
+            writeRef(OBJ_VAL(((ObjBound*)object)->method));
+            break;
+
+        case OBJ_CLASS:
+            writeRef(OBJ_VAL(((ObjClass*)object)->name));
+            writeRef(OBJ_VAL(((ObjClass*)object)->superClass));
+            writeTable(&((ObjClass*)object)->methods);
+            break;
+
+        case OBJ_CLOSURE:
+            closure = (ObjClosure*)object;
+            for (i = 0; i < closure->upvalueCount; i++)
+                writeRef(closure->upvalues[i]);
+            break;
+
+        case OBJ_DYNVAR:
+            writeRef(((ObjDynvar*)object)->varName);
+            writeRef(((ObjDynvar*)object)->previous);
+            break;
+
+        case OBJ_FUNCTION:
+            function = (ObjFunction*)object;
+            writeRef(function->name);
+            writeRef(OBJ_VAL(function->klass));
+            writeU16(function->chunk.constants.count);
+            for (i = 0; i < function->chunk.constants.count; i++)
+                writeRef(function->chunk.constants.values[i]);
+            break;
+
+        case OBJ_INSTANCE:
+            writeRef(OBJ_VAL(((ObjInstance*)object)->klass));
+            writeTable(&((ObjInstance*)object)->fields);
+            break;
+
+        case OBJ_ITERATOR:
+            writeRef(OBJ_VAL(((ObjIterator*)object)->instance));
+            break;
+
+        case OBJ_LIST:
+            writeU16(((ObjList*)object)->arr.count);
+            for (i = 0; i < ((ObjList*)object)->arr.count; i++)
+                writeRef(((ObjList*)object)->arr.values[i]);
+            break;
+
+        case OBJ_UPVALUE:
+            writeRef(*((ObjUpvalue*)object)->location);
+            break;
+    }
+}
+
+// Writes all objects reachable from the globals and constants and these tables themselves
+bool saveHeapImage(const char* path) {
+    bool ok;
+    int  i;
+
+    if (!collectObjects()) {
+        releaseObjects();
+        return false;
+    }
+    out = fopen(path, "wb");
+    if (out == NULL) {
+        releaseObjects();
+        return false;
+    }
+    fwrite(imageMagic, 1, sizeof(imageMagic), out);
+    writeU8(IMAGE_VERSION);
+    writeU8(NUM_OPCODES);
+    writeU8(sizeof(Real));
+    writeU8(0);
+    writeU32(objectCount);
+    for (i = 0; i < objectCount; i++)
+        writeContents(objects[i]);
+    for (i = 0; i < objectCount; i++)
+        writeReferences(objects[i]);
+    writeTable(&vm.globals);
+    writeTable(&vm.constants);
+    releaseObjects();
+
+    ok = !ferror(out);
+    if (fclose(out) != 0 || !ok) {
+        remove(path);
+        return false;
+    }
+    return true;
+}
+
+static ObjList* loaded; // all objects read, in image order, also protecting them from GC
+
+static Value readRef(void) {
+    int      tag = readU8();
+    uint32_t n   = readU32();
+
+    if (tag == 'v')
+        return (Value)n;
+    if (tag == 'o' && n < (uint32_t)loaded->arr.count)
+        return loaded->arr.values[n];
+    failed = true;
+    return NIL_VAL;
+}
+
+static void readTable(Table* table) {
+    int   count = readU16();
+    Value key;
+
+    while (count-- > 0 && !failed) {
+        key = readRef();
+        if (IS_EMPTY(key) || IS_NIL(key))
+            failed = true;
+        else
+            tableSet(table, key, readRef());
+    }
+}
+
+// Creates object from its contents, references still nil
+static Value readContents(void) {
+    char          name[256];
+    int           type = readU8();
+    int           length;
+    uint32_t      n;
+    Real          real;
+    ObjFunction*  function;
+    ObjUpvalue*   upvalue;
+    const Native* native;
+
+    switch (type) {
+        case OBJ_STRING:
+            length = readU16();
+            if (!available(length))
+                return NIL_VAL;
+            in += length;
+            return OBJ_VAL(makeString((const char*)in - length, length));
+
+        case OBJ_REAL:
+            if (!available(sizeof(Real)))
+                return NIL_VAL;
+            mem_copy(&real, in, sizeof(Real));
+            in += sizeof(Real);
+            return makeReal(real);
+
+        case OBJ_NATIVE:
+            length = readU8();
+            if (!available(length))
+                return NIL_VAL;
+            mem_copy(name, in, length);
+            name[length] = '\0';
+            in          += length;
+            native       = findNative(name);
+            if (native == NULL) {
+                fprintf(stderr, "Native %s not available.\n", name);
+                failed = true;
+                return NIL_VAL;
+            }
+            return OBJ_VAL(native);
+
+        case OBJ_FUNCTION:
+            function = makeFunction();
+            push(OBJ_VAL(function));
+            function->arity        = readU8();
+            function->upvalueCount = readU8();
+            readCode(&function->chunk);
+            drop();
+            return OBJ_VAL(function);
+
+        case OBJ_CLOSURE:
+            n = readU32();
+            if (n >= (uint32_t)loaded->arr.count || !IS_FUNCTION(loaded->arr.values[n])) {
+                failed = true;
+                return NIL_VAL;
+            }
+            return OBJ_VAL(makeClosure(AS_FUNCTION(loaded->arr.values[n])));
+
+        case OBJ_UPVALUE:
+            upvalue            = makeUpvalue(NULL);
+            upvalue->uv.closed = NIL_VAL;
+            upvalue->location  = &upvalue->uv.closed;
+            return OBJ_VAL(upvalue);
+
+        case OBJ_BOUND:    return OBJ_VAL(makeBound(NIL_VAL, NULL));
+        case OBJ_CLASS:    return OBJ_VAL(makeClass(NULL));
+        case OBJ_DYNVAR:   return OBJ_VAL(makeDynvar(NIL_VAL, NIL_VAL));
+        case OBJ_INSTANCE: return OBJ_VAL(makeInstance(NULL));
+        case OBJ_ITERATOR: return OBJ_VAL(makeIterator(NULL));
+        case OBJ_LIST:     return OBJ_VAL(makeList(0, NULL, 0, 1));
+
+        default:
+            failed = true;
+            return NIL_VAL;
+    }
+}
+
+static void readReferences(Obj* object) {
+    ObjFunction* function;
+    ObjClosure*  closure;
+    ObjList*     list;
+    Value        value;
+    int          count, i;
+
+    switch (object->type) {
+        case OBJ_BOUND:
+            ((ObjBound*)object)->receiver = readRef();
+            ((ObjBound*)object)->method   = (ObjClosure*)AS_OBJ(readRef());
+            break;
+
+        case OBJ_CLASS:
+            ((ObjClass*)object)->name       = (ObjString*)AS_OBJ(readRef());
+            ((ObjClass*)object)->superClass = (ObjClass*)AS_OBJ(readRef());
+            readTable(&((ObjClass*)object)->methods);
+            break;
+
+        case OBJ_CLOSURE:
+            closure = (ObjClosure*)object;
+            for (i = 0; i < closure->upvalueCount; i++)
+                closure->upvalues[i] = readRef();
+            break;
+
+        case OBJ_DYNVAR:
+            ((ObjDynvar*)object)->varName  = readRef();
+            ((ObjDynvar*)object)->previous = readRef();
+            break;
+
+        case OBJ_FUNCTION:
+            function        = (ObjFunction*)object;
+            function->name  = readRef();
+            function->klass = (ObjClass*)AS_OBJ(readRef());
+            count           = readU16();
+            for (i = 0; i < count && !failed; i++)
+                appendValueArray(&function->chunk.constants, readRef());
+            freezeValueArray(&function->chunk.constants);
+            break;
+
+        case OBJ_INSTANCE:
+            ((ObjInstance*)object)->klass = (ObjClass*)AS_OBJ(readRef());
+            readTable(&((ObjInstance*)object)->fields);
+            break;
+
+        case OBJ_ITERATOR:
+            ((ObjIterator*)object)->instance = (ObjInstance*)AS_OBJ(readRef());
+            break;
+
+        case OBJ_LIST:
+            list  = (ObjList*)object;
+            count = readU16();
+            for (i = 0; i < count && !failed; i++) {
+                value = readRef();
+                appendValueArray(&list->arr, value);
+            }
+            break;
+
+        case OBJ_UPVALUE:
+            ((ObjUpvalue*)object)->uv.closed = readRef();
+            break;
+    }
+}
+
+// Adds all globals and constants of image to those of the VM, creating all objects they refer to
+bool loadHeapImage(const char* path) {
+    uint8_t* buffer = readAll(path);
+    int32_t  count, i;
+    Value    object;
+
+    if (buffer == NULL)
+        return false;
+    failed = !available(12) || !mem_equal(in, imageMagic, sizeof(imageMagic));
+    if (!failed) {
+        in += sizeof(imageMagic);
+        failed = readU8() != IMAGE_VERSION || readU8() != NUM_OPCODES
+              || readU8() != sizeof(Real)  || readU8() != 0;
+    }
+    count = readU32();
+    if (!failed && count > 0x7fff)
+        failed = true; // list of loaded objects too long
+
+    if (!failed) {
+        loaded = makeList(0, NULL, 0, 1);
+        push(OBJ_VAL(loaded));
+        for (i = 0; i < count && !failed; i++) {
+            object = readContents();
+            pushUnchecked(object);
+            appendValueArray(&loaded->arr, object);
+            drop();
+        }
+        for (i = 0; i < count && !failed; i++)
+            readReferences(AS_OBJ(loaded->arr.values[i]));
+        if (!failed)
+            readTable(&vm.globals);
+        if (!failed)
+            readTable(&vm.constants);
+        drop();
+        loaded = NULL;
+    }
+    free(buffer);
+    return !failed;
+}
+
+#endif
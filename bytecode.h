@@ -0,0 +1,16 @@
+#ifndef clox_bytecode_h
+#define clox_bytecode_h
+
+#include "object.h"
+
+// Precompiled script functions in .loxc files and images of the whole heap, only on the host.
+
+#ifndef KIT68K
+
+bool         saveBytecode(ObjFunction* function, const char* path, const char* source);
+ObjFunction* loadBytecode(const char* path, const char* source);
+bool         saveHeapImage(const char* path);
+bool         loadHeapImage(const char* path);
+
+#endif
+#endif
@@ -34,6 +34,13 @@ void freezeChunk(Chunk* chunk) {
     freezeValueArray(&chunk->constants);
 }
 
+void truncateChunk(Chunk* chunk, int count) {
+    // Drop code from offset count on, replaced by the compiler
+    chunk->count = count;
+    while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= count)
+        chunk->lineCount--;
+}
+
 void addBytecode(Chunk* chunk, int byte, int line) {
     int16_t    oldCapacity;
     LineStart* lineStart;
@@ -4,14 +4,20 @@
 #include "opcodes.h"
 #include "value.h"
 
-typedef uint8_t Upvalue; // lower 7 bits index, highest bit set if local
-#define UV_INDEX(u)    ((u)&0x7f)
+typedef uint8_t Upvalue; // lower 6 bits index, highest bit set if local, next if captured flat
+#define UV_INDEX(u)    ((u)&0x3f)
 #define UV_ISLOC(u)    ((u)&0x80)
+#define UV_ISFLAT(u)   ((u)&0x40)
 #define LOCAL_MASK     0x80
+#define FLAT_MASK      0x40
 
 #define ARITY_MASK     0x7f
 #define REST_PARM_MASK 0x80
 
+#define SWITCH_DENSE   0 // OP_SWITCH entry i is for the integer label of entry 0 plus i
+#define SWITCH_HASHED  1 // OP_SWITCH entries by HASH_VALUE of label, probing up to a nil label
+#define CASE_SIZE      4 // bytes of an OP_CASE entry
+
 typedef struct {
     int16_t    offset;
     int16_t    line;
@@ -30,6 +36,7 @@ typedef struct {
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void freezeChunk(Chunk* chunk);
+void truncateChunk(Chunk* chunk, int count);
 void addBytecode(Chunk* chunk, int byte, int line);
 int  addConstant(Chunk* chunk, Value value);
 int  getLine(Chunk* chunk, int offset);
@@ -5,15 +5,22 @@
 #include "compiler.h"
 #include "disasm.h"
 #include "memory.h"
+#include "native.h"
+#include "peephole.h"
 #include "scanner.h"
+#include "timeline.h"
 #include "vm.h"
 
 // Static compiler table limits
 #define MAX_UPVALUES  32 // number of upvalues in a function
 #define MAX_LOCALS    64 // number of local variables in a fucntion
+#define MAX_CONSTS    16 // number of local constants in a function
 #define MAX_BRANCHES 127 // branches per 'case' statement
 #define MAX_LABELS    31 // comparison values per 'case' branch
 #define MAX_BREAKS    16 // number of 'break' statements in a loop
+#define MAX_FOLD_ARGS  3 // arguments of a pure native call evaluated by the compiler
+#define MIN_SWITCH     4 // constant labels of a 'case' statement dispatched by OP_SWITCH
+#define MAX_SWITCH    64 // constant labels of a 'case' statement dispatched by OP_SWITCH
 
 #define PRINT_SEPARATOR "   "
 
@@ -57,8 +64,16 @@ typedef struct {
     Token             name;
     int8_t            depth;
     int8_t            isCaptured; 
+    int8_t            isAssigned;  // after its declaration, else captured flat
+    int16_t           start;       // chunk count at its declaration
 } Local;
 
+typedef struct {
+    Token             name;
+    Value             value;       // substituted for the name
+    int8_t            depth;
+} Const;
+
 typedef struct LoopInfo {
     struct LoopInfo*  enclosing;
     int8_t            scopeDepth;
@@ -72,11 +87,23 @@ typedef struct Compiler {
     FunctionType      type;
     Local             locals[MAX_LOCALS];
     Upvalue           upvalues[MAX_UPVALUES];
+    Const             consts[MAX_CONSTS];
     int8_t            scopeDepth;
     uint8_t           localCount;
+    uint8_t           constCount;
     LoopInfo*         currentLoop;
 } Compiler;
 
+typedef struct {
+    int16_t           code;        // chunk count where operand starts
+    int16_t           constants;   // constants count where operand starts
+} Operand;
+
+typedef struct {
+    Value             label;       // nil for an empty entry
+    int16_t           target;      // chunk count of branch
+} CaseEntry;
+
 typedef struct ClassInfo {
     struct ClassInfo* enclosing;
     bool              hasSuperclass;
@@ -87,11 +114,17 @@ static Parser         parser;
 static Compiler*      currentComp;
 static ClassInfo*     currentClass;
 static Int            lambdaCount;
+static bool           lazyBodies;     // source stays unchanged while running
+static bool           constInit;      // in the initializer of a constant
+static Table          unitConstants;  // global constants declared by the source compiled
+static bool           separate;       // compiled to bytecode, run later in another context
+static Operand        leftOperand;    // of infix rule
 
 // Synthetic tokens (in ROM)
 static const Token synthEmpty = { "",      0, TOKEN_IDENTIFIER, 0};
 static const Token synthThis  = { "this",  4, TOKEN_IDENTIFIER, 0};
 static const Token synthSuper = { "super", 5, TOKEN_IDENTIFIER, 0};
+static const Token synthConst = { "const", 5, TOKEN_IDENTIFIER, 0};
 
 // inlined for IDE68K
 #define currentChunk() (&currentComp->target->chunk)
@@ -238,7 +271,7 @@ static int makeConstant(Value value) {
 static void emitConstant(Value value) {
     if (valuesEqual(value, INT_VAL(0)))
         emitByte(OP_ZERO);
-    else if (IS_INT(value) && AS_INT(value) <= UINT8_MAX)
+    else if (IS_INT(value) && AS_INT(value) >= 0 && AS_INT(value) <= UINT8_MAX)
         emit2Bytes(OP_INT, AS_INT(value));
     else
         emit2Bytes(OP_CONSTANT, makeConstant(value));
@@ -255,31 +288,381 @@ static void patchJump(int offset) {
     cc->code[offset + 1] = jump;
 }
 
+// A function without upvalues gets a single closure as constant, shared by every evaluation
 static void emitClosure(Compiler* compiler) {
-    uint8_t upvalueCount = compiler->target->upvalueCount;
-    uint8_t i;
-
+    uint8_t     upvalueCount = compiler->target->upvalueCount;
+    uint8_t     i;
+    ObjClosure* closure;
+
+    if (upvalueCount == 0) {
+        pushUnchecked(OBJ_VAL(compiler->target)); // not reachable from currentComp any more
+        closure = makeClosure(compiler->target);
+        drop();
+        emit2Bytes(OP_CONSTANT, makeConstant(OBJ_VAL(closure)));
+        return;
+    }
     emit2Bytes(OP_CLOSURE, makeConstant(OBJ_VAL(compiler->target)));
     for (i = 0; i < upvalueCount; i++) 
         emitByte(compiler->upvalues[i]);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Constant folding: operations on constant operands are evaluated by the compiler, replacing
+// the code of the operands. Operations that would raise an error are left to run time.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void markOperand(Operand* operand) {
+    operand->code      = currentChunk()->count;
+    operand->constants = currentChunk()->constants.count;
+}
+
+// Value pushed by the instruction at offset, returns its length or 0 if it isn't a constant
+static int constantAt(int offset, Value* value) {
+    Chunk*   chunk = currentChunk();
+    uint8_t* ip    = chunk->code + offset;
+
+    switch (*ip) {
+        case OP_CONSTANT: *value = chunk->constants.values[ip[1]]; return 2;
+        case OP_INT:      *value = INT_VAL(ip[1]);                 return 2;
+        case OP_ZERO:     *value = INT_VAL(0);                     return 1;
+        case OP_NIL:      *value = NIL_VAL;                        return 1;
+        case OP_TRUE:     *value = TRUE_VAL;                       return 1;
+        case OP_FALSE:    *value = FALSE_VAL;                      return 1;
+        default:          return 0;
+    }
+}
+
+// Values pushed by the code from start up to the end, if it pushes exactly n constants only
+static bool constantOperands(int start, int n, Value* values) {
+    int end = currentChunk()->count;
+    int length;
+
+    for (; n > 0 && start < end; n--) {
+        length = constantAt(start, values++);
+        if (length == 0)
+            return false;
+        start += length;
+    }
+    return n == 0 && start == end;
+}
+
+// Replaces the code of the operands by their result. Constants only used by them are dropped.
+static void emitFolded(const Operand* operand, Value result) {
+    Chunk* chunk = currentChunk();
+
+    pushUnchecked(result);
+    truncateChunk(chunk, operand->code);
+    chunk->constants.count = operand->constants;
+    if (IS_BOOL(result))
+        emitByte(AS_BOOL(result) ? OP_TRUE : OP_FALSE);
+    else if (IS_NIL(result))
+        emitByte(OP_NIL);
+    else
+        emitConstant(result);
+    drop();
+}
+
+static ObjString* foldConcat(ObjString* a, ObjString* b) {
+    // not in big_buffer, which may hold the source
+    int        length = a->length + b->length;
+    char*      chars;
+    ObjString* result;
+
+    if (length >= INPUT_SIZE)
+        return NULL;
+    chars = ALLOCATE(char, length);
+    mem_copy(chars, a->chars, a->length);
+    mem_copy(chars + a->length, b->chars, b->length);
+    result = makeString(chars, length);
+    FREE_ARRAY(char, chars, length);
+    return result;
+}
+
+// A real folded into a constant is shared with an equal real literal of the chunk, unlike the
+// new real computed at run time, which isn't identical to it. The value of a constant stands for
+// a literal anyway.
+static bool foldable(Value result) {
+    return constInit || !IS_REAL(result);
+}
+
+// Result of binary operation op on a and b like at run time
+static bool foldBinary(int op, Value a, Value b, Value* result) {
+    Real       x, y;
+    ObjString* str;
+
+    if (IS_INT(a) && IS_INT(b)) {
+        switch (op) {
+            case OP_EQUAL: *result = BOOL_VAL(valuesEqual(a, b));           return true;
+            case OP_LESS:  *result = BOOL_VAL(AS_INT(a) < AS_INT(b));       return true;
+            case OP_ADD:   *result = INT_VAL(AS_INT(a) + AS_INT(b));        return true;
+            case OP_SUB:   *result = INT_VAL(AS_INT(a) - AS_INT(b));        return true;
+            case OP_MUL:   *result = INT_VAL(AS_INT(a) * AS_INT(b));        return true;
+        }
+        if (AS_INT(b) == 0)
+            return false;
+        *result = INT_VAL(op == OP_DIV ? AS_INT(a) / AS_INT(b) : AS_INT(a) % AS_INT(b));
+        return true;
+    }
+
+    if (op == OP_EQUAL) {
+        *result = BOOL_VAL(valuesEqual(a, b));
+        return true;
+    }
+
+    if (IS_STRING(a) && IS_STRING(b)) {
+        if (op == OP_LESS)
+            *result = BOOL_VAL(strcmp(AS_CSTRING(a), AS_CSTRING(b)) < 0);
+        else if (op == OP_ADD && (str = foldConcat(AS_STRING(a), AS_STRING(b))) != NULL)
+            *result = OBJ_VAL(str);
+        else
+            return false;
+        return true;
+    }
+
+    if (IS_INT(a))       x = intToReal(AS_INT(a));
+    else if (IS_REAL(a)) x = AS_REAL(a);
+    else                 return false;
+    if (IS_INT(b))       y = intToReal(AS_INT(b));
+    else if (IS_REAL(b)) y = AS_REAL(b);
+    else                 return false;
+
+    if (op == OP_LESS) {
+        *result = BOOL_VAL(less(x, y));
+        return true;
+    }
+    errno = 0;
+    switch (op) {
+        case OP_ADD: x = add(x, y); break;
+        case OP_SUB: x = sub(x, y); break;
+        case OP_MUL: x = mul(x, y); break;
+        default:
+            if (y == 0)
+                return false;
+            x = op == OP_DIV ? div(x, y) : mod(x, y);
+            break;
+    }
+    if (errno != 0)
+        return false;
+    *result = makeReal(x);
+    return true;
+}
+
+// Emits op for operands starting at left, with swapped operands and a negated result if set
+static void emitBinary(const Operand* left, int op, bool swap, bool negate) {
+    Value operands[2];
+    Value result;
+
+    if (constantOperands(left->code, 2, operands)
+        && foldBinary(op, operands[swap], operands[!swap], &result) && foldable(result)) {
+        emitFolded(left, negate ? BOOL_VAL(IS_FALSEY(result)) : result);
+        return;
+    }
+    if (swap)
+        emitByte(OP_SWAP);
+    emitByte(op);
+    if (negate)
+        emitByte(OP_NOT);
+}
+
+// Call of a pure native with constant arguments in the initializer of a constant. Elsewhere
+// the global may be bound to something else when the call runs, e.g. by a dynvar expression.
+static bool foldCall(const Operand* callee, int argCount) {
+    Chunk* chunk = currentChunk();
+    Value  values[MAX_FOLD_ARGS + 1]; // result and arguments like on the value stack
+    Value  native;
+
+    if (!constInit || argCount > MAX_FOLD_ARGS || chunk->code[callee->code] != OP_GET_GLOBAL
+        || !constantOperands(callee->code + 2, argCount, values + 1)
+        || !tableGet(&vm.globals, chunk->constants.values[chunk->code[callee->code + 1]], &native)
+        || !IS_NATIVE(native) || !foldNative(AS_NATIVE(native), argCount, values + 1))
+        return false;
+    emitFolded(callee, values[0]);
+    return true;
+}
+
+#ifndef KIT68K
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Inlining, on the host with option -O: a call of a global bound to a small function when the
+// call is compiled is replaced by a copy of its code, which reads the arguments where it read
+// its parameters. OP_INLINE guards the copy and jumps to the call instead when the global has
+// been bound to something else since.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_INLINE      32 // code bytes of a function inlined
+#define MAX_INLINE_ARGS  4 // arguments of a call inlined
+
+static bool inlining;
+
+void setInlining(bool enable) {
+    inlining = enable;
+}
+
+// Length of an instruction accepted by canInline()
+static int inlinedLength(int op) {
+    switch (op) {
+        case OP_INVOKE: case OP_JUMP: case OP_JUMP_OR: case OP_JUMP_AND: case OP_JUMP_TRUE:
+        case OP_JUMP_FALSE: case OP_LOOP:
+            return 3;
+        case OP_CONSTANT: case OP_INT: case OP_GET_LOCAL: case OP_GET_GLOBAL:
+        case OP_GET_PROPERTY: case OP_CALL: case OP_LIST:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+// Length of an argument read in place of its parameter, 0 if it isn't a single instruction
+// reading a value that stays the same. Anything called might change locals and upvalues.
+static int inlinedArgument(int offset, bool calls) {
+    Value value;
+    int   op     = currentChunk()->code[offset];
+    int   length = constantAt(offset, &value);
+
+    if (length == 0 && !calls && (op == OP_GET_LOCAL || op == OP_GET_UPVALUE))
+        length = 2;
+    return length;
+}
+
+// Emits the code of body with its parameters read from args, jumping to its end at each return
+// but the last. The offsets of its instructions when inlined are computed first.
+static void emitInlined(Chunk* body, const uint8_t* args, const int16_t* starts) {
+    int16_t  offsets[MAX_INLINE + 1];
+    uint8_t* code = body->code;
+    int      offset, op, operand, i, target, delta, end = 0;
+    int      start = currentChunk()->count;
+
+    for (offset = 0; offset < body->count; offset += inlinedLength(op)) {
+        op              = code[offset];
+        offsets[offset] = end;
+        if (op == OP_GET_LOCAL)
+            end += starts[code[offset + 1]] - starts[code[offset + 1] - 1];
+        else if (op == OP_RETURN || op == OP_RETURN_NIL)
+            end += (op == OP_RETURN_NIL) + (offset + 1 < body->count ? 3 : 0);
+        else
+            end += inlinedLength(op);
+    }
+    offsets[offset] = end;
+
+    for (offset = 0; offset < body->count; offset += inlinedLength(op)) {
+        op      = code[offset];
+        operand = offset + 1 < body->count ? code[offset + 1] : 0;
+        switch (op) {
+            case OP_GET_LOCAL:
+                for (i = starts[operand - 1]; i < starts[operand]; i++)
+                    emitByte(args[i]);
+                break;
+            case OP_CONSTANT: case OP_GET_GLOBAL: case OP_GET_PROPERTY:
+                emit2Bytes(op, makeConstant(body->constants.values[operand]));
+                break;
+            case OP_INVOKE:
+                emit3Bytes(op, makeConstant(body->constants.values[operand]), code[offset + 2]);
+                break;
+            case OP_JUMP: case OP_JUMP_OR: case OP_JUMP_AND: case OP_JUMP_TRUE: case OP_JUMP_FALSE:
+            case OP_LOOP:
+                delta  = (code[offset + 1] << 8) | code[offset + 2];
+                target = offset + 3 + (op == OP_LOOP ? -delta : delta);
+                delta  = offsets[target] - offsets[offset] - 3;
+                if (op == OP_LOOP)
+                    delta = -delta;
+                emit3Bytes(op, delta >> 8, delta);
+                break;
+            case OP_RETURN: case OP_RETURN_NIL:
+                if (op == OP_RETURN_NIL)
+                    emitByte(OP_NIL);
+                if (offset + 1 < body->count) {
+                    delta = end - (currentChunk()->count - start) - 3;
+                    emit3Bytes(OP_JUMP, delta >> 8, delta);
+                }
+                break;
+            default:
+                for (i = 0; i < inlinedLength(op); i++)
+                    emitByte(code[offset + i]);
+        }
+    }
+}
+
+// Replaces the callee and arguments of a call by the guarded copy of the function bound to the
+// global called, if small enough, followed by the callee and arguments again for the guard.
+// Returns the jump after the call to patch, -1 if not inlined.
+static int inlineCall(const Operand* callee, int argCount) {
+    Chunk*       chunk = currentChunk();
+    ObjFunction* function;
+    Chunk*       body;
+    Value        value;
+    uint8_t      args[2 * MAX_INLINE_ARGS];
+    int16_t      starts[MAX_INLINE_ARGS + 1]; // of each argument in args and their end
+    int          offset, length, name, i, guard, done;
+    bool         calls;
+
+    if (!inlining || argCount > MAX_INLINE_ARGS || chunk->code[callee->code] != OP_GET_GLOBAL)
+        return -1;
+    name = chunk->code[callee->code + 1];
+    if (!tableGet(&vm.globals, chunk->constants.values[name], &value) || !IS_CLOSURE(value))
+        return -1;
+    function = AS_CLOSURE(value)->function;
+    body     = &function->chunk;
+    if (function->arity != argCount || function->upvalueCount > 0 || body->count > MAX_INLINE
+            || chunk->constants.count + body->constants.count >= UINT8_MAX
+            || !canInline(body, 1 + argCount, &calls))
+        return -1;
+
+    // not recursive
+    for (offset = 0; offset < body->count; offset += inlinedLength(body->code[offset]))
+        if (body->code[offset] == OP_GET_GLOBAL
+                && body->constants.values[body->code[offset + 1]] == chunk->constants.values[name])
+            return -1;
+
+    starts[0] = 0;
+    for (i = 0, offset = callee->code + 2; i < argCount && offset < chunk->count; i++) {
+        length = inlinedArgument(offset, calls);
+        if (length == 0)
+            return -1;
+        mem_copy(args + starts[i], chunk->code + offset, length);
+        starts[i + 1] = starts[i] + length;
+        offset       += length;
+    }
+    if (i < argCount || offset != chunk->count)
+        return -1;
+
+    truncateChunk(chunk, callee->code);
+    emit3Bytes(OP_INLINE, name, makeConstant(OBJ_VAL(function)));
+    emit2Bytes(0xff, 0xff);
+    guard = chunk->count - 2;
+    emitInlined(body, args, starts);
+    done = emitJump(OP_JUMP);
+
+    patchJump(guard);
+    emit2Bytes(OP_GET_GLOBAL, name);
+    for (i = 0; i < starts[argCount]; i++)
+        emitByte(args[i]);
+    return done;
+}
+
+#define INLINE_CALL(callee, argCount)  inlineCall(callee, argCount)
+#define LAZY_BODIES                    !inlining // else not compiled in time to be inlined
+#else
+#define INLINE_CALL(callee, argCount)  (-1)
+#define LAZY_BODIES                    true
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Compiler scoping
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void initCompiler(Compiler* compiler, FunctionType type) {
+// Compiles into target when given, a lazy function keeping its name, else into a new function.
+static void initCompiler(Compiler* compiler, FunctionType type, ObjFunction* target) {
     Local* local;
     compiler->enclosing   = currentComp;
     compiler->target      = NULL;
     compiler->type        = type;
     compiler->localCount  = 0;
+    compiler->constCount  = 0;
     compiler->scopeDepth  = 0;
-    compiler->target      = makeFunction();
+    compiler->target      = target ? target : makeFunction();
     compiler->currentLoop = NULL;
     currentComp           = compiler;
 
-    if (type != (FunctionType)FUNT_SCRIPT) {
+    if (type != (FunctionType)FUNT_SCRIPT && target == NULL) {
         if (type == (FunctionType)FUNT_LAMBDA)
             currentComp->target->name = INT_VAL(lambdaCount++);
         else
@@ -290,15 +673,58 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     local = &currentComp->locals[currentComp->localCount++];
     local->depth      = 0;
     local->isCaptured = false;
+    local->isAssigned = false;
+    local->start      = 0;
     local->name       =  *((type >= (FunctionType)FUNT_METHOD) ? &synthThis : &synthEmpty);
     // IDE68K doesn't allow struct in ?: operator, only struct *
 }
 
+// Flat captures: a captured local never assigned is copied into the closures created in its
+// scope when its scope ends, instead of sharing a cell with them. Those closures were compiled
+// already, so their reads of it are rewritten, also in closures they pass it on to.
+
+static void flattenCaptures(Chunk* chunk, int start, int upvalue) {
+    ObjFunction* function;
+    uint8_t*     code;
+    int          offset, i;
+
+    for (offset = start; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        code = chunk->code + offset;
+        if (code[0] == OP_GET_UPVALUE && code[1] == upvalue)
+            code[0] = OP_GET_CAPTURED;
+        else if (code[0] == OP_CLOSURE) {
+            function = AS_FUNCTION(chunk->constants.values[code[1]]);
+            for (i = 0; i < function->upvalueCount; i++)
+                if (code[2 + i] == upvalue) {
+                    code[2 + i] |= FLAT_MASK;
+                    flattenCaptures(&function->chunk, 0, i);
+                }
+        }
+    }
+}
+
+// Returns false if the local captured needs a cell to be closed at the end of its scope
+static bool captureFlat(int slot) {
+    Local* local = &currentComp->locals[slot];
+
+    if (local->isAssigned || parser.hadError)
+        return false;
+    flattenCaptures(currentChunk(), local->start, slot | LOCAL_MASK);
+    return true;
+}
+
 static void endCompiler(bool returnExpr) {
+    int i;
+
+    for (i = 0; i < currentComp->localCount; i++)
+        if (currentComp->locals[i].isCaptured)
+            captureFlat(i); // left on return
     if (returnExpr)
         emitByte(OP_RETURN);
     else
         emitReturn();
+    if (!parser.hadError)
+        optimizeChunk(currentChunk(), 1 + (currentComp->target->arity & ARITY_MASK));
     freezeChunk(currentChunk());
 
 #ifdef LOX_DBG
@@ -315,9 +741,13 @@ static void beginScope(void) {
 
 static void endScope(void) {
     currentComp->scopeDepth--;
+    while (currentComp->constCount > 0 &&
+           currentComp->consts[currentComp->constCount - 1].depth > currentComp->scopeDepth)
+        currentComp->constCount--;
     while (currentComp->localCount > 0 &&
            currentComp->locals[currentComp->localCount - 1].depth > currentComp->scopeDepth) {
-        if (currentComp->locals[currentComp->localCount - 1].isCaptured)
+        if (currentComp->locals[currentComp->localCount - 1].isCaptured
+                && !captureFlat(currentComp->localCount - 1))
             emitByte(OP_CLOSE_UPVALUE);
         else
             emitByte(OP_POP);
@@ -343,12 +773,20 @@ static void  binary(bool canAssign);
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 static void call(bool canAssign) {
-    bool isVarArg = false;
-    int  argCount = argumentList(&isVarArg, TOKEN_RIGHT_PAREN);
+    Operand callee   = leftOperand; // copy struct
+    bool    isVarArg = false;
+    int     argCount = argumentList(&isVarArg, TOKEN_RIGHT_PAREN);
+    int     inlined  = -1;
 
+    if (!isVarArg && foldCall(&callee, argCount))
+        return;
+    if (!isVarArg)
+        inlined = INLINE_CALL(&callee, argCount);
     if      (isVarArg)       emit2Bytes(OP_VCALL,  argCount);
     else if (argCount <= 2)  emitByte  (OP_CALL0 + argCount); // special case 0, 1, or 2 args
     else                     emit2Bytes(OP_CALL,   argCount);
+    if (inlined >= 0)
+        patchJump(inlined);
 }
 
 static void dot(bool canAssign) {
@@ -538,17 +976,14 @@ static void addLocal(const Token* name) {
     local->name       = *name; // copy struct
     local->depth      = -1;
     local->isCaptured = false;
+    local->isAssigned = false;
+    local->start      = currentChunk()->count;
 }
 
-static void declareVariable(void) {
-    const Token* name;
-    int          i;
-    Local*       local;
-
-    if (currentComp->scopeDepth == 0)
-        return;
+static void checkDuplicate(const Token* name) {
+    int    i;
+    Local* local;
 
-    name = &parser.previous;
     for (i = currentComp->localCount - 1; i >= 0; i--) {
         local = &currentComp->locals[i];
         if (local->depth != -1 && local->depth < currentComp->scopeDepth)
@@ -557,25 +992,116 @@ static void declareVariable(void) {
         if (identifiersEqual(name, &local->name))
             error("Duplicate variable name in scope.");
     }
-    addLocal(name);
+    for (i = currentComp->constCount - 1; i >= 0; i--)
+        if (currentComp->consts[i].depth == currentComp->scopeDepth
+                && identifiersEqual(name, &currentComp->consts[i].name))
+            error("Duplicate variable name in scope.");
+}
+
+static void declareVariable(void) {
+    if (currentComp->scopeDepth == 0)
+        return;
+
+    checkDuplicate(&parser.previous);
+    addLocal(&parser.previous);
+}
+
+// Value of a local constant of this or an enclosing function, unless a local variable declared
+// in a scope nested deeper shadows it
+static bool resolveConstant(const Token* name, Value* value) {
+    Compiler* compiler;
+    Local*    local;
+    int       i, depth;
+
+    for (compiler = currentComp; compiler != NULL; compiler = compiler->enclosing) {
+        depth = -2; // of the local variable, none yet
+        for (i = compiler->localCount - 1; i >= 0 && depth == -2; i--) {
+            local = &compiler->locals[i];
+            if (identifiersEqual(name, &local->name))
+                depth = local->depth != -1 ? local->depth : compiler->scopeDepth;
+        }
+        for (i = compiler->constCount - 1; i >= 0; i--)
+            if (identifiersEqual(name, &compiler->consts[i].name)) {
+                *value = compiler->consts[i].value;
+                return compiler->consts[i].depth > depth;
+            }
+        if (depth != -2)
+            return false;
+    }
+    return false;
+}
+
+#ifndef KIT68K
+// Option -c: bytecode may run after other values were declared for the global constants of the
+// sources run before compiling it, so it reads them as globals
+void setSeparateCompilation(bool enable) {
+    separate = enable;
+}
+#endif
+
+// Value of a global constant declared before in this source or by code run before
+static bool globalConstant(Value name, Value* value) {
+    return tableGet(&unitConstants, name, value)
+           || (!separate && tableGet(&vm.constants, name, value));
+}
+
+// Global constants are substituted already by code compiled since, so they stay as they are
+static void checkConstant(int global) {
+    Value value;
+
+    if (globalConstant(currentChunk()->constants.values[global], &value))
+        error("Can't redefine a constant.");
+}
+
+// An assignment to a local, maybe of an enclosing function, keeps it from being captured flat
+static void markAssigned(const Token* name) {
+    Compiler* compiler;
+    int       local;
+
+    for (compiler = currentComp; compiler != NULL; compiler = compiler->enclosing)
+        if ((local = resolveLocal(compiler, name)) != -1) {
+            compiler->locals[local].isAssigned = true;
+            return;
+        }
+}
+
+// Constants are substituted, so that their reads can be folded
+static void constantRead(Value value, bool canAssign) {
+    if (canAssign && match(TOKEN_EQUAL))
+        error("Can't assign to a constant.");
+    emitConstant(value);
 }
 
 static void namedVariable(const Token* name, bool canAssign) {
-    int getOp, setOp;
-    int arg = resolveLocal(currentComp, name);
+    int   getOp, setOp, constants;
+    Value value;
+    int   arg;
 
-    if (arg != -1) {
+    if (resolveConstant(name, &value)) {
+        constantRead(value, canAssign);
+        return;
+    }
+    if ((arg = resolveLocal(currentComp, name)) != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
     } else if ((arg = resolveUpvalue(currentComp, name)) != -1) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg   = identifierConstant(name);
+        constants = currentChunk()->constants.count;
+        arg       = identifierConstant(name);
+        if (globalConstant(currentChunk()->constants.values[arg], &value)) {
+            currentChunk()->constants.count = constants; // name not needed
+            constantRead(value, canAssign);
+            return;
+        }
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
-    if (canAssign && match(TOKEN_EQUAL)) {
+    if (canAssign && check(TOKEN_EQUAL)) {
+        if (setOp != OP_SET_GLOBAL)
+            markAssigned(name); // name may be the previous token
+        advance();
         expression();
         emit2Bytes(setOp, arg);
     } else
@@ -636,14 +1162,24 @@ static void opOr(bool canAssign) {
 }
 
 static void not(bool canAssign) {
+    Operand operand;
+    Value   value;
+
+    markOperand(&operand);
     parsePrecedence(PREC_UNARY);
-    emitByte(OP_NOT);
+    if (constantOperands(operand.code, 1, &value))
+        emitFolded(&operand, BOOL_VAL(IS_FALSEY(value)));
+    else
+        emitByte(OP_NOT);
 }
 
 static void negative(bool canAssign) {
+    Operand zero;
+
+    markOperand(&zero);
     emitConstant(INT_VAL(0)); 
     parsePrecedence(PREC_UNARY);
-    emitByte(OP_SUB);
+    emitBinary(&zero, OP_SUB, false, false);
 }
 
 static void lambda(bool canAssign) {
@@ -654,7 +1190,7 @@ static void buildThunk(void) {
     Compiler compiler;
 
     CHECK_STACKOVERFLOW
-    initCompiler(&compiler, FUNT_LAMBDA);
+    initCompiler(&compiler, FUNT_LAMBDA, NULL);
     beginScope();
     expression();
     endCompiler(true);
@@ -696,6 +1232,7 @@ static void dynvar(bool canAssign) {
     consume(TOKEN_IDENTIFIER, "Expect variable.");
 
     vname = identifierConstant(&parser.previous);
+    checkConstant(vname);
     consumeExp(TOKEN_EQUAL, "variable");
 
     expression();
@@ -787,26 +1324,29 @@ static const ParseRule rules[] = {
 static void binary(bool canAssign) {
     TokenType ot           = parser.previous.type;
     const ParseRule* rule  = getRule(ot);
+    Operand   left         = leftOperand; // copy struct
 
     parsePrecedence((Precedence)(rule->precedence + 1));
-    if      (ot == (TokenType)TOKEN_BANG_EQUAL)    emit2Bytes(OP_EQUAL, OP_NOT);
-    else if (ot == (TokenType)TOKEN_EQUAL_EQUAL)   emitByte  (OP_EQUAL);
-    else if (ot == (TokenType)TOKEN_GREATER)       emit2Bytes(OP_SWAP,  OP_LESS);
-    else if (ot == (TokenType)TOKEN_LESS_EQUAL)    emit3Bytes(OP_SWAP,  OP_LESS, OP_NOT);
-    else if (ot == (TokenType)TOKEN_LESS)          emitByte  (OP_LESS);
-    else if (ot == (TokenType)TOKEN_GREATER_EQUAL) emit2Bytes(OP_LESS,  OP_NOT);
-    else if (ot == (TokenType)TOKEN_PLUS)          emitByte  (OP_ADD);
-    else if (ot == (TokenType)TOKEN_MINUS)         emitByte  (OP_SUB);
-    else if (ot == (TokenType)TOKEN_STAR)          emitByte  (OP_MUL);
-    else if (ot == (TokenType)TOKEN_SLASH)         emitByte  (OP_DIV);
-    else /*if (ot == (TokenType)TOKEN_BACKSLASH:*/ emitByte  (OP_MOD);
+    if      (ot == (TokenType)TOKEN_BANG_EQUAL)    emitBinary(&left, OP_EQUAL, false, true);
+    else if (ot == (TokenType)TOKEN_EQUAL_EQUAL)   emitBinary(&left, OP_EQUAL, false, false);
+    else if (ot == (TokenType)TOKEN_GREATER)       emitBinary(&left, OP_LESS,  true,  false);
+    else if (ot == (TokenType)TOKEN_LESS_EQUAL)    emitBinary(&left, OP_LESS,  true,  true);
+    else if (ot == (TokenType)TOKEN_LESS)          emitBinary(&left, OP_LESS,  false, false);
+    else if (ot == (TokenType)TOKEN_GREATER_EQUAL) emitBinary(&left, OP_LESS,  false, true);
+    else if (ot == (TokenType)TOKEN_PLUS)          emitBinary(&left, OP_ADD,   false, false);
+    else if (ot == (TokenType)TOKEN_MINUS)         emitBinary(&left, OP_SUB,   false, false);
+    else if (ot == (TokenType)TOKEN_STAR)          emitBinary(&left, OP_MUL,   false, false);
+    else if (ot == (TokenType)TOKEN_SLASH)         emitBinary(&left, OP_DIV,   false, false);
+    else /*if (ot == (TokenType)TOKEN_BACKSLASH:*/ emitBinary(&left, OP_MOD,   false, false);
 }
 
 static void parsePrecedence(Precedence precedence) {
     ParseFn prefixRule;
     ParseFn infixRule;
     bool    canAssign;
+    Operand operand;
 
+    markOperand(&operand);
     advance();
     prefixRule = getRule(parser.previous.type)->prefix;
     if (prefixRule == NULL) {
@@ -819,7 +1359,8 @@ static void parsePrecedence(Precedence precedence) {
 
     while (precedence <= getRule(parser.current.type)->precedence) {
         advance();
-        infixRule = getRule(parser.previous.type)->infix;
+        infixRule   = getRule(parser.previous.type)->infix;
+        leftOperand = operand; // copy struct
         (*infixRule)(canAssign);
     }
 
@@ -828,13 +1369,17 @@ static void parsePrecedence(Precedence precedence) {
 }
 
 static int parseVariable(const char* errorMessage) {
+    int global;
+
     consume(TOKEN_IDENTIFIER, errorMessage);
 
     declareVariable();
     if (currentComp->scopeDepth > 0)
         return 0;
 
-    return identifierConstant(&parser.previous);
+    global = identifierConstant(&parser.previous);
+    checkConstant(global);
+    return global;
 }
 
 static void markInitialized(void) {
@@ -888,14 +1433,47 @@ static void block(void) {
     consumeExp(TOKEN_RIGHT_BRACE, "block");
 }
 
-static void function(FunctionType type) {
-    Compiler     compiler;
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Lazy functions: the block body of a function declared at top level, where all names are
+// globals, is skipped and compiled on its first call. Until then its chunk has no code and its
+// LazyBody records where to start.
+
+static bool isLazy(void) {
+    Compiler* enclosing = currentComp->enclosing;
+
+    return lazyBodies && enclosing != NULL && enclosing->type == (FunctionType)FUNT_SCRIPT
+        && enclosing->scopeDepth == 0;
+}
+
+static void skipBody(const Token* start, FunctionType type) {
+    ObjFunction* function = currentComp->target;
+    int          depth    = 0;
+
+    while (!check(TOKEN_EOF) && (depth > 0 || !check(TOKEN_RIGHT_BRACE))) {
+        if (check(TOKEN_LEFT_BRACE))
+            depth++;
+        else if (check(TOKEN_RIGHT_BRACE))
+            depth--;
+        advance();
+    }
+    consumeExp(TOKEN_RIGHT_BRACE, "block");
+
+    function->lazy        = ALLOCATE(LazyBody, 1);
+    function->lazy->start = start->start;
+    function->lazy->line  = start->line;
+    function->lazy->type  = (uint8_t)type;
+    currentComp           = currentComp->enclosing;
+}
+
+// Parameters and body of the current compiler's function, ending it
+static void functionBody(FunctionType type) {
+    Token        start    = parser.previous; // copy struct, name or 'fun'
     int          parameter;
     uint8_t      restParm = 0;
 
-    CHECK_STACKOVERFLOW
-    initCompiler(&compiler, type);
-
     beginScope();
     consumeExp(TOKEN_LEFT_PAREN, "parameters");
     if (!check(TOKEN_RIGHT_PAREN)) {
@@ -920,9 +1498,21 @@ static void function(FunctionType type) {
         endCompiler(true);
     } else {
         consumeExp(TOKEN_LEFT_BRACE, "function body");
-        block();
-        endCompiler(false);
+        if (isLazy())
+            skipBody(&start, type);
+        else {
+            block();
+            endCompiler(false);
+        }
     }
+}
+
+static void function(FunctionType type) {
+    Compiler     compiler;
+
+    CHECK_STACKOVERFLOW
+    initCompiler(&compiler, type, NULL);
+    functionBody(type);
     emitClosure(&compiler);
 }
 
@@ -951,6 +1541,8 @@ static void classDeclaration(void) {
     className    = parser.previous; // copy struct
     nameConstant = identifierConstant(&className);
     declareVariable();
+    if (currentComp->scopeDepth == 0)
+        checkConstant(nameConstant);
 
     emit2Bytes(OP_CLASS, nameConstant);
     defineVariable(nameConstant);
@@ -993,6 +1585,67 @@ static void funDeclaration(void) {
     defineVariable(fname);
 }
 
+// 'const' is no keyword, so it can still name a function. A declaration is followed by a name.
+static bool isConstDeclaration(void) {
+    Token next;
+
+    if (!check(TOKEN_IDENTIFIER) || !identifiersEqual(&parser.current, &synthConst))
+        return false;
+    peekToken(&next);
+    return next.type == (TokenType)TOKEN_IDENTIFIER;
+}
+
+// The value of a constant has to be known when compiling. Local constants take no stack slot,
+// global ones are defined as globals too, for code compiled before. A global constant is
+// registered for code compiled later when its declaration runs, see OP_DEF_CONST, and may be
+// declared again with the same value, e.g. by a library loaded twice.
+static void constDeclaration(void) {
+    Token   name;
+    Operand operand;
+    Value   value = NIL_VAL;
+    Value   previous;
+    Const*  local;
+    int     global;
+    bool    outerConstInit = constInit;
+
+    do {
+        consume(TOKEN_IDENTIFIER, "Expect constant name.");
+        name = parser.previous; // copy struct
+        if (currentComp->scopeDepth > 0)
+            checkDuplicate(&name);
+        consumeExp(TOKEN_EQUAL, "constant name");
+
+        markOperand(&operand);
+        constInit = true;
+        expression();
+        constInit = outerConstInit;
+        if (!constantOperands(operand.code, 1, &value))
+            error("Expect constant expression.");
+
+        if (currentComp->scopeDepth == 0) {
+            global = identifierConstant(&name);
+            if (globalConstant(currentChunk()->constants.values[global], &previous)) {
+                if (!constantsEqual(previous, value))
+                    error("Can't redefine a constant.");
+            } else if (!parser.hadError)
+                tableSet(&unitConstants, currentChunk()->constants.values[global], value);
+            emit2Bytes(OP_DEF_CONST, global);
+        } else {
+            // constants of the expression stay, keeping the value alive
+            truncateChunk(currentChunk(), operand.code);
+            if (currentComp->constCount == MAX_CONSTS) {
+                error("Too many local constants in function.");
+                return;
+            }
+            local        = &currentComp->consts[currentComp->constCount++];
+            local->name  = name; // copy struct
+            local->value = value;
+            local->depth = currentComp->scopeDepth;
+        }
+    } while (match(TOKEN_COMMA));
+    consumeExp(TOKEN_SEMICOLON, "constant declarations");
+}
+
 static void varDeclaration(void) {
     int vname;
 
@@ -1103,6 +1756,89 @@ static void ifStatement(void) {
         patchJump(thenJump);
 }
 
+// Label tests of a case statement from offset, compiled to OP_DUP, constant, OP_EQUAL and
+// OP_JUMP_TRUE to its branch or OP_JUMP_FALSE over it. Returns the code after the last one.
+static int scanLabels(int offset, int labels, CaseEntry* cases, int* count) {
+    uint8_t* code = currentChunk()->code;
+    Value    label = NIL_VAL;
+    int      i, jump, delta;
+
+    *count = 0;
+    while (labels-- > 0) {
+        jump  = offset + 2 + constantAt(offset + 1, &label);
+        delta = (code[jump + 1] << 8) | code[jump + 2];
+        for (i = 0; i < *count && !valuesEqual(cases[i].label, label); i++)
+            ;
+        if (i == *count) { // else the first one is taken
+            cases[i].label  = label;
+            cases[i].target = code[jump] == OP_JUMP_TRUE ? jump + 3 + delta : jump + 3;
+            ++*count;
+        }
+        offset = code[jump] == OP_JUMP_TRUE ? jump + 3 : jump + 3 + delta;
+    }
+    return offset;
+}
+
+// For a case statement with int or string constant labels only, adds an OP_SWITCH jumped to
+// from dispatch at its start. Its table is dense for a compact range of ints, else hashed.
+// The label tests are left unreachable, for the peephole optimizer to drop.
+static void emitSwitch(int dispatch, int labels) {
+    CaseEntry* cases;
+    CaseEntry* table;
+    int        i, n, size, kind, min, max, fallback, skip, delta, nilLabel;
+
+    if (labels < MIN_SWITCH || labels > MAX_SWITCH
+            || currentChunk()->constants.count + labels >= UINT8_MAX)
+        return;
+
+    cases    = ALLOCATE(CaseEntry, labels);
+    fallback = scanLabels(dispatch + 2, labels, cases, &n);
+    kind     = SWITCH_DENSE;
+    min      = max = IS_INT(cases[0].label) ? AS_INT(cases[0].label) : 0;
+    for (i = 0; i < n; i++)
+        if (!IS_INT(cases[i].label))
+            kind = SWITCH_HASHED;
+        else if (AS_INT(cases[i].label) < min)
+            min = AS_INT(cases[i].label);
+        else if (AS_INT(cases[i].label) > max)
+            max = AS_INT(cases[i].label);
+
+    if (kind == SWITCH_DENSE && max - min < 2 * n)
+        size = max - min + 1;
+    else
+        for (kind = SWITCH_HASHED, size = 4; size < n + n / 2; size <<= 1)
+            ;
+    table = ALLOCATE(CaseEntry, size);
+    for (i = 0; i < size; i++) {
+        table[i].label  = NIL_VAL;
+        table[i].target = fallback;
+    }
+    for (i = 0; i < n; i++) {
+        if (kind == SWITCH_DENSE)
+            delta = AS_INT(cases[i].label) - min;
+        else
+            for (delta = HASH_VALUE(cases[i].label) & (size - 1); !IS_NIL(table[delta].label);
+                 delta = (delta + 1) & (size - 1))
+                ;
+        table[delta] = cases[i];
+    }
+
+    skip = emitJump(OP_JUMP); // from the last branch
+    patchJump(dispatch);
+    emit3Bytes(OP_SWITCH, size, kind);
+    nilLabel = makeConstant(NIL_VAL);
+    for (i = 0; i < size; i++) {
+        emit2Bytes(OP_CASE, IS_NIL(table[i].label) ? nilLabel : makeConstant(table[i].label));
+        delta = table[i].target - (currentChunk()->count + 2);
+        emit2Bytes(delta >> 8, delta);
+    }
+    emitLoop(fallback);
+    patchJump(skip);
+
+    FREE_ARRAY(CaseEntry, table, size);
+    FREE_ARRAY(CaseEntry, cases, labels);
+}
+
 static void caseStatement(void) {
     int       state        = 0; // 0: before 'when', 1: before 'else', 2: after 'else'
     int       caseCount    = 0;
@@ -1112,6 +1848,9 @@ static void caseStatement(void) {
     int16_t   caseEnds[MAX_BRANCHES];
     int16_t   whenLabels[MAX_LABELS];
     TokenType caseType;
+    int       dispatch, labels = 0, labelStart;
+    bool      constantLabels   = true;
+    Value     label;
 
     CHECK_STACKOVERFLOW
 
@@ -1124,6 +1863,9 @@ static void caseStatement(void) {
     // reserve one stack slot for case test value
     addLocal(&synthEmpty);
     defineVariable(0);
+    // jumps to the next instruction unless patched by emitSwitch()
+    dispatch = emitJump(OP_JUMP);
+    patchJump(dispatch);
 
     while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
         if (match(TOKEN_WHEN) || match(TOKEN_ELSE)) {
@@ -1146,7 +1888,11 @@ static void caseStatement(void) {
                 state = 1;
                 do {
                     emitByte(OP_DUP);
+                    labelStart = currentChunk()->count;
                     expression();
+                    constantLabels &= constantOperands(labelStart, 1, &label)
+                                      && (IS_INT(label) || IS_STRING(label));
+                    labels++;
                     emitByte(OP_EQUAL);
                     if (check(TOKEN_COMMA)) {
                         // jump over other label tests to statement
@@ -1184,6 +1930,8 @@ static void caseStatement(void) {
     while (caseCount)
         patchJump(caseEnds[--caseCount]);
 
+    if (constantLabels && !parser.hadError)
+        emitSwitch(dispatch, labels);
     endScope();
 }
 
@@ -1265,7 +2013,11 @@ static void declaration(bool topLevel) {
     if      (match(TOKEN_CLASS))  classDeclaration();
     else if (match(TOKEN_FUN))    funDeclaration();
     else if (match(TOKEN_VAR))    varDeclaration();
-    else                          statement(topLevel);
+    else if (isConstDeclaration()) {
+        advance();
+        constDeclaration();
+    } else
+        statement(topLevel);
 
     if (parser.panicMode)
         synchronize();
@@ -1292,28 +2044,187 @@ static void statement(bool topLevel) {
 // Compiler entry
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-ObjFunction* compile(const char* source) {
+// Script function of source starting at line up to end, or to its end when NULL. When autoload
+// is given, it returns the value of this global after running all declarations.
+static ObjFunction* compileScript(const char* source, const char* end, int line, ObjString* autoload) {
     Compiler compiler;
 
+    TIMELINE_BEGIN("compile");
+    initScanner(source, line);
+    initCompiler(&compiler, FUNT_SCRIPT, NULL);
+    initTable(&unitConstants);
+
+    parser.hadError  = false;
+    parser.panicMode = false;
+
+    advance();
+
+    while (!check(TOKEN_EOF) && (end == NULL || parser.current.start < end))
+        declaration(true);
+
+    if (autoload)
+        emit2Bytes(OP_GET_GLOBAL, makeConstant(OBJ_VAL(autoload)));
+    endCompiler(autoload != NULL);
+    freeTable(&unitConstants);
+    TIMELINE_END();
+    return parser.hadError ? NULL : compiler.target;
+}
+
+ObjFunction* compile(const char* source) {
+#ifdef LOX_DBG
+    STATIC_BREAKPOINT();
+    vm.allocatedBefore = vm.totallyAllocated;
+    vm.gcsBefore       = vm.numGCs;
+#endif
+
+    lazyBodies = false;
+    return compileScript(source, NULL, 1, NULL);
+}
+
+// Like compile(), but source stays unchanged while running, so function bodies are compiled
+// when they are called first, unless inlining.
+ObjFunction* compileLazily(const char* source) {
+    ObjFunction* function;
+
 #ifdef LOX_DBG
     STATIC_BREAKPOINT();
-    vm.totallyAllocated = 0;
-    vm.numGCs           = 0;
+    vm.allocatedBefore = vm.totallyAllocated;
+    vm.gcsBefore       = vm.numGCs;
 #endif
 
-    initScanner(source);
-    initCompiler(&compiler, FUNT_SCRIPT);
+    lazyBodies = LAZY_BODIES;
+    function   = compileScript(source, NULL, 1, NULL);
+    lazyBodies = false;
+    return function;
+}
+
+// Compiles body of lazy function. Syntax errors are reported now and leave it lazy.
+bool compileBody(ObjFunction* function) {
+    Compiler     compiler;
+    ClassInfo    classInfo;
+    LazyBody*    lazy = function->lazy;
+    FunctionType type = (FunctionType)lazy->type;
 
+    TIMELINE_BEGIN("compile");
+    initScanner(lazy->start, lazy->line);
     parser.hadError  = false;
     parser.panicMode = false;
-
     advance();
+    advance(); // token before parameters
+
+    classInfo.enclosing     = NULL;
+    classInfo.hasSuperclass = false; // lazy methods are in classes without superclass only
+    currentClass            = type >= (FunctionType)FUNT_METHOD ? &classInfo : NULL;
+    currentComp             = NULL;
+
+    function->arity = 0;
+    function->lazy  = NULL;
+    initCompiler(&compiler, type, function);
+    functionBody(type);
+    currentClass = NULL;
+
+    if (parser.hadError) {
+        freeChunk(&function->chunk);
+        function->lazy = lazy;
+    } else
+        FREE(LazyBody, lazy);
+    TIMELINE_END();
+    return !parser.hadError;
+}
 
-    while (!match(TOKEN_EOF))
-        declaration(true);
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Autoloading: top-level declarations of a library are compiled when their global is read first
+////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    endCompiler(false);
-    return parser.hadError ? NULL : compiler.target;
+// Scans to the next declaration of a global at top level, i.e. 'fun', 'class', 'var' or 'const'
+// followed by a name outside of any brackets. Returns its first token, or TOKEN_EOF, and its name.
+static void nextDeclaration(Token* token, Token* name) {
+    int depth = 0;
+
+    scanToken(token);
+    for (;;) {
+        switch (token->type) {
+            case TOKEN_LEFT_PAREN:
+            case TOKEN_LEFT_BRACE:
+            case TOKEN_LEFT_BRACKET:
+                depth++;
+                break;
+
+            case TOKEN_RIGHT_PAREN:
+            case TOKEN_RIGHT_BRACE:
+            case TOKEN_RIGHT_BRACKET:
+                depth--;
+                break;
+
+            case TOKEN_EOF:
+                return;
+
+            case TOKEN_IDENTIFIER:
+                if (!identifiersEqual(token, &synthConst))
+                    break;
+                /* fall through */
+            case TOKEN_CLASS:
+            case TOKEN_FUN:
+            case TOKEN_VAR:
+                if (depth == 0) {
+                    scanToken(name);
+                    if (name->type == TOKEN_IDENTIFIER)
+                        return;
+                    *token = *name; // lambda, continue with token after 'fun'
+                    continue;
+                }
+                break;
+
+            default:
+                break;
+        }
+        scanToken(token);
+    }
+}
+
+// Index all global declarations of source, which must stay unchanged while running.
+void registerAutoloads(const char* source) {
+    Token token, name;
+
+    vm.autoloadSource = source;
+    initScanner(source, 1);
+    for (;;) {
+        nextDeclaration(&token, &name);
+        if (token.type == TOKEN_EOF)
+            break;
+        push(OBJ_VAL(makeString(name.start, name.length)));
+        tableSet(&vm.autoloads, peek(0), INT_VAL(token.start - source));
+        drop();
+    }
+}
+
+// Compiles declaration of global name up to the next one, once. Running it leaves the value
+// of the global on the stack, so it can replace a failed OP_GET_GLOBAL.
+ObjFunction* compileAutoload(ObjString* name) {
+    Value        offset;
+    Token        token, next;
+    const char*  start;
+    const char*  c;
+    int          line = 1;
+    ObjFunction* function;
+
+    if (!tableGet(&vm.autoloads, OBJ_VAL(name), &offset))
+        return NULL;
+    tableDelete(&vm.autoloads, OBJ_VAL(name));
+
+    start = vm.autoloadSource + AS_INT(offset);
+    for (c = vm.autoloadSource; c < start; c++)
+        if (*c == '\n')
+            line++;
+    initScanner(start, line);
+    scanToken(&token); // the declaring keyword
+    nextDeclaration(&token, &next);
+
+    // compiled in place, as the library stays unchanged
+    lazyBodies = true;
+    function   = compileScript(start, token.start, line, name);
+    lazyBodies = false;
+    return function;
 }
 
 void markCompilerRoots(void) {
@@ -1322,4 +2233,5 @@ void markCompilerRoots(void) {
         markObject((Obj*)compiler->target);
         compiler = compiler->enclosing;
     }
+    markTable(&unitConstants);
 }
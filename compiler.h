@@ -4,6 +4,17 @@
 #include "object.h"
 
 ObjFunction* compile(const char* source);
+ObjFunction* compileLazily(const char* source);
+bool         compileBody(ObjFunction* function);
+void         registerAutoloads(const char* source);
+ObjFunction* compileAutoload(ObjString* name);
 void         markCompilerRoots(void);
 
+#ifndef KIT68K
+// Option -O: inline calls of small functions bound to globals, see compiler.c
+void         setInlining(bool enable);
+// Option -c: don't substitute global constants declared by sources run before
+void         setSeparateCompilation(bool enable);
+#endif
+
 #endif
\ No newline at end of file
@@ -8,7 +8,7 @@ lorom      equ         $40000          ; ROM low address
 hirom      equ         $60000          ; ROM high address
 
 datastart  equ         $02000          ; Data starts here in RAM
-loxlibsrc  equ         $5e000          ; Lox standard library source code in ROM
+loxlibsrc  equ         $5e000          ; Lox standard library source or image in ROM
 
 stklen     equ         $4000           ; Default stacksize
 
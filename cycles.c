@@ -0,0 +1,266 @@
+#if defined(LOX_DBG) && !defined(KIT68K)
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cycles.h"
+#include "nano_malloc.h"
+#include "object.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cost tables, in 68008 clock cycles
+//
+// The 68008 needs 4 clocks per byte on its 8 bit bus, so a long word access costs 16 clocks,
+// and there is neither a cache nor an FPU. The numbers estimate the code IDE68K generates
+// for the Kit build, including kit_util.asm for push and the FFP library for reals.
+// Their relative sizes are estimated from instruction timings, the whole sum is then scaled so
+// that queens(8) of lox/queens.lox matches its 21 seconds on the Kit at the assumed KIT_CLOCK.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define CALIBRATION  8.4  // factor for the sum of all costs below
+
+#define DISPATCH     70   // fetch opcode, check interrupt and stack, jump via table
+
+// Paths depending on operand types
+#define FFP_ADD      300  // FFP library calls for reals
+#define FFP_MUL      420
+#define FFP_DIV      720
+#define FFP_CMP      150
+#define FFP_FLOAT    160  // integer operand converted to real
+#define PER_CHAR     36   // copy, hash and compare for interning a string
+#define PER_ELEMENT  40   // copy a list element
+#define PER_ARGUMENT 24   // push and check an argument
+#define PER_UPVALUE  60   // capture an upvalue for a new closure
+#define PER_FLAT     24   // copy a value captured flat into a new closure
+
+// Natives
+#define NATIVE_CALL  220  // dispatch and signature check
+#define NATIVE_ARG   60   // per argument checked against signature
+
+// nano_malloc and garbage collection
+#define MALLOC_CALL  220
+#define MALLOC_STEP  56   // per free chunk skipped
+#define FREE_CALL    200
+#define FREE_STEP    56   // per free chunk passed while inserting
+#define GC_OBJECT    260  // mark, blacken and sweep a surviving object
+#define GC_ENTRY     40   // scan an entry of the strings table
+
+static const uint16_t opCycles[NUM_OPCODES] = {
+    40,   // OP_CONSTANT
+    30,   // OP_INT
+    20,   // OP_ZERO
+    20,   // OP_NIL
+    20,   // OP_TRUE
+    20,   // OP_FALSE
+    8,    // OP_POP
+    40,   // OP_SWAP
+    24,   // OP_DUP
+    40,   // OP_GET_LOCAL
+    36,   // OP_SET_LOCAL
+    300,  // OP_GET_GLOBAL
+    400,  // OP_DEF_GLOBAL
+    350,  // OP_SET_GLOBAL
+    750,  // OP_DEF_CONST
+    60,   // OP_GET_UPVALUE
+    60,   // OP_SET_UPVALUE
+    48,   // OP_GET_CAPTURED
+    350,  // OP_GET_PROPERTY
+    400,  // OP_SET_PROPERTY
+    400,  // OP_GET_SUPER
+    50,   // OP_EQUAL
+    60,   // OP_LESS
+    60,   // OP_ADD
+    60,   // OP_SUB
+    260,  // OP_MUL, no 32 bit MULS on 68000
+    620,  // OP_DIV, no 32 bit DIVS on 68000
+    620,  // OP_MOD
+    30,   // OP_NOT
+    1500, // OP_PRINT
+    1600, // OP_PRINTLN
+    1600, // OP_PRINTQ
+    30,   // OP_JUMP
+    40,   // OP_JUMP_OR
+    40,   // OP_JUMP_AND
+    40,   // OP_JUMP_TRUE
+    40,   // OP_JUMP_FALSE
+    30,   // OP_LOOP
+    350,  // OP_CALL
+    300,  // OP_CALL0
+    320,  // OP_CALL1
+    340,  // OP_CALL2
+    500,  // OP_CALL_HAND
+    700,  // OP_CALL_BIND
+    700,  // OP_INVOKE
+    700,  // OP_SUPER_INVOKE
+    300,  // OP_CLOSURE
+    150,  // OP_CLOSE_UPVALUE
+    250,  // OP_RETURN
+    230,  // OP_RETURN_NIL
+    300,  // OP_CLASS
+    1000, // OP_INHERIT
+    400,  // OP_METHOD
+    200,  // OP_LIST
+    120,  // OP_GET_INDEX
+    130,  // OP_SET_INDEX
+    400,  // OP_GET_SLICE
+    200,  // OP_UNPACK
+    400,  // OP_VCALL
+    750,  // OP_VINVOKE
+    750,  // OP_VSUPER_INVOKE
+    250,  // OP_VLIST
+    100,  // OP_GET_ITVAL
+    100,  // OP_SET_ITVAL
+    100,  // OP_GET_ITKEY
+    160,  // OP_SWITCH, hash and one or two probes
+    0,    // OP_CASE, never executed
+    330,  // OP_INLINE, like OP_GET_GLOBAL and a compare
+};
+
+// Natives slower than a plain call, mostly by FFP library routines
+static const struct {
+    const char* name;
+    uint16_t    cycles;
+} nativeCycles[] = {
+    {"sqrt",        2600},
+    {"sin",         6500},
+    {"cos",         6500},
+    {"tan",         9000},
+    {"sinh",        9000},
+    {"cosh",        9000},
+    {"tanh",        9500},
+    {"exp",         5000},
+    {"log",         5200},
+    {"atan",        6500},
+    {"pow",        11000},
+    {"trunc",        300},
+    {"dec",         4000},
+    {"parse_real",  3500},
+    {"random",       300},
+    {"clock",        100},
+};
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Estimation
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static NanoCounts countsAtReset;
+
+void resetCycles(void) {
+    vm.cycles     = 0;
+    countsAtReset = nano_counts;
+}
+
+static int32_t arithCycles(uint8_t opcode, Value a, Value b) {
+    int32_t cycles;
+
+    if (IS_STRING(a) && IS_STRING(b))
+        return PER_CHAR * (AS_STRING(a)->length + AS_STRING(b)->length);
+    if (IS_LIST(a) && IS_LIST(b))
+        return PER_ELEMENT * (AS_LIST(a)->arr.count + AS_LIST(b)->arr.count);
+    if (!IS_REAL(a) && !IS_REAL(b))
+        return 0;
+
+    cycles = (IS_INT(a) || IS_INT(b)) ? FFP_FLOAT : 0;
+    switch (opcode) {
+        case OP_ADD:
+        case OP_SUB: return cycles + FFP_ADD;
+        case OP_MUL: return cycles + FFP_MUL;
+        case OP_DIV:
+        case OP_MOD: return cycles + FFP_DIV;
+        default:     return cycles + FFP_CMP;
+    }
+}
+
+static int32_t callCycles(Value callee, int argCount) {
+    const Native* native;
+    int           i;
+    int32_t       cycles = PER_ARGUMENT * argCount;
+
+    if (!IS_NATIVE(callee))
+        return cycles;
+
+    native  = AS_NATIVE(callee);
+    cycles += NATIVE_CALL + NATIVE_ARG * argCount;
+    for (i = 0; i < (int)(sizeof(nativeCycles) / sizeof(nativeCycles[0])); i++)
+        if (!strcmp(nativeCycles[i].name, native->name))
+            return cycles + nativeCycles[i].cycles;
+    return cycles;
+}
+
+// Called before the instruction at frame->ip is executed.
+void estimateOp(CallFrame* frame) {
+    uint8_t  opcode = frame->ip[0];
+    int32_t  cycles = DISPATCH + opCycles[opcode];
+    Value*   consts = frame->closure->function->chunk.constants.values;
+    int      argCount, i;
+
+    switch (opcode) {
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+            cycles += arithCycles(opcode, peek(1), peek(0));
+            break;
+
+        case OP_CALL:
+        case OP_CALL0:
+        case OP_CALL1:
+        case OP_CALL2:
+            argCount = (opcode == OP_CALL) ? frame->ip[1] : opcode - OP_CALL0;
+            cycles  += callCycles(peek(argCount), argCount);
+            break;
+
+        case OP_VCALL:
+            argCount = frame->ip[1] + AS_INT(peek(0));
+            cycles  += callCycles(peek(argCount + 1), argCount);
+            break;
+
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            cycles += PER_ARGUMENT * frame->ip[2];
+            break;
+
+        case OP_CLOSURE:
+            for (i = 0; i < AS_FUNCTION(consts[frame->ip[1]])->upvalueCount; i++)
+                cycles += UV_ISFLAT(frame->ip[2 + i]) ? PER_FLAT : PER_UPVALUE;
+            break;
+
+        case OP_LIST:
+            cycles += PER_ELEMENT * frame->ip[1];
+            break;
+
+        case OP_VLIST:
+            cycles += PER_ELEMENT * (frame->ip[1] + AS_INT(peek(0)));
+            break;
+
+        case OP_UNPACK:
+        case OP_GET_SLICE:
+            if (IS_LIST(peek(opcode == OP_UNPACK ? 0 : 2)))
+                cycles += PER_ELEMENT * AS_LIST(peek(opcode == OP_UNPACK ? 0 : 2))->arr.count;
+            break;
+    }
+    vm.cycles += cycles;
+}
+
+// Called after a garbage collection, when only surviving objects are left.
+void estimateGC(void) {
+    Obj* object;
+
+    for (object = vm.objects; object; object = object->nextObj)
+        vm.cycles += GC_OBJECT;
+    vm.cycles += GC_ENTRY * vm.strings.capacity;
+}
+
+steps_t estimatedCycles(void) {
+    steps_t cycles = vm.cycles
+                   + MALLOC_CALL * (steps_t)(nano_counts.mallocs      - countsAtReset.mallocs)
+                   + MALLOC_STEP * (steps_t)(nano_counts.malloc_steps - countsAtReset.malloc_steps)
+                   + FREE_CALL   * (steps_t)(nano_counts.frees        - countsAtReset.frees)
+                   + FREE_STEP   * (steps_t)(nano_counts.free_steps   - countsAtReset.free_steps);
+    return (steps_t)(cycles * CALIBRATION);
+}
+
+#endif
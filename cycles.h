@@ -0,0 +1,29 @@
+#ifndef clox_cycles_h
+#define clox_cycles_h
+
+#include "vm.h"
+
+// Estimation of 68008 clock cycles while running on the host, reported by dbg_stat.
+// On the Kit, which can simply be timed, the hooks expand to nothing.
+
+#if defined(LOX_DBG) && !defined(KIT68K)
+
+#define KIT_CLOCK 10000000 // Hz, assumed clock of the 68008 Kit
+
+void    resetCycles(void);
+void    estimateOp(CallFrame* frame);
+void    estimateGC(void);
+steps_t estimatedCycles(void);
+
+#define RESET_CYCLES()     resetCycles()
+#define ESTIMATE_OP(frame) if (vm.debug_statistics) estimateOp(frame)
+#define ESTIMATE_GC()      if (vm.debug_statistics) estimateGC()
+
+#else
+
+#define RESET_CYCLES()
+#define ESTIMATE_OP(frame)
+#define ESTIMATE_GC()
+
+#endif
+#endif
@@ -2,7 +2,9 @@
 
 #include <stdio.h>
 #include "disasm.h"
+#include "memory.h"
 #include "object.h"
+#include "vm.h"
 
 static int    offset;
 static Chunk* chunk;
@@ -56,11 +58,115 @@ static void closInst(const char* name) {
     printValue(chunk->constants.values[constant], PRTF_MACHINE | PRTF_COMPACT);
     for (j = 0, ++offset; j < function->upvalueCount; j++, ++offset) {
         upvalue = chunk->code[offset];
-        printf("\n%04d    |   %5s   %4d", offset,
-               UV_ISLOC(upvalue) ? "LOCAL" : "UPVAL", UV_INDEX(upvalue));
+        printf("\n%04d    |   %5s   %4d%s", offset, UV_ISLOC(upvalue) ? "LOCAL" : "UPVAL",
+               UV_INDEX(upvalue), UV_ISFLAT(upvalue) ? " FLAT" : "");
     }
 }
 
+static void switInst(const char* name) {
+    // switch instruction, 2 extra bytes, number of OP_CASE entries following, kind of table
+    int entries = chunk->code[++offset];
+    int kind    = chunk->code[++offset];
+    printf("%-9s %4d ; %s", name, entries, kind == SWITCH_DENSE ? "dense" : "hashed");
+    ++offset;
+}
+
+static void caseInst(const char* name) {
+    // case entry, 3 extra bytes, 0-255 index into constants table, signed jump distance
+    int constant = chunk->code[++offset];
+    int delta    = (int16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-9s %4d ; ", name, constant);
+    printValue(chunk->constants.values[constant], PRTF_MACHINE | PRTF_COMPACT);
+    offset += 3;
+    printf(" -> %d", offset + delta);
+}
+
+static void inlnInst(const char* name) {
+    // inline guard, 4 extra bytes, 0-255 index into constants table for the global and for the
+    // function inlined, 0-65535 jump distance to the call instead
+    int constant = chunk->code[++offset];
+    int delta    = (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+    printf("%-9s %4d ; ", name, constant);
+    printValue(chunk->constants.values[constant], PRTF_MACHINE | PRTF_COMPACT);
+    offset += 4;
+    printf(" -> %d", offset + delta);
+}
+
+// Name and operand format of each instruction, same order as enum OpCode in opcodes.h
+static const struct {
+    const char* name;
+    void        (*format)(const char* name);
+} instructions[NUM_OPCODES] = {
+    {"CONST",     cnstInst},  // OP_CONSTANT
+    {"INT",       byteInst},  // OP_INT
+    {"ZERO",      simpInst},  // OP_ZERO
+    {"NIL",       simpInst},  // OP_NIL
+    {"TRUE",      simpInst},  // OP_TRUE
+    {"FALSE",     simpInst},  // OP_FALSE
+    {"POP",       simpInst},  // OP_POP
+    {"SWAP",      simpInst},  // OP_SWAP
+    {"DUP",       simpInst},  // OP_DUP
+    {"GET_LOC",   byteInst},  // OP_GET_LOCAL
+    {"SET_LOC",   byteInst},  // OP_SET_LOCAL
+    {"GET_GLOB",  cnstInst},  // OP_GET_GLOBAL
+    {"DEF_GLOB",  cnstInst},  // OP_DEF_GLOBAL
+    {"SET_GLOB",  cnstInst},  // OP_SET_GLOBAL
+    {"DEF_CNST",  cnstInst},  // OP_DEF_CONST
+    {"GET_UPVAL", byteInst},  // OP_GET_UPVALUE
+    {"SET_UPVAL", byteInst},  // OP_SET_UPVALUE
+    {"GET_CAPT",  byteInst},  // OP_GET_CAPTURED
+    {"GET_PROP",  cnstInst},  // OP_GET_PROPERTY
+    {"SET_PROP",  cnstInst},  // OP_SET_PROPERTY
+    {"GET_SUPER", cnstInst},  // OP_GET_SUPER
+    {"EQUAL",     simpInst},  // OP_EQUAL
+    {"LESS",      simpInst},  // OP_LESS
+    {"ADD",       simpInst},  // OP_ADD
+    {"SUB",       simpInst},  // OP_SUB
+    {"MUL",       simpInst},  // OP_MUL
+    {"DIV",       simpInst},  // OP_DIV
+    {"MOD",       simpInst},  // OP_MOD
+    {"NOT",       simpInst},  // OP_NOT
+    {"PRINT",     simpInst},  // OP_PRINT
+    {"PRINTLN",   simpInst},  // OP_PRINTLN
+    {"PRINTQ",    simpInst},  // OP_PRINTQ
+    {"JUMP",      jumpInst},  // OP_JUMP
+    {"JUMP_OR",   jumpInst},  // OP_JUMP_OR
+    {"JUMP_AND",  jumpInst},  // OP_JUMP_AND
+    {"JUMP_T",    jumpInst},  // OP_JUMP_TRUE
+    {"JUMP_F",    jumpInst},  // OP_JUMP_FALSE
+    {"LOOP",      jumpInst},  // OP_LOOP
+    {"CALL",      byteInst},  // OP_CALL
+    {"CALL0",     simpInst},  // OP_CALL0
+    {"CALL1",     simpInst},  // OP_CALL1
+    {"CALL2",     simpInst},  // OP_CALL2
+    {"CALL_HAND", simpInst},  // OP_CALL_HAND
+    {"CALL_BIND", cnstInst},  // OP_CALL_BIND
+    {"INVOKE",    invoInst},  // OP_INVOKE
+    {"SUP_INV",   invoInst},  // OP_SUPER_INVOKE
+    {"CLOSURE",   closInst},  // OP_CLOSURE
+    {"CLOSE_UPV", simpInst},  // OP_CLOSE_UPVALUE
+    {"RET",       simpInst},  // OP_RETURN
+    {"RET_NIL",   simpInst},  // OP_RETURN_NIL
+    {"CLASS",     cnstInst},  // OP_CLASS
+    {"INHERIT",   simpInst},  // OP_INHERIT
+    {"METHOD",    cnstInst},  // OP_METHOD
+    {"LIST",      byteInst},  // OP_LIST
+    {"GET_INDEX", simpInst},  // OP_GET_INDEX
+    {"SET_INDEX", simpInst},  // OP_SET_INDEX
+    {"GET_SLICE", simpInst},  // OP_GET_SLICE
+    {"UNPACK",    simpInst},  // OP_UNPACK
+    {"VCALL",     byteInst},  // OP_VCALL
+    {"VINVOKE",   invoInst},  // OP_VINVOKE
+    {"VSUP_INV",  invoInst},  // OP_VSUPER_INVOKE
+    {"VLIST",     byteInst},  // OP_VLIST
+    {"GET_ITVAL", simpInst},  // OP_GET_ITVAL
+    {"SET_ITVAL", simpInst},  // OP_SET_ITVAL
+    {"GET_ITKEY", simpInst},  // OP_GET_ITKEY
+    {"SWITCH",    switInst},  // OP_SWITCH
+    {"CASE",      caseInst},  // OP_CASE
+    {"INLINE",    inlnInst},  // OP_INLINE
+};
+
 static void disassembleIntern(void) {
     int opcd = chunk->code[offset];
     int line = getLine(chunk, offset);
@@ -71,73 +177,11 @@ static void disassembleIntern(void) {
     else
         printf("%4d ", line);
 
-    switch (opcd) {
-        case OP_CONSTANT:      cnstInst("CONST");     break;
-        case OP_INT:           byteInst("INT");       break;
-        case OP_ZERO:          simpInst("ZERO");      break;
-        case OP_NIL:           simpInst("NIL");       break;
-        case OP_TRUE:          simpInst("TRUE");      break;
-        case OP_FALSE:         simpInst("FALSE");     break;
-        case OP_POP:           simpInst("POP");       break;
-        case OP_SWAP:          simpInst("SWAP");      break;
-        case OP_DUP:           simpInst("DUP");       break;
-        case OP_GET_LOCAL:     byteInst("GET_LOC");   break;
-        case OP_SET_LOCAL:     byteInst("SET_LOC");   break;
-        case OP_GET_GLOBAL:    cnstInst("GET_GLOB");  break;
-        case OP_DEF_GLOBAL:    cnstInst("DEF_GLOB");  break;
-        case OP_SET_GLOBAL:    cnstInst("SET_GLOB");  break;
-        case OP_GET_UPVALUE:   byteInst("GET_UPVAL"); break;
-        case OP_SET_UPVALUE:   byteInst("SET_UPVAL"); break;
-        case OP_GET_PROPERTY:  cnstInst("GET_PROP");  break;
-        case OP_SET_PROPERTY:  cnstInst("SET_PROP");  break;
-        case OP_GET_SUPER:     cnstInst("GET_SUPER"); break;
-        case OP_EQUAL:         simpInst("EQUAL");     break;
-        case OP_LESS:          simpInst("LESS");      break;
-        case OP_ADD:           simpInst("ADD");       break;
-        case OP_SUB:           simpInst("SUB");       break;
-        case OP_MUL:           simpInst("MUL");       break;
-        case OP_DIV:           simpInst("DIV");       break;
-        case OP_MOD:           simpInst("MOD");       break;
-        case OP_NOT:           simpInst("NOT");       break;
-        case OP_PRINT:         simpInst("PRINT");     break;
-        case OP_PRINTLN:       simpInst("PRINTLN");   break;
-        case OP_PRINTQ:        simpInst("PRINTQ");    break;
-        case OP_JUMP:          jumpInst("JUMP");      break;
-        case OP_JUMP_OR:       jumpInst("JUMP_OR");   break;
-        case OP_JUMP_AND:      jumpInst("JUMP_AND");  break;
-        case OP_JUMP_TRUE:     jumpInst("JUMP_T");    break;
-        case OP_JUMP_FALSE:    jumpInst("JUMP_F");    break;
-        case OP_LOOP:          jumpInst("LOOP");      break;
-        case OP_CALL:          byteInst("CALL");      break;
-        case OP_CALL0:         simpInst("CALL0");     break;
-        case OP_CALL1:         simpInst("CALL1");     break;
-        case OP_CALL2:         simpInst("CALL2");     break;
-        case OP_CALL_HAND:     simpInst("CALL_HAND"); break;
-        case OP_CALL_BIND:     cnstInst("CALL_BIND"); break;
-        case OP_INVOKE:        invoInst("INVOKE");    break;
-        case OP_SUPER_INVOKE:  invoInst("SUP_INV");   break;
-        case OP_CLOSURE:       closInst("CLOSURE");   break; 
-        case OP_CLOSE_UPVALUE: simpInst("CLOSE_UPV"); break;
-        case OP_RETURN:        simpInst("RET");       break;
-        case OP_RETURN_NIL:    simpInst("RET_NIL");   break;
-        case OP_CLASS:         cnstInst("CLASS");     break;
-        case OP_INHERIT:       simpInst("INHERIT");   break;
-        case OP_METHOD:        cnstInst("METHOD");    break;
-        case OP_LIST:          byteInst("LIST");      break;
-        case OP_GET_INDEX:     simpInst("GET_INDEX"); break;
-        case OP_SET_INDEX:     simpInst("SET_INDEX"); break;
-        case OP_GET_SLICE:     simpInst("GET_SLICE"); break;
-        case OP_UNPACK:        simpInst("UNPACK");    break;
-        case OP_VCALL:         byteInst("VCALL");     break;
-        case OP_VINVOKE:       invoInst("VINVOKE");   break;
-        case OP_VSUPER_INVOKE: invoInst("VSUP_INV");  break;
-        case OP_VLIST:         byteInst("VLIST");     break;
-        case OP_GET_ITVAL:     simpInst("GET_ITVAL"); break;
-        case OP_SET_ITVAL:     simpInst("SET_ITVAL"); break;
-        case OP_GET_ITKEY:     simpInst("GET_ITKEY"); break;
-        default:
-            printf("Unknown opcode %d", opcd);
-            ++offset;
+    if (opcd < NUM_OPCODES)
+        instructions[opcd].format(instructions[opcd].name);
+    else {
+        printf("Unknown opcode %d", opcd);
+        ++offset;
     }
     putstr("\n");
 }
@@ -156,4 +200,198 @@ int disassembleInst(Chunk* pChunk, int pOffset) {
     return offset;
 }
 
-#endif
\ No newline at end of file
+const char* opcodeName(int opcode) {
+    return (opcode >= 0 && opcode < NUM_OPCODES) ? instructions[opcode].name : "???";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Opcode histograms, collected by run() when vm.debug_op_stats is set
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define TOP_PAIRS 24 // number of most frequent opcode pairs printed
+
+void resetOpStats(void) {
+    mem_clear(vm.opCounts, sizeof(vm.opCounts));
+#ifndef KIT68K
+    mem_clear(vm.opPairs, sizeof(vm.opPairs));
+#endif
+    vm.prevOpcode = NUM_OPCODES;
+}
+
+static int percentTimes10(steps_t count, steps_t total) {
+    return total ? (int)(count * 1000 / total) : 0;
+}
+
+#ifdef KIT68K
+#define STEPS_FMT "%10u"
+#else
+#define STEPS_FMT "%10llu"
+#endif
+
+static void printOpTable(steps_t total) {
+    uint8_t order[NUM_OPCODES];
+    int     i, j, best, perc;
+    uint8_t op;
+
+    // Selection sort by descending count, small enough even for the Kit
+    for (i = 0; i < NUM_OPCODES; i++)
+        order[i] = i;
+    for (i = 0; i < NUM_OPCODES - 1; i++) {
+        best = i;
+        for (j = i + 1; j < NUM_OPCODES; j++)
+            if (vm.opCounts[order[j]] > vm.opCounts[order[best]])
+                best = j;
+        op          = order[i];
+        order[i]    = order[best];
+        order[best] = op;
+    }
+
+    printf("== opcodes (" STEPS_FMT " steps) ==\n", total);
+    for (i = 0; i < NUM_OPCODES && vm.opCounts[order[i]]; i++) {
+        perc = percentTimes10(vm.opCounts[order[i]], total);
+        printf("%-9s " STEPS_FMT " %3d.%d%%\n", opcodeName(order[i]), vm.opCounts[order[i]],
+               perc / 10, perc % 10);
+    }
+}
+
+#ifndef KIT68K
+
+static void printPairTable(steps_t total) {
+    bool    printed[NUM_OPCODES][NUM_OPCODES];
+    int     n, i, j, bestI, bestJ, perc;
+    steps_t pairs = 0;
+
+    for (i = 0; i < NUM_OPCODES; i++)
+        for (j = 0; j < NUM_OPCODES; j++)
+            pairs += vm.opPairs[i][j];
+    mem_clear(printed, sizeof(printed));
+
+    printf("== top opcode pairs (" STEPS_FMT " pairs) ==\n", pairs);
+    for (n = 0; n < TOP_PAIRS; n++) {
+        bestI = -1;
+        bestJ = -1;
+        for (i = 0; i < NUM_OPCODES; i++)
+            for (j = 0; j < NUM_OPCODES; j++)
+                if (!printed[i][j] && vm.opPairs[i][j] &&
+                    (bestI < 0 || vm.opPairs[i][j] > vm.opPairs[bestI][bestJ])) {
+                    bestI = i;
+                    bestJ = j;
+                }
+        if (bestI < 0)
+            break;
+        printed[bestI][bestJ] = true;
+        perc = percentTimes10(vm.opPairs[bestI][bestJ], pairs);
+        printf("%-9s %-9s " STEPS_FMT " %3d.%d%%\n", opcodeName(bestI), opcodeName(bestJ),
+               vm.opPairs[bestI][bestJ], perc / 10, perc % 10);
+    }
+}
+
+static bool writeOpStats(const char* fileName) {
+    int   i, j;
+    FILE* file = fopen(fileName, "w");
+
+    if (file == NULL)
+        return false;
+    fprintf(file, "kind,first,second,count\n");
+    for (i = 0; i < NUM_OPCODES; i++)
+        if (vm.opCounts[i])
+            fprintf(file, "op,%s,,%llu\n", opcodeName(i), vm.opCounts[i]);
+    for (i = 0; i < NUM_OPCODES; i++)
+        for (j = 0; j < NUM_OPCODES; j++)
+            if (vm.opPairs[i][j])
+                fprintf(file, "pair,%s,%s,%llu\n", opcodeName(i), opcodeName(j), vm.opPairs[i][j]);
+    fclose(file);
+    return true;
+}
+
+#endif
+
+bool printOpStats(const char* fileName) {
+    int     i;
+    steps_t total = 0;
+
+    for (i = 0; i < NUM_OPCODES; i++)
+        total += vm.opCounts[i];
+
+#ifndef KIT68K
+    if (fileName)
+        return writeOpStats(fileName);
+#endif
+
+    printOpTable(total);
+#ifndef KIT68K
+    printPairTable(total);
+#endif
+    return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Trace ring, written by run() when vm.debug_trace_ring is set
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define TAG_OBJ 4 // tags below for values without object, object type added to it
+
+static const char* tagNames[TAG_OBJ] = {"nil", "bool", "empty", "int"};
+
+static uint8_t valueTag(Value value) {
+    if      (IS_NIL(value))   return 0;
+    else if (IS_BOOL(value))  return 1;
+    else if (IS_EMPTY(value)) return 2;
+    else if (IS_INT(value))   return 3;
+    else                      return TAG_OBJ + OBJ_TYPE(value);
+}
+
+void resetTraceRing(void) {
+    mem_clear(vm.traceRing, sizeof(vm.traceRing));
+    vm.traceNext = 0;
+    vm.traceFull = false;
+}
+
+// Called before the instruction at frame->ip is executed.
+void traceStep(CallFrame* frame) {
+    TraceRecord* record = &vm.traceRing[vm.traceNext];
+    ObjFunction* function = frame->closure->function;
+
+    record->function = function;
+    record->offset   = (uint16_t)(frame->ip - function->chunk.code);
+    record->opcode   = frame->ip[0];
+    record->depth    = (uint16_t)(vm.sp - vm.stack);
+    record->tag      = vm.sp > vm.stack ? valueTag(vm.sp[-1]) : 0;
+    if (++vm.traceNext == TRACE_RING_SIZE) {
+        vm.traceNext = 0;
+        vm.traceFull = true;
+    }
+}
+
+// Functions recorded must survive until the ring is printed
+void markTraceRing(void) {
+    int i;
+    for (i = 0; i < TRACE_RING_SIZE; i++)
+        if (vm.traceRing[i].function)
+            markObject((Obj*)vm.traceRing[i].function);
+}
+
+// Print the last count records, oldest first, decoded by the disassembler.
+void printTraceRing(int count) {
+    int          available = vm.traceFull ? TRACE_RING_SIZE : vm.traceNext;
+    int          index;
+    TraceRecord* record;
+
+    if (count > available)
+        count = available;
+    if (count < 0)
+        count = 0;
+    printf("== last %d steps ==\n", count);
+    index = (vm.traceNext - count + TRACE_RING_SIZE) % TRACE_RING_SIZE;
+    while (count--) {
+        record = &vm.traceRing[index];
+        printf("%-12.12s %4d %-9s ", functionName(record->function), record->depth,
+               record->tag < TAG_OBJ ? tagNames[record->tag] : typeName(record->tag - TAG_OBJ));
+        disassembleInst(&record->function->chunk, record->offset);
+        index = (index + 1) % TRACE_RING_SIZE;
+    }
+}
+
+#endif
@@ -3,9 +3,19 @@
 
 #ifdef LOX_DBG
 #include "chunk.h"
+#include "vm.h"
 
 void disassembleChunk(Chunk* pChunk, const char* name);
 int  disassembleInst( Chunk* pChunk, int pOffset);
 
+const char* opcodeName(int opcode);
+void        resetOpStats(void);
+bool        printOpStats(const char* fileName);
+
+void        resetTraceRing(void);
+void        traceStep(CallFrame* frame);
+void        markTraceRing(void);
+void        printTraceRing(int count);
+
 #endif
 #endif
\ No newline at end of file
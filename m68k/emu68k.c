@@ -0,0 +1,232 @@
+// Minimal 68000 system around the Musashi emulator core for running Lox68k images built by
+// m68k/build, counting clock cycles of the Lox sources run.
+//
+// Usage: emu68k [-v] <image.bin> <source>*
+// - each source is loaded by the REPL with '&<source>', its output is printed to stdout,
+//   its cycle count as a line of JSON to stderr, like llox --bench.
+// - -v also prints banner, prompts and messages of the REPL to stderr.
+//
+// Musashi counts cycles of a 68000 with its 16 bit bus. The 68008 of the Kit needs two
+// bus cycles of 4 clocks for every word, so 4 clocks are added per word accessed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "m68k.h"
+#include "emu_io.h"
+
+#define KIT_CLOCK  10000000 // Hz, same assumption as cycles.h
+#define SLICE      100000   // cycles per call of m68k_execute()
+
+static unsigned char ram[EMU_RAM_SIZE];
+static unsigned long long busCycles;      // extra clocks of 8 bit bus
+static unsigned long long cycles;         // clocks of completed time slices
+static int32_t            args[3];
+static int32_t            result;
+static int                exitCode = -1;  // >= 0 when emulation stopped
+
+static int          verbose;
+static const char** sources;
+static int          sourceCount;
+static int          nextSource;
+static const char*  input = "";            // rest of current input line
+static const char*  running;               // source evaluated, NULL while in REPL
+static unsigned long long started;         // cycles when source was loaded
+static const char*  skip = "";             // message of REPL to skip after load
+
+static unsigned long long now(void) {
+    return cycles + m68k_cycles_run() + busCycles;
+}
+
+static void stop(int code) {
+    exitCode = code;
+    m68k_end_timeslice();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// I/O area
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void putChar(int c) {
+    if (running && *skip == c) // "File loaded.\n" printed by REPL after load
+        skip++;
+    else if (running)
+        putchar(c);
+    else if (verbose)
+        putc(c, stderr);
+}
+
+// The REPL reads its next line after evaluating a source.
+static int getChar(void) {
+    static char line[1024];
+
+    if (running) {
+        fprintf(stderr, "{\"file\": \"%s\", \"ok\": true, \"cycles\": %llu, \"sec\": %.4f}\n",
+                running, now() - started, (double)(now() - started) / KIT_CLOCK);
+        fflush(stdout);
+        running = NULL;
+    }
+    if (*input == '\0') {
+        if (nextSource == sourceCount) {
+            stop(0);
+            return -1;
+        }
+        snprintf(line, sizeof(line), "&%s\n", sources[nextSource++]);
+        input = line;
+    }
+    return (unsigned char)*input++;
+}
+
+static int32_t loadFile(uint32_t name, uint32_t dest, int32_t maxSize) {
+    FILE* file;
+    long  size;
+
+    if (name >= EMU_RAM_SIZE || dest + maxSize > EMU_RAM_SIZE || !memchr(ram + name, 0, EMU_RAM_SIZE - name))
+        return -1;
+    file = fopen((const char*)ram + name, "rb");
+    if (file == NULL)
+        return -1;
+    size = fread(ram + dest, 1, maxSize, file);
+    fclose(file);
+
+    running = sources[nextSource - 1];
+    skip    = "File loaded.\n";
+    started = now();
+    return size;
+}
+
+static void command(int32_t cmd) {
+    switch (cmd) {
+        case EMU_CMD_EXIT: result = 0; stop(args[0]); break;
+        case EMU_CMD_LOAD: result = loadFile(args[0], args[1], args[2]); break;
+        default:           result = -1;
+    }
+}
+
+static uint32_t readIO(uint32_t address) {
+    switch (address) {
+        case EMU_GETCHAR: return getChar();
+        case EMU_COMMAND: return result;
+    }
+    return 0;
+}
+
+static void writeIO(uint32_t address, uint32_t value) {
+    switch (address) {
+        case EMU_PUTCHAR: putChar(value & 0xff);              break;
+        case EMU_ARG0:    args[0] = value;                    break;
+        case EMU_ARG1:    args[1] = value;                    break;
+        case EMU_ARG2:    args[2] = value;                    break;
+        case EMU_COMMAND: command(value);                     break;
+    }
+}
+
+#define IS_IO(address) ((address) >= EMU_IO && (address) < EMU_IO_END)
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory interface required by Musashi, big endian
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+unsigned int m68k_read_memory_8(unsigned int address) {
+    address &= EMU_RAM_SIZE - 1;
+    return IS_IO(address) ? readIO(address) : ram[address];
+}
+
+unsigned int m68k_read_memory_16(unsigned int address) {
+    address   &= EMU_RAM_SIZE - 1;
+    busCycles += 4;
+    if (IS_IO(address))
+        return readIO(address);
+    return (ram[address] << 8) | ram[address + 1];
+}
+
+unsigned int m68k_read_memory_32(unsigned int address) {
+    address   &= EMU_RAM_SIZE - 1;
+    busCycles += 8;
+    if (IS_IO(address))
+        return readIO(address);
+    return ((unsigned)ram[address] << 24) | (ram[address + 1] << 16) |
+           (ram[address + 2] << 8) | ram[address + 3];
+}
+
+void m68k_write_memory_8(unsigned int address, unsigned int value) {
+    address &= EMU_RAM_SIZE - 1;
+    if (IS_IO(address))
+        writeIO(address, value);
+    else
+        ram[address] = value;
+}
+
+void m68k_write_memory_16(unsigned int address, unsigned int value) {
+    address   &= EMU_RAM_SIZE - 1;
+    busCycles += 4;
+    if (IS_IO(address))
+        writeIO(address, value);
+    else {
+        ram[address]     = value >> 8;
+        ram[address + 1] = value;
+    }
+}
+
+void m68k_write_memory_32(unsigned int address, unsigned int value) {
+    address   &= EMU_RAM_SIZE - 1;
+    busCycles += 8;
+    if (IS_IO(address))
+        writeIO(address, value);
+    else {
+        ram[address]     = value >> 24;
+        ram[address + 1] = value >> 16;
+        ram[address + 2] = value >> 8;
+        ram[address + 3] = value;
+    }
+}
+
+unsigned int m68k_read_disassembler_8(unsigned int address) {
+    return ram[address & (EMU_RAM_SIZE - 1)];
+}
+
+unsigned int m68k_read_disassembler_16(unsigned int address) {
+    address &= EMU_RAM_SIZE - 1;
+    return (ram[address] << 8) | ram[address + 1];
+}
+
+unsigned int m68k_read_disassembler_32(unsigned int address) {
+    return (m68k_read_disassembler_16(address) << 16) | m68k_read_disassembler_16(address + 2);
+}
+
+
+int main(int argc, const char* argv[]) {
+    FILE* file;
+    int   arg = 1;
+
+    if (arg < argc && !strcmp(argv[arg], "-v")) {
+        verbose = 1;
+        arg++;
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "Usage: emu68k [-v] <image.bin> <source>*\n");
+        return 10;
+    }
+
+    file = fopen(argv[arg], "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open \"%s\".\n", argv[arg]);
+        return 10;
+    }
+    fread(ram, 1, EMU_IO, file);
+    fclose(file);
+    sources     = argv + arg + 1;
+    sourceCount = argc - arg - 1;
+
+    m68k_init();
+    m68k_set_cpu_type(M68K_CPU_TYPE_68000);
+    m68k_pulse_reset();
+    while (exitCode < 0)
+        cycles += m68k_execute(SLICE);
+
+    if (running)
+        fprintf(stderr, "{\"file\": \"%s\", \"ok\": false}\n", running);
+    return exitCode;
+}
@@ -0,0 +1,25 @@
+#ifndef clox_emu_io_h
+#define clox_emu_io_h
+
+// I/O area of the 68000 emulator emu68k.c, used by kit_gcc.c. Everything else is plain RAM.
+
+#define EMU_RAM_SIZE  0x100000           // 1 MB, vectors at 0
+
+#define EMU_IO        0xf0000            // start of I/O area, also initial stack pointer
+#define EMU_PUTCHAR   (EMU_IO + 0x00)    // write byte:  output character
+#define EMU_GETCHAR   (EMU_IO + 0x04)    // read long:   next input character, -1 at end of input
+#define EMU_ARG0      (EMU_IO + 0x08)    // write long:  arguments of command
+#define EMU_ARG1      (EMU_IO + 0x0c)
+#define EMU_ARG2      (EMU_IO + 0x10)
+#define EMU_COMMAND   (EMU_IO + 0x14)    // write long:  execute command, read long: its result
+#define EMU_IO_END    (EMU_IO + 0x100)   // Kit ports behind, plain RAM here
+
+#define EMU_CMD_EXIT  1                  // stop emulation with exit code ARG0
+#define EMU_CMD_LOAD  2                  // load file named ARG0 to ARG1, max ARG2 bytes, returns size or -1
+
+// Kit ports, see monitor4x.h
+#define EMU_PORT0     (EMU_IO_END + 0)
+#define EMU_PORT1     (EMU_IO_END + 1)
+#define EMU_PORT2     (EMU_IO_END + 2)
+
+#endif
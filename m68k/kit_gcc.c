@@ -0,0 +1,204 @@
+// C replacements for kit_util.asm, ffp_glue.asm, the monitor and newlib system calls,
+// when the Kit configuration is compiled with m68k-elf-gcc to run on emu68k.c.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "emu_io.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define IO_BYTE(address) (*(volatile uint8_t*)(address))
+#define IO_LONG(address) (*(volatile int32_t*)(address))
+
+static int emuCommand(int command, int32_t arg0, int32_t arg1, int32_t arg2) {
+    IO_LONG(EMU_ARG0)    = arg0;
+    IO_LONG(EMU_ARG1)    = arg1;
+    IO_LONG(EMU_ARG2)    = arg2;
+    IO_LONG(EMU_COMMAND) = command;
+    return IO_LONG(EMU_COMMAND);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// kit_util.asm
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void mem_copy(char* dest, const char* src, size_t size) {
+    while (size--)
+        *dest++ = *src++;
+}
+
+void mem_clear(char* dest, size_t size) {
+    memset(dest, 0, size);
+}
+
+int mem_equal(const char* a, const char* b, size_t size) {
+    return !memcmp(a, b, size);
+}
+
+int putstr(const char* str) {
+    return fputs(str, stdout);
+}
+
+bool isObjType(Value value, ObjType type) {
+    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+void push(Value value) {
+    if (vm.sp >= (vm.stack + (STACK_MAX-1))) {
+        vm.hadStackoverflow = true;
+        return;
+    }
+    *vm.sp++ = value;
+}
+
+int loadROM(void) {
+    return -1; // FFP library linked, standard library loaded by '&'
+}
+
+int loadSource(const char* name) {
+    int size = emuCommand(EMU_CMD_LOAD, (int32_t)name, (int32_t)big_buffer, INPUT_SIZE - 1);
+    if (size < 0)
+        return -1;
+    big_buffer[size] = '\0';
+    return 0;
+}
+
+void _stackoverflow(void) {
+    putstr("C stack overflow!\nProgram aborted\n");
+    emuCommand(EMU_CMD_EXIT, 2, 0, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Monitor routines, no LCD and keyboard on emulator
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void lcd_clear(void)                    {}
+void lcd_goto(int x, int y)             {}
+void lcd_puts(const char* str)          {}
+void lcd_defchar(int udc, char* bitmap) {}
+int  monitor_scan(void)                 { return 0xff; }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// ffp_glue.asm
+//
+// Reals are IEEE single precision instead of Motorola FFP, both 32 bits wide, computed by the
+// soft-float routines of libgcc and newlib's libm. Timing differs from the FFP library in ROM.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+char errno; // set on overflow or domain error, like _errno of cstart_common.asm
+
+float sqrtf(float), sinf(float), cosf(float), tanf(float), sinhf(float), coshf(float);
+float tanhf(float), atanf(float), expf(float), logf(float), powf(float, float);
+float strtof(const char*, char**);
+
+typedef union {
+    Real  bits;
+    float value;
+} RealBits;
+
+static float F(Real x) {
+    RealBits r;
+    r.bits = x;
+    return r.value;
+}
+
+static Real R(float x) {
+    RealBits r;
+    r.value = x;
+    if (x != x || (x - x) != 0) // NaN or infinite
+        errno = 1;
+    return r.bits;
+}
+
+Real fabs(Real x)         { return x & 0x7fffffff; }
+Real sqrt(Real x)         { return R(sqrtf(F(x))); }
+Real sin(Real x)          { return R(sinf(F(x))); }
+Real cos(Real x)          { return R(cosf(F(x))); }
+Real tan(Real x)          { return R(tanf(F(x))); }
+Real sinh(Real x)         { return R(sinhf(F(x))); }
+Real cosh(Real x)         { return R(coshf(F(x))); }
+Real tanh(Real x)         { return R(tanhf(F(x))); }
+Real atan(Real x)         { return R(atanf(F(x))); }
+Real exp(Real x)          { return R(expf(F(x))); }
+Real log(Real x)          { return R(logf(F(x))); }
+Real pow(Real x, Real y)  { return R(powf(F(x), F(y))); }
+
+Real add(Real x, Real y)  { return R(F(x) + F(y)); }
+Real sub(Real x, Real y)  { return R(F(x) - F(y)); }
+Real mul(Real x, Real y)  { return R(F(x) * F(y)); }
+Real div(Real x, Real y)  { return R(F(x) / F(y)); }
+int  less(Real x, Real y) { return F(x) < F(y); }
+
+Real intToReal(int n)     { return R((float)n); }
+int  realToInt(Real x)    { return (int)F(x); }
+
+Real strToReal(const char* str, char** endptr) {
+    return R(strtof(str, endptr));
+}
+
+// Same fixed format as ffp_flp_to_asc: s.mmmmmmmmEsdd
+void realToStr(char* str, Real x) {
+    char  digits[20];
+    float value = F(x);
+    int   expo;
+
+    sprintf(digits, "%.7e", (double)(value < 0 ? -value : value)); // d.dddddddesdd
+    expo = atoi(digits + 10) + 1;
+    sprintf(str, "%c.%c%.7sE%c%02d", value < 0 ? '-' : '+', digits[0], digits + 2,
+            expo < 0 ? '-' : '+', expo < 0 ? -expo : expo);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// newlib system calls
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+extern char __heap_start[]; // from kit.ld, for newlib's malloc used by printf
+
+int _write(int file, const char* buf, int len) {
+    int i;
+    for (i = 0; i < len; i++)
+        IO_BYTE(EMU_PUTCHAR) = buf[i];
+    return len;
+}
+
+int _read(int file, char* buf, int len) {
+    int i, c;
+    for (i = 0; i < len; ) {
+        c = IO_LONG(EMU_GETCHAR);
+        if (c < 0)
+            break;
+        buf[i++] = c;
+        if (c == '\n')
+            break;
+    }
+    return i;
+}
+
+void* _sbrk(int increment) {
+    static char* brk = __heap_start;
+    char*        old = brk;
+
+    if (brk + increment >= __stack_limit)
+        return (void*)-1;
+    brk += increment;
+    return old;
+}
+
+void _exit(int status) {
+    for (;;)
+        emuCommand(EMU_CMD_EXIT, status, 0, 0);
+}
+
+int _close(int file)                  { return -1; }
+int _lseek(int file, int ptr, int dir) { return 0; }
+int _isatty(int file)                 { return 1; }
+int _getpid(void)                     { return 1; }
+int _kill(int pid, int sig)           { return -1; }
+
+int _fstat(int file, struct stat* st) {
+    st->st_mode = S_IFCHR;
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef clox_kit_gcc_h
+#define clox_kit_gcc_h
+
+// Replaces IDE68K specific definitions of machine.h for m68k-elf-gcc -m68000, see build.
+// The configuration stays KIT68K, so code and data layout match the Kit's as close as possible.
+
+#include <stdint.h>
+#include <stdlib.h>   // before div is renamed below
+
+typedef short          bool;
+typedef unsigned int   steps_t;
+
+#define true       1
+#define false      0
+
+// IDE68K intrinsics
+#define _word(w)   __asm__ volatile (".word %c0" : : "i" (w))
+#define _trap(n)   __asm__ volatile ("trap #%c0" : : "i" (n))
+
+// FFP routine div() of ffp_glue.h collides with div() of stdlib.h
+#define div        ffp_div
+
+// The IDE68K version depends on the exact size of a jsr, check in C instead.
+extern char __stack_limit[]; // from kit.ld
+#define CHECK_STACKOVERFLOW \
+    if ((char*)__builtin_frame_address(0) < __stack_limit) _stackoverflow();
+
+#endif
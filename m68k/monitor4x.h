@@ -0,0 +1,20 @@
+#ifndef clox_monitor4x_h
+#define clox_monitor4x_h
+
+// Stand-in for the monitor 4.x header of the Kit when compiled by m68k-elf-gcc.
+// The LCD, keyboard and ports don't exist on the emulator, see kit_gcc.c.
+
+#include "emu_io.h"
+
+#define port0      ((volatile uint8_t*)EMU_PORT0)
+#define port1      ((volatile uint8_t*)EMU_PORT1)
+#define port2      ((volatile uint8_t*)EMU_PORT2)
+#define tick_100hz 0x268  // monitor variable counting 100 Hz ticks, never incremented here
+
+void lcd_clear(void);
+void lcd_goto(int x, int y);
+void lcd_puts(const char* str);
+void lcd_defchar(int udc, char* bitmap);
+int  monitor_scan(void);
+
+#endif
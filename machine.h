@@ -9,6 +9,10 @@
 // Wichichote 68008 KIT / IDE68K C compiler specific definitions
 /////////////////////////////////////////////////////////////////
 
+#ifdef __GNUC__
+// Compiled by m68k-elf-gcc for running on a 68000 emulator, see m68k/
+#include "kit_gcc.h"
+#else
 typedef signed char    int8_t;
 typedef unsigned char  uint8_t;
 typedef unsigned short uint16_t;
@@ -25,6 +29,7 @@ typedef unsigned int   steps_t;
 #define UINT8_MAX  0xff
 #define UINT16_MAX 0xffff
 #define INT32_MAX  0x7fffffff
+#endif
 
 #define WRAP_BIG_ENDIAN
 
@@ -50,15 +55,18 @@ extern Real mod(Real a, Real b); // in native.c
 #define STACKLIMIT_ADDR 0x2004
 
 extern void _stackoverflow(void);
+#ifndef CHECK_STACKOVERFLOW
 #define CHECK_STACKOVERFLOW \
   _word(0xbff8); _word(STACKLIMIT_ADDR); \
   _word(0x6c06); \
   _stackoverflow();
+#endif
 
 #define STATIC_BREAKPOINT() _trap(1)
 
 // Using the 100 Hz IRQ as a timer and checking for interrupt button
 #define clock()       (*((int32_t*)tick_100hz))
+#define CLOCK_MS(ticks) ((ticks) * 10)
 #define IRQ2_VECTOR   (*((int32_t*)0x0068))
 #define TRAP1_VECTOR  (*((int32_t*)0x0084))
 #define ON_KIT()      (*((short*)0x0200) == 0x1138)
@@ -106,6 +114,8 @@ typedef double Real;
 #define CHECK_STACKOVERFLOW
 #define STATIC_BREAKPOINT()
 
+#define CLOCK_MS(ticks) ((ticks) / (CLOCKS_PER_SEC / 1000))
+
 // Set by SIGINT handler
 #define INTERRUPTED()       (vm.interrupted)
 
@@ -2,13 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bytecode.h"
+#include "compiler.h"
+#include "disasm.h"
 #include "nano_malloc.h"
 #include "native.h"
 #include "memory.h"
+#include "peephole.h"
+#include "profiler.h"
+#include "romimage.h"
+#include "sampler.h"
+#include "timeline.h"
 #include "vm.h"
 
 #define VERSION "Lox68k 1.7"
 #define AUTHOR  "by Fred Bayer"
+#define SAMPLE_INTERVAL 1000 // usec
 #ifdef LOX_DBG
 #define DBG_STR "debug"
 #else
@@ -19,9 +28,11 @@
 
 #include "monitor4x.h"
 
-static const char* loxLibSrc;
+static const char* loxLibSrc; // source or precompiled image, see makerom.py
 
 int main() {
+    ObjFunction* library;
+
     if (ON_KIT()) { // Running on actual 68008 Kit
         // Welcome message on LCD
         lcd_clear();    lcd_puts(VERSION);
@@ -43,11 +54,17 @@ int main() {
     }
 
     init_freelist();
+    library = loxLibSrc ? openRomImage(loxLibSrc) : NULL;
     initVM();
     printf("%s [%s] %s\n", VERSION, DBG_STR, AUTHOR);
-    if (loxLibSrc) {
-        putstr("Loading standard library.\n");
-        interpret(loxLibSrc);
+    if (library) {
+        putstr("Running standard library from ROM.\n");
+        interpretFunction(library);
+    } else if (loxLibSrc && isRomImage(loxLibSrc)) {
+        putstr("Standard library image in ROM doesn't fit this version.\n");
+    } else if (loxLibSrc) {
+        putstr("Standard library loaded on demand.\n");
+        registerAutoloads(loxLibSrc);
     }
 
     // REPL
@@ -94,11 +111,106 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
-static bool runFile(const char* path) {
-    char* source = readFile(path);
+static bool        benchMode;
+static bool        statsJson;
+static bool        lazyFiles;   // compile function bodies on their first call
+static const char* saveImage;   // heap image written at exit
+static char**      keptSources; // referred to by lazy function bodies, freed at exit
+static int         keptCount;
+
+static void keepSource(char* source) {
+    keptSources = (char**)realloc(keptSources, (keptCount + 1) * sizeof(char*));
+    if (keptSources == NULL) {
+        fprintf(stderr, "Not enough memory to keep source.\n");
+        exit(10);
+    }
+    keptSources[keptCount++] = source;
+}
+
+// One JSON object per file on stderr, collected by bench/bench.py
+static void printBenchStats(const char* path, clock_t started, EvalResult result) {
+    fputs("{\"file\": \"", stderr);
+    for (; *path; path++) {
+        if (*path == '"' || *path == '\\')
+            fputc('\\', stderr);
+        fputc(*path, stderr);
+    }
+    fprintf(stderr, "\", \"ok\": %s, \"sec\": %.4f",
+            result == EVAL_OK ? "true" : "false",
+            (double)(clock() - started) / CLOCKS_PER_SEC);
+#ifdef LOX_DBG
+    fprintf(stderr, ", \"steps\": %llu, \"bytes\": %lu, \"gcs\": %d, \"peak\": %lu",
+            vm.stepsExecuted, (unsigned long)(vm.totallyAllocated - vm.allocatedBefore),
+            vm.numGCs - vm.gcsBefore,
+            (unsigned long)vm.peakAllocated);
+#endif
+    fputs("}\n", stderr);
+}
+
+// Name of precompiled file for path, "<path>c", in big_buffer
+static char* bytecodePath(const char* path) {
+    snprintf(big_buffer, INPUT_SIZE, "%sc", path);
+    return big_buffer;
+}
+
+// Compile source file into "<path>c" without running it
+static bool compileFile(const char* path) {
+    char*        source = readFile(path);
+    ObjFunction* function;
+    bool         ok = false;
+
     if (source) {
-        EvalResult result = interpret(source);
+        function = compile(source);
+        if (function) {
+            ok = saveBytecode(function, bytecodePath(path), source);
+            if (!ok)
+                fprintf(stderr, "Could not write \"%s\".\n", big_buffer);
+        }
         free(source);
+    }
+    return ok;
+}
+
+// Compile source file into ROM image for the host or the Kit
+static bool writeRomFile(const char* image, const char* path, bool forKit) {
+    char*        source = readFile(path);
+    ObjFunction* function;
+    bool         ok = false;
+
+    if (source) {
+        function = compile(source);
+        if (function) {
+            ok = writeRomImage(function, image, forKit);
+            if (!ok)
+                fprintf(stderr, "Could not write \"%s\".\n", image);
+        }
+        free(source);
+    }
+    return ok;
+}
+
+// Uses precompiled "<path>c" instead of compiling when it matches the source
+static bool runFile(const char* path) {
+    char*        source = readFile(path);
+    ObjFunction* function;
+    bool         lazy = false;
+
+    if (source) {
+        clock_t    started = clock();
+        EvalResult result;
+
+        function = loadBytecode(bytecodePath(path), source);
+        if (function == NULL) {
+            function = lazyFiles ? compileLazily(source) : compile(source);
+            lazy     = lazyFiles && function != NULL;
+        }
+        result = function ? interpretFunction(function) : EVAL_COMPILE_ERROR;
+        if (lazy)
+            keepSource(source);
+        else
+            free(source);
+        if (benchMode)
+            printBenchStats(path, started, result);
         return result == EVAL_OK;
     }
     return false;
@@ -119,32 +231,177 @@ static void repl(void) {
     }
 }
 
-// Usage: [lw]loxd? [ <source>* [-]]
+// Heap statistics like native stats() as one JSON object on stderr
+static void printStatsJson(void) {
+    HeapStats stats;
+
+    heapStats(&stats);
+    fprintf(stderr, "{\"heap\": %lu, \"peak\": %lu, \"allocated\": %lu, \"gcs\": %d, "
+            "\"gc_ms\": %d, \"strings\": %d, \"strings_capacity\": %d, \"largest_free\": %lu}\n",
+            (unsigned long)stats.heap, (unsigned long)stats.peak, (unsigned long)stats.allocated,
+            stats.gcs, stats.gcMillis, stats.strings, stats.stringsCapacity,
+            (unsigned long)stats.largestFree);
+}
+
+// Print reports of all profiling modes still active
+static void printReports(void) {
+#ifdef LOX_DBG
+    if (vm.debug_op_stats)
+        printOpStats(NULL);
+    if (vm.debug_profile)
+        printProfile(NULL);
+#endif
+#ifndef _WIN32
+    if (samplerRunning) {
+        stopSampler();
+        printSamples();
+    }
+#endif
+    stopTimeline();
+    if (statsJson)
+        printStatsJson();
+}
+
+// Usage: [lw]loxd? [--rom <image>] [-O] [--lazy] [--sample] [--bench] [--stats-json]
+//                  [--timeline <file>] [--image <file>] [--save-image <file>] [--autoload <source>]
+//                  [ <source>* [-]]
+//        [lw]loxd? [-O] -c <source>*
+//        [lw]loxd? --write-rom [--kit] <image> <source>
 // - starts REPL after loading all sources.
+// - a source is run from its precompiled "<source>c" when that was compiled from the same text.
+// - --lazy compiles top-level function bodies of sources compiled afterwards when they are called
+//   first, reporting their syntax errors only then, not with -O.
+// - -c only compiles each source into "<source>c", reading constants of sources run before
+//   as globals.
+// - -O optimizes locals of everything compiled afterwards and inlines calls of small functions
+//   defined by sources run before, see peephole.c and compiler.c.
+// - --rom runs an image mapped read-only, before anything else (not on Windows).
+// - --write-rom compiles a source into an image for --rom, or with --kit for the Kit's ROM.
+// - --image restores globals and all objects reachable from them from a heap image.
+// - --save-image writes globals and all objects reachable from them as a heap image at exit.
+// - --autoload compiles each global declaration of a library source when it is used first,
+//   only one library.
+// - --sample prints source lines executed most often to stderr at exit (not on Windows).
+// - --bench prints time and, in debug build, steps and allocations of each source to stderr.
+// - --stats-json prints heap statistics like native stats() to stderr at exit.
+// - --timeline <file> writes calls, natives, GCs, compilations and exceptions as Chrome trace events.
 //
 
 int main(int argc, const char* argv[]) {
-    int arg;
+    int          arg     = 1;
+    ObjFunction* library = NULL;
+    const char*  image;
+    char*        source;
 
     init_freelist();
+    if (argc > 2 && !strcmp(argv[1], "--rom")) {
+        // strings of image must be interned before initVM()
+        image   = mapRomImage(argv[2]);
+        library = image ? openRomImage(image) : NULL;
+        if (library == NULL) {
+            fprintf(stderr, "Could not use image \"%s\".\n", argv[2]);
+            exit(10);
+        }
+        arg = 3;
+    }
     initVM();
 
     printf("%s [%s] %s\n", VERSION, DBG_STR, AUTHOR);
-    if (argc == 1)
+    if (library && interpretFunction(library) != EVAL_OK)
+        exit(10);
+    if (arg == argc)
         repl();
     else {
-        for (arg=1; arg<argc; arg++) {
+        for (; arg<argc; arg++) {
+#ifndef _WIN32
+            if (!strcmp(argv[arg], "--sample")) {
+                if (!startSampler(SAMPLE_INTERVAL))
+                    fprintf(stderr, "Could not start sampling.\n");
+                continue;
+            }
+#endif
+            if (!strcmp(argv[arg], "-O")) {
+                setOptimizeLocals(true);
+                setInlining(true);
+                continue;
+            }
+            if (!strcmp(argv[arg], "--lazy")) {
+                lazyFiles = true;
+                continue;
+            }
+            if (!strcmp(argv[arg], "-c")) {
+                setSeparateCompilation(true);
+                while (++arg < argc)
+                    if (!compileFile(argv[arg]))
+                        exit(10);
+                break;
+            }
+            if (!strcmp(argv[arg], "--write-rom")) {
+                bool forKit = arg + 1 < argc && !strcmp(argv[arg + 1], "--kit");
+
+                arg += forKit;
+                if (arg + 2 >= argc || !writeRomFile(argv[arg + 1], argv[arg + 2], forKit))
+                    exit(10);
+                break;
+            }
+            if (!strcmp(argv[arg], "--image") && arg + 1 < argc) {
+                if (!loadHeapImage(argv[++arg])) {
+                    fprintf(stderr, "Could not load image \"%s\".\n", argv[arg]);
+                    exit(10);
+                }
+                continue;
+            }
+            if (!strcmp(argv[arg], "--autoload") && arg + 1 < argc) {
+                if (vm.autoloadSource) {
+                    // its offsets are only valid in the first library
+                    fprintf(stderr, "Only one --autoload library allowed.\n");
+                    exit(10);
+                }
+                source = readFile(argv[++arg]); // kept while running
+                if (source == NULL)
+                    exit(10);
+                registerAutoloads(source);
+                continue;
+            }
+            if (!strcmp(argv[arg], "--save-image") && arg + 1 < argc) {
+                saveImage = argv[++arg];
+                continue;
+            }
+            if (!strcmp(argv[arg], "--stats-json")) {
+                statsJson = true;
+                continue;
+            }
+            if (!strcmp(argv[arg], "--timeline") && arg + 1 < argc) {
+                if (!startTimeline(argv[++arg]))
+                    fprintf(stderr, "Could not open \"%s\".\n", argv[arg]);
+                continue;
+            }
+            if (!strcmp(argv[arg], "--bench")) {
+                benchMode = true;
+#ifdef LOX_DBG
+                vm.debug_count_steps = true;
+#endif
+                continue;
+            }
             if (argv[arg][0] == '-') 
                 repl();
             else {
                 printf("Loading %s\n", argv[arg]);
-                if (!runFile(argv[arg]))
+                if (!runFile(argv[arg])) {
+                    printReports();
                     exit(10);
+                }
             }
         }
     }  
 
+    if (saveImage && !saveHeapImage(saveImage))
+        fprintf(stderr, "Could not write \"%s\".\n", saveImage);
+    printReports();
     freeVM();
+    while (keptCount > 0)
+        free(keptSources[--keptCount]);
+    free(keptSources);
     return 0;
 }
 
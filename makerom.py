@@ -1,13 +1,14 @@
 ### Python script to build a ROM image including Monitor, FFP lib, and Clox68k
 
-import bincopy, os, sys, time
+import bincopy, os, re, sys, time
 
 rom_path = "../roms/"
 rom_base = 0x40000
 
-lib_file = "lox/stdlib_68k.lox"
-lib_base = 0x5e000 # must be same as loxlibsrc in cstart_lox_rom.asm  
-lib_max  = 0x5f000 # maximum address of library, math FFP starts here  
+lib_file  = "lox/stdlib_68k.lox"
+lib_image = "lox/stdlib_68k.img" # precompiled by: llox --write-rom --kit lox/stdlib_68k.img lox/stdlib_68k.lox
+lib_base  = 0x5e000 # must be same as loxlibsrc in cstart_common.asm and ROM_IMAGE_KIT in romimage.h
+lib_max   = 0x5f000 # maximum address of library, math FFP starts here  
 
 ## Based on Monitor ROM with FFP library.
 rom = bincopy.BinFile()
@@ -16,8 +17,34 @@ rom.add_binary_file(rom_path + "mon_ffp.bin", rom_base)
 ## Add Lox68k binaries.
 rom.add_file("clox.hex", overwrite = True)
 rom.add_file("clox_dbg.hex", overwrite = True)
+if bincopy.BinFile("clox.hex").maximum_address > lib_base:
+    print("clox.hex overlaps library, change lib_base")
+    sys.exit(10)
 
-## Add Lox standard library source
+## Version of images the interpreter accepts, see romimage.c
+def rom_version():
+    with open("romimage.c") as src:
+        return int(re.search(r"#define ROM_VERSION (\d+)", src.read()).group(1))
+
+## Reason why the library image can't be used in place of its source, or None
+def image_problem():
+    with open(lib_image, "rb") as src:
+        header = src.read(5)
+    if len(header) < 5 or header[:4] != b"LXRM" or header[4] != rom_version():
+        return "written by another version"
+    if os.path.getmtime(lib_image) < os.path.getmtime(lib_file):
+        return "older than " + lib_file
+    if lib_base + os.path.getsize(lib_image) >= lib_max:
+        return "too large"
+    return None
+
+## Add Lox standard library, precompiled image used in place when usable, else source
+if os.path.exists(lib_image):
+    problem = image_problem()
+    if problem:
+        print("{} {}, using source.".format(lib_image, problem))
+    else:
+        lib_file = lib_image
 lib_size = 0
 try:
     lib_size = os.stat(lib_file).st_size
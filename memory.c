@@ -2,7 +2,11 @@
 #include <stdio.h>
 
 #include "compiler.h"
+#include "cycles.h"
+#include "disasm.h"
 #include "memory.h"
+#include "sampler.h"
+#include "timeline.h"
 #include "vm.h"
 #include "nano_malloc.h"
 
@@ -42,9 +46,9 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
         }
     }
 
-#ifdef LOX_DBG
     vm.totallyAllocated += newSize;
-#endif
+    if (vm.bytesAllocated > vm.peakAllocated)
+        vm.peakAllocated = vm.bytesAllocated;
 
     if (oldSize != 0) {
         mem_copy(result, pointer, (oldSize < newSize) ? oldSize : newSize);
@@ -113,7 +117,7 @@ static void blackenObject(Obj* object) {
         case OBJ_CLOSURE:
             markObject((Obj*)((ObjClosure*)object)->function);
             for (i = 0; i < ((ObjClosure*)object)->upvalueCount; i++)
-                markObject((Obj*)((ObjClosure*)object)->upvalues[i]);
+                markValue(((ObjClosure*)object)->upvalues[i]);
             break;
 
         case OBJ_DYNVAR:
@@ -165,7 +169,7 @@ static void freeObject(Obj* object) {
 
         case OBJ_CLOSURE:
             reallocate(object, sizeof(ObjClosure)  +
-                               sizeof(ObjUpvalue*) * ((ObjClosure*)object)->upvalueCount, 0);  
+                               sizeof(Value) * ((ObjClosure*)object)->upvalueCount, 0);  
             break;
 
         case OBJ_DYNVAR:
@@ -174,6 +178,8 @@ static void freeObject(Obj* object) {
 
         case OBJ_FUNCTION:
             freeChunk(&((ObjFunction*)object)->chunk);
+            if (((ObjFunction*)object)->lazy)
+                FREE(LazyBody, ((ObjFunction*)object)->lazy);
             FREE(ObjFunction, object);
             break;
 
@@ -191,10 +197,6 @@ static void freeObject(Obj* object) {
             FREE(ObjList, object);
             break;
 
-        case OBJ_NATIVE:
-            FREE(ObjNative, object);
-            break;
-
         case OBJ_REAL:
             FREE(ObjReal, object);
             break;
@@ -227,8 +229,13 @@ static void markRoots(void) {
         markObject((Obj*)upvalue);
 
     markTable(&vm.globals);
+    markTable(&vm.autoloads);
+    markTable(&vm.constants);
     markCompilerRoots();
     markObject((Obj*)vm.initString);
+#ifdef LOX_DBG
+    markTraceRing();
+#endif
 }
 
 static void traceReferences(void) {
@@ -261,17 +268,27 @@ static void sweep(void) {
 }
 
 void collectGarbage(bool checkReclaim) {
-    size_t before = vm.bytesAllocated;
+    size_t  before  = vm.bytesAllocated;
+    clock_t started = clock();
 
 #ifdef LOX_DBG
     if (vm.debug_log_gc & DBG_GC_GENERAL)
         putstr("GC >>> begin\n");
 #endif
 
+    TIMELINE_BEGIN("gc");
+    DRAIN_SAMPLES();
+    TIMELINE_BEGIN("mark");
     markRoots();
     traceReferences();
+    TIMELINE_END();
+    TIMELINE_BEGIN("weak strings");
     tableRemoveWhite(&vm.strings); // making vm.strings a weak hash-table
+    TIMELINE_END();
+    TIMELINE_BEGIN("sweep");
     sweep();
+    TIMELINE_END();
+    ESTIMATE_GC();
 
     if (checkReclaim && before == vm.bytesAllocated) {
         putstr("GC failed to reclaim enough space, exiting.\n");
@@ -289,11 +306,30 @@ void collectGarbage(bool checkReclaim) {
 #ifdef LOX_DBG
     if (!(vm.debug_log_gc & DBG_GC_STRESS)) // Avoid endless recursion
         tableShrink(&vm.strings);
-    vm.numGCs++;
 #else
     tableShrink(&vm.strings);
 #endif
+    vm.numGCs++;
+    vm.gcTime += clock() - started;
+    TIMELINE_END();
+
+}
 
+void heapStats(HeapStats* stats) {
+    int    i, blocks;
+    size_t total;
+
+    stats->heap            = vm.bytesAllocated;
+    stats->peak            = vm.peakAllocated;
+    stats->allocated       = vm.totallyAllocated;
+    stats->gcs             = vm.numGCs;
+    stats->gcMillis        = CLOCK_MS(vm.gcTime);
+    stats->strings         = 0;
+    stats->stringsCapacity = vm.strings.capacity;
+    for (i = 0; i < vm.strings.capacity; i++)
+        if (!IS_EMPTY(vm.strings.entries[i].key)) // not counting free entries and tombstones
+            stats->strings++;
+    nano_stats(&blocks, &total, &stats->largestFree);
 }
 
 #ifndef KIT68K
@@ -29,11 +29,24 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
     (type*)reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+// Heap statistics since start, returned by native stats() and printed by --stats-json
+typedef struct {
+    size_t heap;            // current heap usage
+    size_t peak;            // maximum heap usage
+    size_t allocated;       // total memory allocated
+    int    gcs;             // number of garbage collections
+    int    gcMillis;        // time spent in garbage collection
+    int    strings;         // number of interned strings
+    int    stringsCapacity; // capacity of vm.strings
+    size_t largestFree;     // largest block in free list of nano_malloc
+} HeapStats;
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 void  markObject(Obj* object);
 void  markValue(Value value);
 void  collectGarbage(bool checkReclaim);
 void  freeObjects(void);
+void  heapStats(HeapStats* stats);
 
 extern char big_buffer[INPUT_SIZE];
 
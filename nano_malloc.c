@@ -29,8 +29,8 @@
 #include <stdio.h>
 #include <string.h>
 
-#include "nano_malloc.h"
 #include "machine.h"
+#include "nano_malloc.h"
 
 #ifndef MAX
 #define MAX(a,b) ((a) >= (b) ? (a) : (b))
@@ -101,12 +101,42 @@ static chunk * get_chunk_from_ptr(void * ptr) {
 static chunk* free_list;
 static char myHeap[HEAP_SIZE];
 
+#if defined(LOX_DBG) && !defined(KIT68K)
+/* Calls and free list chunks visited, for the 68008 cycle estimator */
+NanoCounts nano_counts;
+#define COUNT(field) nano_counts.field++
+#else
+#define COUNT(field)
+#endif
+
 void init_freelist(void) {
     free_list = (chunk *)(myHeap);
     free_list->size = HEAP_SIZE;
     free_list->next = NULL;
 }
 
+/* Check if ptr points into the heap, used to validate pointers
+ * read asynchronously, e.g. from a signal handler */
+bool nano_contains(const void* ptr) {
+    return (const char *)ptr >= myHeap && (const char *)ptr < myHeap + HEAP_SIZE;
+}
+
+/* Walk the free list to measure fragmentation: number of free
+ * chunks, their total size and the largest one */
+void nano_stats(int* blocks, size_t* total, size_t* largest) {
+    chunk * c;
+
+    *blocks  = 0;
+    *total   = 0;
+    *largest = 0;
+    for (c = free_list; c; c = c->next) {
+        (*blocks)++;
+        *total += c->size;
+        if ((size_t)c->size > *largest)
+            *largest = c->size;
+    }
+}
+
 /** Algorithm:
   *   Walk through the free list to find the first match. If fails to find
   *   one, call sbrk to allocate a new chunk.
@@ -127,6 +157,7 @@ void* nano_malloc(size_t s) {
 
     p = free_list;
     r = p;
+    COUNT(mallocs);
 
     while (r) {
         int rem = r->size - alloc_size;
@@ -152,6 +183,7 @@ void* nano_malloc(size_t s) {
         }
         p=r;
         r=r->next;
+        COUNT(malloc_steps);
     }
 
     /* Failed to find a appropriate chunk. Give up */
@@ -184,6 +216,7 @@ void nano_free (void* free_p) {
     if (free_p == NULL) return;
 
     p_to_free = get_chunk_from_ptr(free_p);
+    COUNT(frees);
 
     if (free_list == NULL) {
         /* Set first free list element */
@@ -211,6 +244,7 @@ void nano_free (void* free_p) {
     do {
         p = q;
         q = q->next;
+        COUNT(free_steps);
     } while (q && q <= p_to_free);
 
     /* Now p <= p_to_free and either q == NULL or q > p_to_free
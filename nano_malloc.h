@@ -1,8 +1,21 @@
 #ifndef clox_nano_malloc_h
 #define clox_nano_malloc_h
 
+#include "machine.h"
+
 void  init_freelist(void);
 void* nano_malloc(size_t s);
 void  nano_free(void* free_p);
+bool  nano_contains(const void* ptr);
+void  nano_stats(int* blocks, size_t* total, size_t* largest);
+
+#if defined(LOX_DBG) && !defined(KIT68K)
+typedef struct {
+    unsigned long mallocs, malloc_steps; /* calls and chunks skipped in free list */
+    unsigned long frees,   free_steps;
+} NanoCounts;
+
+extern NanoCounts nano_counts;
+#endif
 
 #endif
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "disasm.h"
 #include "native.h"
 #include "memory.h"
+#include "profiler.h"
 #include "vm.h"
 
 
@@ -40,7 +41,8 @@ static const char* matchesType(Value value, int type) {
     }
 }
 
-bool callNative(const Native* native, int argCount, Value* args) {
+// Checks arguments against signature, reporting a mismatch as runtime error when report is set
+static bool checkArguments(const Native* native, int argCount, Value* args, bool report) {
     int         maxParmCount = 0;
     int         minParmCount = 0;
     int         i;
@@ -59,6 +61,8 @@ bool callNative(const Native* native, int argCount, Value* args) {
 
     // Check number of arguments.
     if (minParmCount > argCount || argCount > maxParmCount) {
+        if (!report)
+            return false;
         if (minParmCount == maxParmCount)
             runtimeError("'%s' expected %d arguments but got %d.",
                          native->name, maxParmCount, argCount);
@@ -72,16 +76,39 @@ bool callNative(const Native* native, int argCount, Value* args) {
     for (i = 0; i < argCount; i++) {
         expected = matchesType(args[i], signature[i] & ~LOWER_CASE_MASK);
         if (expected) {
-            runtimeError("'%s' type mismatch at argument %d, expected %s but got %s.",
-                         native->name, i + 1, expected, valueType(args[i]));
+            if (report)
+                runtimeError("'%s' type mismatch at argument %d, expected %s but got %s.",
+                             native->name, i + 1, expected, valueType(args[i]));
             return false;
         }
     }
+    return true;
+}
+
+bool callNative(const Native* native, int argCount, Value* args) {
+    if (!checkArguments(native, argCount, args, true))
+        return false;
 
     // Actual native call
     return (*native->function)(argCount, args);
 }
 
+// Set while the compiler calls a pure native, whose errors only prevent folding the call
+static bool folding;
+
+// Calls pure native with constant arguments at compile time, result in args[-1]. Returns false
+// when it isn't pure or would raise an error, leaving the call to run time.
+bool foldNative(const Native* native, int argCount, Value* args) {
+    bool ok;
+
+    if (!native->isPure || !checkArguments(native, argCount, args, false))
+        return false;
+    folding = true;
+    ok      = (*native->function)(argCount, args);
+    folding = false;
+    return ok;
+}
+
 #define RESULT args[-1]
 
 // Concatening fun name with ## crashes IDE68K compiler
@@ -109,6 +136,13 @@ bool callNative(const Native* native, int argCount, Value* args) {
 // return `nil`. End of string means `nil` is returned always. The return type is only used for
 // documentation currently.
 //
+// ## Pure natives
+//
+// Natives declared with `PURE` instead of `NAT` have no side effects and their result depends
+// on their arguments only. The compiler calls them for constant arguments, e.g. `sqrt(2)`, and
+// uses the result as a constant. They must not use `big_buffer`, which may hold the source, and
+// may only raise errors via `CHECK_ARITH_ERROR`, which are left to run time then.
+//
 // ## Allocations
 //
 // If you allocate heap objects, you have to ensure that objects allocated before are not
@@ -133,10 +167,11 @@ bool callNative(const Native* native, int argCount, Value* args) {
 // Real arithmetics
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#define CHECK_ARITH_ERROR(op)                       \
-    if (errno != 0) {                               \
-        runtimeError("'%s' arithmetic error.", op); \
-        return false;                               \
+#define CHECK_ARITH_ERROR(op)                           \
+    if (errno != 0) {                                   \
+        if (!folding)                                   \
+            runtimeError("'%s' arithmetic error.", op); \
+        return false;                                   \
     }
 
 NATIVE(absNative) {
@@ -679,6 +714,54 @@ NATIVE(dbgStatNative) {
     return setVMFlag(args, &vm.debug_statistics);
 }
 
+NATIVE(dbgOpsNative) {
+    if (!IS_FALSEY(args[0]))
+        resetOpStats();
+    return setVMFlag(args, &vm.debug_op_stats);
+}
+
+NATIVE(dumpOpsNative) {
+#ifdef KIT68K
+    printOpStats(NULL);
+#else
+    if (!printOpStats(argCount ? AS_CSTRING(args[0]) : NULL)) {
+        runtimeError("'%s' can't write file.", "dump_ops");
+        return false;
+    }
+#endif
+    RESULT = NIL_VAL;
+    return true;
+}
+
+NATIVE(dbgRingNative) {
+    if (!IS_FALSEY(args[0]))
+        resetTraceRing();
+    return setVMFlag(args, &vm.debug_trace_ring);
+}
+
+NATIVE(dumpRingNative) {
+    printTraceRing(argCount ? AS_INT(args[0]) : TRACE_RING_SIZE);
+    RESULT = NIL_VAL;
+    return true;
+}
+
+#ifndef KIT68K
+NATIVE(dbgProfNative) {
+    if (!IS_FALSEY(args[0]))
+        resetProfile();
+    return setVMFlag(args, &vm.debug_profile);
+}
+
+NATIVE(dumpProfNative) {
+    if (!printProfile(argCount ? AS_CSTRING(args[0]) : NULL)) {
+        runtimeError("'%s' can't write file.", "dump_prof");
+        return false;
+    }
+    RESULT = NIL_VAL;
+    return true;
+}
+#endif
+
 NATIVE(disasmNative) {
     ObjFunction* fun = IS_FUNCTION(args[0]) ? AS_FUNCTION(args[0])
                      : IS_BOUND(args[0])    ? AS_BOUND(args[0])->method->function
@@ -902,6 +985,40 @@ NATIVE(gcNative) {
     return true;
 }
 
+static void setIntField(ObjInstance* instance, const char* name, Int value) {
+    push(OBJ_VAL(makeString0(name))); // protect from GC while table grows
+    tableSet(&instance->fields, peek(0), INT_VAL(value));
+    drop();
+}
+
+// Byte counts saturate at the largest Lox int, the total allocated overflows it on long runs
+static void setSizeField(ObjInstance* instance, const char* name, size_t value) {
+    setIntField(instance, name, value > LOXINT_MAX ? LOXINT_MAX : (Int)value);
+}
+
+NATIVE(statsNative) {
+    HeapStats    stats;
+    ObjInstance* instance;
+
+    heapStats(&stats);
+    push(OBJ_VAL(makeString0("Stats"))); // protect from GC while allocating the class
+    peek(0) = OBJ_VAL(makeClass(AS_STRING(peek(0))));
+    instance = makeInstance(AS_CLASS(peek(0)));
+    push(OBJ_VAL(instance));
+    setSizeField(instance, "heap",             stats.heap);
+    setSizeField(instance, "peak",             stats.peak);
+    setSizeField(instance, "allocated",        stats.allocated);
+    setIntField(instance,  "gcs",              stats.gcs);
+    setIntField(instance,  "gc_ms",            stats.gcMillis);
+    setIntField(instance,  "strings",          stats.strings);
+    setIntField(instance,  "strings_capacity", stats.stringsCapacity);
+    setSizeField(instance, "largest_free",     stats.largestFree);
+    RESULT = OBJ_VAL(instance);
+    drop();
+    drop();
+    return true;
+}
+
 NATIVE(typeNative) {
     const char* type = valueType(args[0]);
     RESULT           = OBJ_VAL(makeString0(type));
@@ -933,7 +1050,7 @@ NATIVE(nameNative) {
                 break;
 
             case OBJ_NATIVE:
-                name = ((ObjNative*)object)->native->name;
+                name = ((Native*)object)->name;
                 break;
         }
         if (name)
@@ -948,15 +1065,7 @@ NATIVE(errorNative) {
 }
 
 NATIVE(clockNative) {
-#ifdef KIT68K
-    RESULT = INT_VAL(clock() * 10);   // CLOCKS_PER_SEC == 100
-#else
-#ifdef _WIN32
-    RESULT = INT_VAL(clock());        // CLOCKS_PER_SEC == 1000
-#else
-    RESULT = INT_VAL(clock() / 1000); // CLOCKS_PER_SEC == 1000000
-#endif
-#endif
+    RESULT = INT_VAL(CLOCK_MS(clock()));
     return true;
 }
 
@@ -965,114 +1074,146 @@ NATIVE(clockNative) {
 // Setup everyting
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static const Native allNatives[] = {             // Possible errors
+// Object header of natives, see native.h, and whether pure
+#define NAT  NULL, OBJ_NATIVE, true, false,
+#define PURE NULL, OBJ_NATIVE, true, true,
+
+static const Native allNatives[] = {                 // Possible errors
     // Mathematics
-    {"abs",         "R-R",    absNative},
-    {"trunc",       "R=N",    truncNative},      // arithmetic error
-    {"sqrt",        "R=R",    sqrtNative},       // arithmetic error
-    {"sin",         "R=R",    sinNative},        // arithmetic error
-    {"cos",         "R=R",    cosNative},        // arithmetic error 
-    {"tan",         "R=R",    tanNative},        // arithmetic error
-    {"sinh",        "R=R",    sinhNative},       // arithmetic error
-    {"cosh",        "R=R",    coshNative},       // arithmetic error
-    {"tanh",        "R-R",    tanhNative},
-    {"exp",         "R=R",    expNative},        // arithmetic error
-    {"log",         "R=R",    logNative},        // arithmetic error
-    {"atan",        "R-R",    atanNative},
-    {"pow",         "RR=R",   powNative},        // arithmetic error
+    {PURE "abs",         "R-R",    absNative},
+    {PURE "trunc",       "R=N",    truncNative},     // arithmetic error
+    {PURE "sqrt",        "R=R",    sqrtNative},      // arithmetic error
+    {PURE "sin",         "R=R",    sinNative},       // arithmetic error
+    {PURE "cos",         "R=R",    cosNative},       // arithmetic error 
+    {PURE "tan",         "R=R",    tanNative},       // arithmetic error
+    {PURE "sinh",        "R=R",    sinhNative},      // arithmetic error
+    {PURE "cosh",        "R=R",    coshNative},      // arithmetic error
+    {PURE "tanh",        "R-R",    tanhNative},
+    {PURE "exp",         "R=R",    expNative},       // arithmetic error
+    {PURE "log",         "R=R",    logNative},       // arithmetic error
+    {PURE "atan",        "R-R",    atanNative},
+    {PURE "pow",         "RR=R",   powNative},       // arithmetic error
 
     // Lists
-    {"list",        "Na=L",   listNative},       // length out of range
-    {"reverse",     "L-L",    reverseNative},
-    {"append",      "LA-",    appendNative},
-    {"insert",      "LNA-",   insertNative},
-    {"delete",      "LN=",    deleteNative},     // index out of range
-    {"index",       "ALn=n",  indexNative},      // start index out of range
+    {NAT  "list",        "Na=L",   listNative},      // length out of range
+    {NAT  "reverse",     "L-L",    reverseNative},
+    {NAT  "append",      "LA-",    appendNative},
+    {NAT  "insert",      "LNA-",   insertNative},
+    {NAT  "delete",      "LN=",    deleteNative},    // index out of range
+    {NAT  "index",       "ALn=n",  indexNative},     // start index out of range
 
     // Strings
-    {"length",      "Q-N",    lengthNative},
-    {"lower",       "S-S",    lowerNative},
-    {"upper",       "S-S",    upperNative},
-    {"join",        "Lsss=S", joinNative},       // string expected at % | stringbuffer overflow
-    {"split",       "SS-L",   splitNative},
-    {"match",       "SSn=l",  matchNative},      // start index out of range
+    {PURE "length",      "Q-N",    lengthNative},
+    {NAT  "lower",       "S-S",    lowerNative},
+    {NAT  "upper",       "S-S",    upperNative},
+    {NAT  "join",        "Lsss=S", joinNative},      // string expected at % | stringbuffer overflow
+    {NAT  "split",       "SS-L",   splitNative},
+    {NAT  "match",       "SSn=l",  matchNative},     // start index out of range
 
     // Objects
-    {"parent",      "C-c",    parentNative},
-    {"class_of",    "A-c",    classOfNative},
-    {"remove",      "Ai-B",   removeNative},
-    {"slots",       "I-T",    slotsNative},
-    {"next",        "T-B",    nextNative},
+    {NAT  "parent",      "C-c",    parentNative},
+    {NAT  "class_of",    "A-c",    classOfNative},
+    {NAT  "remove",      "Ai-B",   removeNative},
+    {NAT  "slots",       "I-T",    slotsNative},
+    {NAT  "next",        "T-B",    nextNative},
 
     // Type conversion
-    {"asc",         "Sn=N",   ascNative},        // index out of range
-    {"chr",         "N=S",    chrNative},        // byte out of range
-    {"dec",         "R-S",    decNative},
-    {"hex",         "N-S",    hexNative},
-    {"bin",         "N-S",    binNative},
-    {"parse_int",   "S-n",    parseIntNative},
-    {"parse_real",  "S-r",    parseRealNative},  
+    {NAT  "asc",         "Sn=N",   ascNative},       // index out of range
+    {NAT  "chr",         "N=S",    chrNative},       // byte out of range
+    {PURE "dec",         "R-S",    decNative},
+    {PURE "hex",         "N-S",    hexNative},
+    {PURE "bin",         "N-S",    binNative},
+    {PURE "parse_int",   "S-n",    parseIntNative},
+    {PURE "parse_real",  "S-r",    parseRealNative},  
 
     // Binary integers
-    {"bit_and",     "NN-N",   bitAndNative},
-    {"bit_or",      "NN-N",   bitOrNative},
-    {"bit_xor",     "NN-N",   bitXorNative},
-    {"bit_not",     "N-N",    bitNotNative},
-    {"bit_shift",   "NN-N",   bitShiftNative},
-    {"random",      "-N",     randomNative},
-    {"seed_rand",   "N-N",    seedRandNative},
+    {PURE "bit_and",     "NN-N",   bitAndNative},
+    {PURE "bit_or",      "NN-N",   bitOrNative},
+    {PURE "bit_xor",     "NN-N",   bitXorNative},
+    {PURE "bit_not",     "N-N",    bitNotNative},
+    {PURE "bit_shift",   "NN-N",   bitShiftNative},
+    {NAT  "random",      "-N",     randomNative},
+    {NAT  "seed_rand",   "N-N",    seedRandNative},
 
     // System
-    {"input",       "s-s",    inputNative},
-    {"type",        "A-S",    typeNative},
-    {"name",        "A-s",    nameNative},
-    {"error",       "A=",     errorNative},      // always raises an error
-    {"gc",          "-N",     gcNative},
-    {"clock",       "-N",     clockNative},
-    {"sleep",       "N-",     sleepNative},
+    {NAT  "input",       "s-s",    inputNative},
+    {PURE "type",        "A-S",    typeNative},
+    {NAT  "name",        "A-s",    nameNative},
+    {NAT  "error",       "A=",     errorNative},     // always raises an error
+    {NAT  "gc",          "-N",     gcNative},
+    {NAT  "stats",       "-I",     statsNative},
+    {NAT  "clock",       "-N",     clockNative},
+    {NAT  "sleep",       "N-",     sleepNative},
 
     // Low-level memory access
-    {"peek",        "N-N",    peekNative},
-    {"poke",        "NN=",    pokeNative},       // byte out of range
-    {"addr",        "A-n",    addrNative},
-    {"heap",        "N-A",    heapNative},
+    {NAT  "peek",        "N-N",    peekNative},
+    {NAT  "poke",        "NN=",    pokeNative},      // byte out of range
+    {NAT  "addr",        "A-n",    addrNative},
+    {NAT  "heap",        "N-A",    heapNative},
 
 #ifdef KIT68K
-    {"lcd_clear",   "-",      lcdClearNative},
-    {"lcd_goto",    "NN-",    lcdGotoNative},
-    {"lcd_puts",    "S-",     lcdPutsNative},
-    {"lcd_defchar", "NL=",    lcdDefcharNative}, // UDC out of range | bitmap must be 8 bytes | byte expected at %
-    {"keycode",     "-n",     keycodeNative},
-    {"sound",       "NN-",    soundNative},
-    {"exec",        "Naaa-A", execNative},
-    {"trap",        "-",      trapNative},
+    {NAT  "lcd_clear",   "-",      lcdClearNative},
+    {NAT  "lcd_goto",    "NN-",    lcdGotoNative},
+    {NAT  "lcd_puts",    "S-",     lcdPutsNative},
+    {NAT  "lcd_defchar", "NL=",    lcdDefcharNative}, // UDC out of range | bitmap must be 8 bytes | byte expected at %
+    {NAT  "keycode",     "-n",     keycodeNative},
+    {NAT  "sound",       "NN-",    soundNative},
+    {NAT  "exec",        "Naaa-A", execNative},
+    {NAT  "trap",        "-",      trapNative},
 #endif
 
 #ifdef LOX_DBG
-    {"dbg_code",    "A-",     dbgCodeNative},
-    {"dbg_step",    "A-",     dbgStepNative},
-    {"dbg_call",    "A-",     dbgCallNative},
-    {"dbg_nat",     "A-",     dbgNatNative},
-    {"dbg_gc",      "N-",     dbgGcNative},
-    {"dbg_stat",    "A-",     dbgStatNative},
-    {"disasm",      "FN=n",   disasmNative},     // offset out of range
+    {NAT  "dbg_code",    "A-",     dbgCodeNative},
+    {NAT  "dbg_step",    "A-",     dbgStepNative},
+    {NAT  "dbg_call",    "A-",     dbgCallNative},
+    {NAT  "dbg_nat",     "A-",     dbgNatNative},
+    {NAT  "dbg_gc",      "N-",     dbgGcNative},
+    {NAT  "dbg_stat",    "A-",     dbgStatNative},
+    {NAT  "dbg_ops",     "A-",     dbgOpsNative},
+    {NAT  "dbg_ring",    "A-",     dbgRingNative},
+    {NAT  "dump_ring",   "n-",     dumpRingNative},
+#ifdef KIT68K
+    {NAT  "dump_ops",    "-",      dumpOpsNative},
+#else
+    {NAT  "dump_ops",    "s=",     dumpOpsNative},   // can't write file
+    {NAT  "dbg_prof",    "A-",     dbgProfNative},
+    {NAT  "dump_prof",   "s=",     dumpProfNative},  // can't write file
+#endif
+    {NAT  "disasm",      "FN=n",   disasmNative},    // offset out of range
 #endif
 };
 
+#define NUM_NATIVES     (sizeof(allNatives) / sizeof(Native))
+#define NATIVE_NAME_MAX 12 // longest name "lcd_defchar" plus NUL
+
+// Permanent strings for the names of natives, laid out like struct ObjString. They need their
+// hash, so they are in RAM, but not in the heap.
+typedef struct {
+    OBJ_HEADER
+    int16_t  length;
+    uint32_t hash;
+    char     chars[NATIVE_NAME_MAX];
+} NativeName;
+
+static NativeName nativeNames[NUM_NATIVES];
+
 void defineAllNatives() {
-    int           natCount = sizeof(allNatives) / sizeof(Native);
-    const Native* currNat  = allNatives;
+    int i;
 
-    pushUnchecked(NIL_VAL);
-    pushUnchecked(NIL_VAL);
+    for (i = 0; i < (int)NUM_NATIVES; i++)
+        tableSet(&vm.globals,
+                 OBJ_VAL(makeStaticString((ObjString*)&nativeNames[i], allNatives[i].name)),
+                 OBJ_VAL(&allNatives[i]));
+}
 
-    while (natCount--) {
-        vm.stack[0] = OBJ_VAL(makeString0(currNat->name));
-        vm.stack[1] = OBJ_VAL(makeNative(currNat));
-        tableSet(&vm.globals, vm.stack[0], vm.stack[1]);
-        currNat++;
-    }
+#ifndef KIT68K
+// Native of allNatives by name, NULL if not available in this build
+const Native* findNative(const char* name) {
+    int i;
 
-    drop();
-    drop();
+    for (i = 0; i < (int)NUM_NATIVES; i++)
+        if (!strcmp(allNatives[i].name, name))
+            return &allNatives[i];
+    return NULL;
 }
+#endif
@@ -5,14 +5,27 @@
 
 typedef bool (*NativeFn)(int argCount, Value* args);
 
-typedef struct {
+// Natives are permanent objects, constant data in ROM. Their header is laid out like
+// OBJ_HEADER and always marked, so the GC never writes nor frees them.
+// Pure natives have no side effects and depend on their arguments only.
+struct ObjNative {
+    struct Obj* nextObj;
+    uint8_t     type;
+    uint8_t     isMarked;
+    uint8_t     isPure;
     const char* name;
     const char* signature;
     NativeFn    function;
-} Native;
+};
+
+typedef struct ObjNative Native;
 
 
 void  defineAllNatives(void);
 bool  callNative(const Native* native, int argCount, Value* args);
+bool  foldNative(const Native* native, int argCount, Value* args);
+#ifndef KIT68K
+const Native* findNative(const char* name);
+#endif
 
 #endif
\ No newline at end of file
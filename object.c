@@ -17,6 +17,11 @@ bool isObjType(Value value, ObjType type) {
 }
 #endif
 
+// Equal reals may be different objects, e.g. a real literal in different chunks
+bool constantsEqual(Value a, Value b) {
+    return valuesEqual(a, b) || (IS_REAL(a) && IS_REAL(b) && AS_REAL(a) == AS_REAL(b));
+}
+
 bool isCallable(Value value) {
     uint8_t type;
     if (IS_OBJ(value)) {
@@ -74,9 +79,8 @@ ObjClass* makeClass(ObjString* name) {
 
 ObjClosure* makeClosure(ObjFunction* function) {
     ObjClosure* closure = (ObjClosure*)
-        allocateObject(sizeof(ObjClosure) + sizeof(ObjUpvalue*) * function->upvalueCount,
-                       OBJ_CLOSURE);
-    mem_clear(closure->upvalues, function->upvalueCount * sizeof(ObjUpvalue*));
+        allocateObject(sizeof(ObjClosure) + sizeof(Value) * function->upvalueCount, OBJ_CLOSURE);
+    mem_clear(closure->upvalues, function->upvalueCount * sizeof(Value));
     closure->function     = function;
     closure->upvalueCount = function->upvalueCount;
     return closure;
@@ -95,6 +99,7 @@ ObjFunction* makeFunction() {
     function->upvalueCount = 0;
     function->name         = NIL_VAL;
     function->klass        = NIL_VAL;
+    function->lazy         = NULL;
     initChunk(&function->chunk);
     return function;
 }
@@ -135,12 +140,6 @@ ObjList* makeList(int len, Value* items, int numCopy, int stride) {
     return list;
 }
 
-ObjNative* makeNative(const Native* native) {
-    ObjNative* res = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
-    res->native    = native;
-    return res;
-}
-
 Value makeReal(Real val) {
     ObjReal* real = ALLOCATE_OBJ(ObjReal, OBJ_REAL);
     real->content = val;
@@ -172,6 +171,25 @@ ObjString* makeString(const char* chars, int length) {
     return string;
 }
 
+// Permanent string in storage outside of the heap, large enough for chars. Like the natives,
+// it is always marked, so it is never freed nor removed from vm.strings.
+ObjString* makeStaticString(ObjString* storage, const char* chars) {
+    int        length = strlen(chars);
+    uint32_t   hash   = hashBytes((const uint8_t*)chars, length);
+    ObjString* string = tableFindString(&vm.strings, chars, length, hash);
+    if (string != NULL)
+        return string;
+
+    storage->nextObj  = NULL;
+    storage->type     = OBJ_STRING;
+    storage->isMarked = true;
+    storage->length   = length;
+    storage->hash     = hash;
+    mem_copy(storage->chars, chars, length + 1);
+    tableSet(&vm.strings, OBJ_VAL(storage), NIL_VAL);
+    return storage;
+}
+
 ObjUpvalue* makeUpvalue(Value* slot) {
     ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
     upvalue->location   = slot;
@@ -31,9 +31,10 @@
 #define AS_INSTANCE(value)     ((ObjInstance*)AS_OBJ(value))
 #define AS_ITERATOR(value)     ((ObjIterator*)AS_OBJ(value))
 #define AS_LIST(value)         ((ObjList*)AS_OBJ(value))
-#define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->native)
+#define AS_NATIVE(value)       ((const Native*)AS_OBJ(value))
 #define AS_REAL(value)         (((ObjReal*)AS_OBJ(value))->content)
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
+#define AS_UPVALUE(value)      ((ObjUpvalue*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -84,7 +85,7 @@ struct ObjClosure {
     OBJ_HEADER
     int16_t      upvalueCount; // too big, but keep alignment
     ObjFunction* function;
-    ObjUpvalue*  upvalues[];   // array embedded in structure
+    Value        upvalues[];   // array embedded in structure, ObjUpvalue or value captured flat
 };
 
 struct ObjDynvar {
@@ -93,6 +94,13 @@ struct ObjDynvar {
     Value        previous;     // EMPTY_VAL when nothing to unbind
 };
 
+// Block body of a function declared at top level, compiled on its first call by compileBody()
+typedef struct {
+    const char*  start;        // token before the parameters, in a source kept while running
+    int          line;
+    uint8_t      type;         // FunctionType
+} LazyBody;
+
 struct ObjFunction {
     OBJ_HEADER
     uint8_t      arity;        // lower 7 bits arity, highest bit rest parameter flag        
@@ -100,6 +108,7 @@ struct ObjFunction {
     Chunk        chunk;
     Value        name;         // string for named functions, int for anonymous, nil for script
     ObjClass*    klass;        // defining class for method, nil for normal function
+    LazyBody*    lazy;         // body not compiled yet, chunk empty until then
 };
 
 struct ObjInstance {
@@ -119,11 +128,6 @@ struct ObjList {
     ValueArray   arr;
 };
 
-struct ObjNative {
-    OBJ_HEADER
-    const Native* native;      // Pointer into ROM table, not GCed
-};
-
 struct ObjReal {
     OBJ_HEADER
     Real         content;
@@ -157,15 +161,16 @@ ObjFunction* makeFunction(void);
 ObjInstance* makeInstance(ObjClass* klass);
 ObjIterator* makeIterator(ObjInstance* instance);
 ObjList*     makeList(int len, Value* items, int numCopy, int stride);
-ObjNative*   makeNative(const Native* native);
 Value        makeReal(Real val);
 ObjString*   makeString0(const char* chars);
 ObjString*   makeString(const char* chars, int length);
+ObjString*   makeStaticString(ObjString* storage, const char* chars);
 ObjUpvalue*  makeUpvalue(Value* slot);
 
 void         printObject(Value value, int flags);
 bool         isObjType(Value value, ObjType type);
 bool         isCallable(Value value);
+bool         constantsEqual(Value a, Value b);
 const char*  typeName(ObjType type);
 const char*  functionName(ObjFunction* function);
 
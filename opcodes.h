@@ -16,8 +16,10 @@ typedef enum {
     OP_GET_GLOBAL,    // push global variable named str0
     OP_DEF_GLOBAL,    // create or update global variable named str0 with TOS
     OP_SET_GLOBAL,    // update global variable named str0 with TOS
+    OP_DEF_CONST,     // create global variable and constant named str0 with TOS
     OP_GET_UPVALUE,   // push upvalue at index byte0
     OP_SET_UPVALUE,   // update upvalue at index byte0 with TOS
+    OP_GET_CAPTURED,  // push value captured flat at upvalue index byte0
     OP_GET_PROPERTY,  // push property named str0 of TOS
     OP_SET_PROPERTY,  // update property named str0 of TOS-1 with TOS
     OP_GET_SUPER,     // push method named str0 in superclass of TOS class
@@ -65,6 +67,11 @@ typedef enum {
     OP_GET_ITVAL,     // push value of TOS iterator
     OP_SET_ITVAL,     // set value of TOS-1 iterator to TOS 
     OP_GET_ITKEY,     // push key of TOS iterator
+    OP_SWITCH,        // jump by the byte0 OP_CASE entries following to the one for TOS, kind byte1
+    OP_CASE,          // entry of OP_SWITCH for label str0, jump by signed word1 bytes
+    OP_INLINE,        // unless global str0 is a closure of function const1, jump by word2 bytes
+
+    NUM_OPCODES       // not an opcode, number of opcodes defined above, keep last
 } OpCode;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,797 @@
+#include "memory.h"
+#include "object.h"
+#include "peephole.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Peephole optimizer
+//
+// The code is decoded into a table of instructions with jump targets as indices, so rewrites
+// don't have to care about offsets. Each round marks the instructions reachable from the start
+// and the targets of their jumps, rewrites, and compacts the table, dropping unreachable and
+// removed instructions. Jumps to a removed instruction continue at the next one kept.
+// Finally the code and its line starts are laid out again with the new jump offsets.
+//
+// During optimizing, OP_LOOP is an OP_JUMP with an earlier target. Which one is emitted
+// depends on its direction after the layout. Conditional jumps are only threaded forwards.
+// The OP_CASE entries of an OP_SWITCH are jumps too, in either direction, never dropped as they
+// are reached from the OP_SWITCH. So is OP_INLINE, forwards to the call it replaces. The jump
+// word is the last operand of all of them.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_HOPS     16 // jumps followed when threading a jump
+#define MAX_PASSES   8  // over locals with option -O, each followed by peephole rounds
+
+#define INSTR_LIVE   1  // reachable from the start
+#define INSTR_TARGET 2  // target of a reachable jump
+#define INSTR_DROP   4  // removed by a rewrite
+
+typedef struct {
+    int16_t  offset;    // in code before optimizing, for its operands
+    int16_t  target;    // index of instruction jumped to, -1 if no jump
+    int16_t  line;
+    uint8_t  op;        // maybe rewritten
+    uint8_t  flags;
+} Instr;
+
+static Chunk*   chunk;
+static Instr*   instrs;
+static int16_t* indices;    // temporary index or offset for each instruction and the end
+static int      count;      // of instructions
+static int      capacity;   // of instrs, indices has one more
+
+// Operand bytes of each instruction, same order as enum OpCode in opcodes.h.
+// OP_CLOSURE is followed by one more byte for each upvalue of its function.
+static const uint8_t operandBytes[NUM_OPCODES] = {
+    1, 1, 0, 0, 0, 0, 0, 0, 0,  // OP_CONSTANT .. OP_DUP
+    1, 1, 1, 1, 1, 1, 1, 1, 1,  // OP_GET_LOCAL .. OP_GET_CAPTURED
+    1,                          // OP_GET_PROPERTY
+    1,                          // OP_SET_PROPERTY
+    1,                          // OP_GET_SUPER
+    0, 0, 0, 0, 0, 0, 0, 0,     // OP_EQUAL .. OP_NOT
+    0, 0, 0,                    // OP_PRINT .. OP_PRINTQ
+    2, 2, 2, 2, 2, 2,           // OP_JUMP .. OP_LOOP
+    1, 0, 0, 0, 0, 1, 2, 2,     // OP_CALL .. OP_SUPER_INVOKE
+    1, 0, 0, 0,                 // OP_CLOSURE .. OP_RETURN_NIL
+    1, 0, 1, 1,                 // OP_CLASS .. OP_LIST
+    0, 0, 0, 0,                 // OP_GET_INDEX .. OP_UNPACK
+    1, 2, 2, 1,                 // OP_VCALL .. OP_VLIST
+    0, 0, 0,                    // OP_GET_ITVAL .. OP_GET_ITKEY
+    2, 3, 4,                    // OP_SWITCH .. OP_INLINE
+};
+
+#define IS_JUMP(op)      (((op) >= OP_JUMP && (op) <= OP_LOOP) || (op) >= OP_CASE)
+#define ENDS_FLOW(op)    ((op) == OP_JUMP || (op) == OP_RETURN || (op) == OP_RETURN_NIL)
+#define IS_CONDJUMP(op)  ((op) == OP_JUMP_TRUE || (op) == OP_JUMP_FALSE)
+#define KEPT(instr)      (((instr)->flags & (INSTR_LIVE | INSTR_DROP)) == INSTR_LIVE)
+
+int instructionLength(const Chunk* of, int offset) {
+    int op = of->code[offset];
+
+    if (op == OP_CLOSURE)
+        return 2 + AS_FUNCTION(of->constants.values[of->code[offset + 1]])->upvalueCount;
+    return 1 + operandBytes[op];
+}
+
+static int lengthAt(int op, int offset) {
+    return op == OP_CLOSURE ? instructionLength(chunk, offset) : 1 + operandBytes[op];
+}
+
+// Index of instruction at offset, -1 if none starts there
+static int indexOf(int offset) {
+    int beg = 0;
+    int end = count - 1;
+    int mid;
+
+    while (beg <= end) {
+        mid = (beg + end) >> 1;
+        if (offset < instrs[mid].offset)
+            end = mid - 1;
+        else if (offset > instrs[mid].offset)
+            beg = mid + 1;
+        else
+            return mid;
+    }
+    return -1;
+}
+
+static bool decode(void) {
+    int      offset, at, delta, i;
+    uint8_t* code = chunk->code;
+    Instr*   instr;
+
+    count = 0;
+    for (offset = 0; offset < chunk->count; offset += lengthAt(code[offset], offset)) {
+        if (code[offset] >= NUM_OPCODES)
+            return false;
+        count++;
+    }
+    if (offset != chunk->count)
+        return false;
+
+    capacity = count;
+    instrs   = ALLOCATE(Instr, capacity);
+    indices  = ALLOCATE(int16_t, capacity + 1);
+    for (offset = 0, i = 0; i < count; offset += lengthAt(code[offset], offset), i++) {
+        instr         = &instrs[i];
+        instr->offset = offset;
+        instr->op     = code[offset];
+        instr->line   = getLine(chunk, offset);
+        instr->flags  = 0;
+        instr->target = -1;
+    }
+
+    for (instr = instrs; instr < instrs + count; instr++)
+        if (IS_JUMP(instr->op)) {
+            at    = instr->offset + operandBytes[instr->op] - 1;
+            delta = (code[at] << 8) | code[at + 1];
+            if (instr->op == OP_CASE)
+                delta = (int16_t)delta;
+            else if (instr->op == OP_LOOP) {
+                instr->op = OP_JUMP;
+                delta     = -delta;
+            }
+            instr->target = indexOf(instr->offset + 1 + operandBytes[instr->op] + delta);
+            if (instr->target < 0)
+                return false;
+        }
+    return true;
+}
+
+static void markLive(void) {
+    Instr* instr;
+    Instr* target;
+    bool   changed;
+    int    i;
+
+    for (i = 0; i < count; i++)
+        instrs[i].flags &= ~(INSTR_LIVE | INSTR_TARGET);
+    instrs[0].flags |= INSTR_LIVE;
+
+    do {
+        changed = false;
+        for (i = 0; i < count; i++) {
+            instr = &instrs[i];
+            if (!(instr->flags & INSTR_LIVE))
+                continue;
+            if (instr->target >= 0) {
+                target = &instrs[instr->target];
+                if (!(target->flags & INSTR_LIVE) && instr->target < i)
+                    changed = true; // forward targets are reached in this pass
+                target->flags |= INSTR_LIVE | INSTR_TARGET;
+            }
+            if (!ENDS_FLOW(instr->op) && i + 1 < count)
+                instrs[i + 1].flags |= INSTR_LIVE;
+        }
+    } while (changed);
+}
+
+// Jumps to a jump continue at its target, unconditional jumps to a return return at once.
+// Jumps to the next instruction are dropped or only pop their condition.
+static bool rewriteJump(int index) {
+    Instr* instr  = &instrs[index];
+    Instr* to;
+    int    target = instr->target;
+    int    hops;
+
+    for (hops = 0; hops < MAX_HOPS; hops++) {
+        to = &instrs[target];
+        if (to->op == OP_JUMP && to->target != target
+                && (instr->op == OP_JUMP || instr->op == OP_CASE || to->target > index))
+            target = to->target;
+        else if ((instr->op == OP_JUMP_AND || instr->op == OP_JUMP_OR) && to->op == instr->op)
+            target = to->target; // same condition still on the stack
+        else
+            break;
+    }
+
+    if (instr->op == OP_JUMP && (instrs[target].op == OP_RETURN || instrs[target].op == OP_RETURN_NIL)) {
+        instr->op     = instrs[target].op;
+        instr->target = -1;
+        return true;
+    }
+    if (target == index + 1) {
+        if (instr->op == OP_JUMP)
+            instr->flags |= INSTR_DROP; // still followed when threading
+        else if (IS_CONDJUMP(instr->op)) {
+            instr->op     = OP_POP;
+            instr->target = -1;
+        } else
+            return false;
+        return true;
+    }
+    if (target != instr->target) {
+        instr->target = target;
+        return true;
+    }
+    return false;
+}
+
+// Pairs of instructions with no jump to the second one. Returns number of instructions dropped.
+static int rewritePair(Instr* first, Instr* second) {
+    int  op   = first->op;
+    bool falsey;
+    bool pure = op == OP_CONSTANT || op == OP_INT || op == OP_ZERO || op == OP_NIL
+             || op == OP_TRUE || op == OP_FALSE || op == OP_DUP
+             || op == OP_GET_LOCAL || op == OP_GET_UPVALUE || op == OP_GET_CAPTURED;
+
+    if ((pure && second->op == OP_POP) || (op == OP_SWAP && second->op == OP_SWAP)) {
+        first->flags  |= INSTR_DROP;
+        second->flags |= INSTR_DROP;
+        return 2;
+    }
+    if (!IS_CONDJUMP(second->op))
+        return 0;
+
+    if (op == OP_NOT) {
+        second->op    = second->op == OP_JUMP_TRUE ? OP_JUMP_FALSE : OP_JUMP_TRUE;
+        first->flags |= INSTR_DROP;
+        return 1;
+    }
+    if (pure && op <= OP_FALSE) {
+        // constant condition
+        falsey = op == OP_NIL || op == OP_FALSE || (op == OP_CONSTANT
+                 && IS_FALSEY(chunk->constants.values[chunk->code[first->offset + 1]]));
+        first->flags |= INSTR_DROP;
+        if (falsey == (second->op == OP_JUMP_FALSE))
+            second->op = OP_JUMP;
+        else
+            second->flags |= INSTR_DROP;
+        return 1;
+    }
+    return 0;
+}
+
+static bool rewrite(void) {
+    Instr* instr;
+    Instr* next;
+    bool   changed = false;
+    int    i;
+
+    for (i = 0; i < count; i++) {
+        instr = &instrs[i];
+        if (!KEPT(instr))
+            continue;
+        if (instr->target >= 0)
+            changed |= rewriteJump(i);
+        else if (i + 1 < count) {
+            next = &instrs[i + 1];
+            if (KEPT(next) && !(next->flags & INSTR_TARGET) && rewritePair(instr, next)) {
+                changed = true;
+                i++;
+            }
+        }
+    }
+    return changed;
+}
+
+// Drops all instructions not kept. Returns false if a jump is left without target.
+static bool compact(void) {
+    int i, n = 0;
+
+    for (i = 0; i < count; i++) {
+        indices[i] = n;
+        if (KEPT(&instrs[i]))
+            instrs[n++] = instrs[i];
+    }
+    indices[count] = n;
+    count          = n;
+
+    for (i = 0; i < count; i++)
+        if (instrs[i].target >= 0) {
+            instrs[i].target = indices[instrs[i].target];
+            if (instrs[i].target == count)
+                return false;
+        }
+    return true;
+}
+
+static void layout(void) {
+    uint8_t*   code;
+    LineStart* lines;
+    uint8_t*   at;
+    Instr*     instr;
+    int        i, n, length, delta, lineCount = 0;
+
+    for (i = 0, length = 0; i < count; i++) {
+        indices[i] = length;
+        length    += lengthAt(instrs[i].op, instrs[i].offset);
+    }
+    indices[count] = length;
+
+    code  = ALLOCATE(uint8_t, length);
+    lines = ALLOCATE(LineStart, count);
+    for (i = 0; i < count; i++) {
+        instr = &instrs[i];
+        at    = code + indices[i];
+        *at   = instr->op;
+        if (instr->op >= OP_CASE) {
+            n     = operandBytes[instr->op] - 2;
+            delta = indices[instr->target] - indices[i + 1];
+            mem_copy(at + 1, chunk->code + instr->offset + 1, n);
+            at[n + 1] = delta >> 8;
+            at[n + 2] = delta;
+        } else if (instr->target >= 0) {
+            delta = indices[instr->target] - indices[i] - 3;
+            if (delta < 0) {
+                *at   = OP_LOOP;
+                delta = -delta;
+            }
+            at[1] = delta >> 8;
+            at[2] = delta;
+        } else
+            mem_copy(at + 1, chunk->code + instr->offset + 1, indices[i + 1] - indices[i] - 1);
+
+        if (lineCount == 0 || lines[lineCount - 1].line != instr->line) {
+            lines[lineCount].offset = indices[i];
+            lines[lineCount].line   = instr->line;
+            lineCount++;
+        }
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    chunk->code         = code;
+    chunk->count        = length;
+    chunk->capacity     = length;
+    chunk->lines        = lines;
+    chunk->lineCount    = lineCount;
+    chunk->lineCapacity = count;
+}
+
+#ifndef KIT68K
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Passes over locals, on the host with option -O
+//
+// The table of instructions serves as intermediate form of the function. First the stack height
+// before each instruction is computed, so every push is known to fill the stack slot at that
+// height, which is a local if it stays there until its scope ends.
+// - Slots known to hold a constant or the value of another local on all paths are tracked, and
+//   reading them pushes that constant or reads that other local instead.
+// - A store into a local not read on any path before it is stored again or popped is removed,
+//   as OP_SET_LOCAL leaves its value on the stack anyway.
+// Slots captured by any closure of the function are left alone. Functions unpacking lists have no
+// fixed stack heights and are skipped. The peephole rounds then remove the pushes left unused.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_SLOTS    256 // stack slots tracked
+#define UNVISITED    -2  // first value at a jump target not reached yet
+
+#define OPERAND(instr)   chunk->code[(instr)->offset + 1]
+#define IS_PUSH(op)      ((op) >= OP_CONSTANT && (op) <= OP_FALSE)
+#define KEEPS_COND(op)   ((op) == OP_JUMP_OR || (op) == OP_JUMP_AND)
+
+#define HAS_SLOT(set, slot)  ((set)[(slot) >> 5] &   (1UL << ((slot) & 31)))
+#define ADD_SLOT(set, slot)  ((set)[(slot) >> 5] |=  (1UL << ((slot) & 31)))
+#define DEL_SLOT(set, slot)  ((set)[(slot) >> 5] &= ~(1UL << ((slot) & 31)))
+
+static bool      optimizeLocals;
+static int16_t*  heights;           // stack height before each instruction, -1 if not reached
+static uint32_t* liveIn;            // set of slots read later, liveWords for each instruction
+static int       liveWords;
+static int16_t*  entries;          // values at each jump target, width for each
+static int       width;             // maximum stack height plus one
+static int16_t   values[MAX_SLOTS]; // instruction pushing the same value as each slot, -1 if unknown
+static bool      captured[MAX_SLOTS];
+
+void setOptimizeLocals(bool enable) {
+    optimizeLocals = enable;
+}
+
+// Stack slots popped and pushed by an instruction, false if its arguments are counted at runtime.
+// OP_JUMP_OR and OP_JUMP_AND pop their condition only when not jumping.
+static bool stackEffect(const Instr* instr, int* pops, int* pushes) {
+    *pops   = 0;
+    *pushes = 1;
+    switch (instr->op) {
+        case OP_CONSTANT: case OP_INT: case OP_ZERO: case OP_NIL: case OP_TRUE: case OP_FALSE:
+        case OP_DUP: case OP_GET_LOCAL: case OP_GET_GLOBAL: case OP_GET_UPVALUE:
+        case OP_GET_CAPTURED: case OP_CLOSURE: case OP_CLASS:
+            return true;
+        case OP_SET_LOCAL: case OP_SET_GLOBAL: case OP_SET_UPVALUE: case OP_GET_PROPERTY:
+        case OP_NOT: case OP_GET_ITVAL: case OP_GET_ITKEY: case OP_CALL0: case OP_SWITCH:
+            *pops = 1;
+            return true;
+        case OP_SWAP: case OP_SET_PROPERTY: case OP_GET_SUPER: case OP_EQUAL: case OP_LESS:
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD: case OP_CALL1:
+        case OP_CALL_HAND: case OP_CALL_BIND: case OP_INHERIT: case OP_METHOD:
+        case OP_GET_INDEX: case OP_SET_ITVAL:
+            *pops   = 2;
+            *pushes = 1 + (instr->op == OP_SWAP);
+            return true;
+        case OP_SET_INDEX: case OP_GET_SLICE: case OP_CALL2:
+            *pops = 3;
+            return true;
+        case OP_CALL:
+            *pops = 1 + OPERAND(instr);
+            return true;
+        case OP_INVOKE:
+            *pops = 1 + chunk->code[instr->offset + 2];
+            return true;
+        case OP_SUPER_INVOKE:
+            *pops = 2 + chunk->code[instr->offset + 2];
+            return true;
+        case OP_LIST:
+            *pops = OPERAND(instr);
+            return true;
+        case OP_POP: case OP_DEF_GLOBAL: case OP_DEF_CONST: case OP_PRINT: case OP_PRINTLN:
+        case OP_PRINTQ: case OP_JUMP_OR: case OP_JUMP_AND: case OP_JUMP_TRUE: case OP_JUMP_FALSE:
+        case OP_CLOSE_UPVALUE: case OP_RETURN:
+            *pops = 1;
+            /* fall through */
+        case OP_JUMP: case OP_RETURN_NIL: case OP_CASE: case OP_INLINE:
+            *pushes = 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool setHeight(int index, int height, bool* changed) {
+    if (heights[index] < 0) {
+        heights[index] = height;
+        *changed       = true;
+    }
+    return heights[index] == height;
+}
+
+// Returns false if the heights are not the same on all paths or not fixed at all.
+static bool computeHeights(int slots) {
+    Instr* instr;
+    bool   changed;
+    int    i, pops, pushes, after;
+
+    for (i = 0; i < count; i++)
+        heights[i] = -1;
+    heights[0] = slots;
+
+    do {
+        changed = false;
+        for (i = 0; i < count; i++) {
+            instr = &instrs[i];
+            if (heights[i] < 0)
+                continue;
+            if (!stackEffect(instr, &pops, &pushes) || heights[i] < (pops > 0 ? pops : 1))
+                return false;
+            after = heights[i] - pops + pushes;
+            if (after >= MAX_SLOTS)
+                return false;
+            if (instr->target >= 0 && !setHeight(instr->target,
+                                                 KEEPS_COND(instr->op) ? heights[i] : after, &changed))
+                return false;
+            if (!ENDS_FLOW(instr->op) && i + 1 < count && !setHeight(i + 1, after, &changed))
+                return false;
+        }
+    } while (changed);
+    return true;
+}
+
+static void findCaptured(void) {
+    Instr* instr;
+    int    i, upvalueCount, upvalue;
+
+    for (i = 0; i < MAX_SLOTS; i++)
+        captured[i] = false;
+    for (instr = instrs; instr < instrs + count; instr++)
+        if (instr->op == OP_CLOSURE) {
+            upvalueCount = AS_FUNCTION(chunk->constants.values[OPERAND(instr)])->upvalueCount;
+            for (i = 0; i < upvalueCount; i++) {
+                upvalue = chunk->code[instr->offset + 2 + i];
+                if (UV_ISLOC(upvalue))
+                    captured[UV_INDEX(upvalue)] = true;
+            }
+        }
+}
+
+// Forgets the value of a slot about to be overwritten, and all slots holding a copy of it
+static void forget(int slot, int height) {
+    int i;
+
+    for (i = 0; i < height; i++)
+        if (values[i] >= 0 && instrs[values[i]].op == OP_GET_LOCAL && OPERAND(&instrs[values[i]]) == slot)
+            values[i] = -1;
+    values[slot] = -1;
+}
+
+static bool sameRead(const Instr* a, const Instr* b) {
+    return a->op == b->op && (operandBytes[a->op] == 0 || OPERAND(a) == OPERAND(b));
+}
+
+// Merges the values of the slots at a jump or fall through into those at the target
+static bool mergeEntry(int index, int height) {
+    int16_t* entry = &entries[indices[index] * width];
+    bool     changed = false;
+    int      slot;
+
+    if (entry[0] == UNVISITED) {
+        for (slot = 0; slot < height; slot++)
+            entry[slot] = values[slot];
+        return true;
+    }
+    for (slot = 0; slot < height; slot++)
+        if (entry[slot] >= 0 && entry[slot] != values[slot]) {
+            entry[slot] = -1;
+            changed     = true;
+        }
+    return changed;
+}
+
+// One pass forwards, merging into the values at jump targets. Reads are only rewritten in a final
+// pass once they are stable. Returns true if a read was rewritten or a value at a target changed.
+static bool propagate(bool rewriteReads) {
+    Instr*   instr;
+    int16_t* entry;
+    bool     changed = false;
+    bool     reached = true; // else not known how, skipped in this pass
+    int      i, h, slot, value, pops, pushes;
+
+    for (i = 0; i < count; i++) {
+        instr = &instrs[i];
+        h     = heights[i];
+        if (i == 0)
+            for (slot = 0; slot < h; slot++)
+                values[slot] = -1;
+        else if (instr->flags & INSTR_TARGET) {
+            if (reached && !ENDS_FLOW(instrs[i - 1].op))
+                changed |= mergeEntry(i, h);
+            entry   = &entries[indices[i] * width];
+            reached = entry[0] != UNVISITED;
+            for (slot = 0; reached && slot < h; slot++)
+                values[slot] = entry[slot];
+        }
+        if (!reached)
+            continue;
+        if (instr->target >= 0 && KEEPS_COND(instr->op))
+            changed |= mergeEntry(instr->target, h);
+
+        switch (instr->op) {
+            case OP_GET_LOCAL:
+                slot  = OPERAND(instr);
+                value = slot < h && !captured[slot] ? values[slot] : -1;
+                if (rewriteReads && value >= 0 && !sameRead(instr, &instrs[value])) {
+                    // operands are copied from the instruction pushing the same value
+                    instr->op     = instrs[value].op;
+                    instr->offset = instrs[value].offset;
+                    changed       = true;
+                }
+                values[h] = value >= 0 ? value : (slot < h && !captured[slot] ? i : -1);
+                break;
+            case OP_SET_LOCAL:
+                slot  = OPERAND(instr);
+                value = values[h - 1];
+                if (slot >= h - 1)
+                    break;
+                forget(slot, h);
+                if (value >= 0 && instrs[value].op == OP_GET_LOCAL && OPERAND(&instrs[value]) == slot)
+                    value = -1;
+                values[slot] = captured[slot] ? -1 : value;
+                break;
+            case OP_DUP:
+                values[h] = values[h - 1];
+                break;
+            default:
+                stackEffect(instr, &pops, &pushes);
+                for (slot = h - pops; slot < h; slot++)
+                    forget(slot, h);
+                for (slot = h - pops; slot < h - pops + pushes; slot++)
+                    values[slot] = IS_PUSH(instr->op) ? i : -1;
+        }
+
+        if (instr->target >= 0 && !KEEPS_COND(instr->op))
+            changed |= mergeEntry(instr->target, heights[instr->target]);
+    }
+    return changed;
+}
+
+// Slots read after an instruction, from those read before its successors
+static void liveAfter(int index, uint32_t* set) {
+    Instr* instr = &instrs[index];
+    int    w;
+
+    for (w = 0; w < liveWords; w++)
+        set[w] = 0;
+    if (!ENDS_FLOW(instr->op) && index + 1 < count)
+        for (w = 0; w < liveWords; w++)
+            set[w] |= liveIn[(index + 1) * liveWords + w];
+    if (instr->target >= 0)
+        for (w = 0; w < liveWords; w++)
+            set[w] |= liveIn[instr->target * liveWords + w];
+}
+
+static void computeLiveness(void) {
+    uint32_t set[MAX_SLOTS / 32];
+    Instr*   instr;
+    bool     changed;
+    int      i, w, h, slot, pops, pushes;
+
+    for (i = 0; i < count * liveWords; i++)
+        liveIn[i] = 0;
+
+    do {
+        changed = false;
+        for (i = count - 1; i >= 0; i--) {
+            instr = &instrs[i];
+            h     = heights[i];
+            if (h < 0)
+                continue;
+            liveAfter(i, set);
+            stackEffect(instr, &pops, &pushes);
+            switch (instr->op) {
+                case OP_GET_LOCAL:
+                    DEL_SLOT(set, h);
+                    ADD_SLOT(set, OPERAND(instr));
+                    break;
+                case OP_SET_LOCAL:
+                    DEL_SLOT(set, OPERAND(instr));
+                    ADD_SLOT(set, h - 1);
+                    break;
+                case OP_DUP:
+                    DEL_SLOT(set, h);
+                    ADD_SLOT(set, h - 1);
+                    break;
+                case OP_POP:
+                    DEL_SLOT(set, h - 1); // discarded, not read
+                    break;
+                default:
+                    for (slot = h - pops; slot < h - pops + pushes; slot++)
+                        DEL_SLOT(set, slot);
+                    for (slot = h - pops; slot < h; slot++)
+                        ADD_SLOT(set, slot);
+            }
+            for (w = 0; w < liveWords; w++)
+                if (liveIn[i * liveWords + w] != set[w]) {
+                    liveIn[i * liveWords + w] = set[w];
+                    changed = true;
+                }
+        }
+    } while (changed);
+}
+
+static bool removeDeadStores(void) {
+    uint32_t set[MAX_SLOTS / 32];
+    Instr*   instr;
+    bool     changed = false;
+    int      i, slot;
+
+    for (i = 0; i < count; i++) {
+        instr = &instrs[i];
+        if (instr->op != OP_SET_LOCAL || heights[i] < 0)
+            continue;
+        slot = OPERAND(instr);
+        liveAfter(i, set);
+        if (slot < heights[i] - 1 && !captured[slot] && !HAS_SLOT(set, slot)) {
+            instr->flags |= INSTR_DROP;
+            changed       = true;
+        }
+    }
+    return changed;
+}
+
+// Returns true if any instruction was changed, to be cleaned up by the next peephole rounds
+static bool passLocals(int slots) {
+    bool changed = false;
+    int  i, targets = 0, maxHeight = 0;
+
+    if (!optimizeLocals)
+        return false;
+
+    heights = ALLOCATE(int16_t, count);
+    markLive();
+    findCaptured();
+    if (computeHeights(slots)) {
+        for (i = 0; i < count; i++) {
+            if (heights[i] > maxHeight)
+                maxHeight = heights[i];
+            indices[i] = instrs[i].flags & INSTR_TARGET ? targets++ : -1;
+        }
+        width   = maxHeight + 1;
+        entries = ALLOCATE(int16_t, targets * width + 1);
+        for (i = 0; i < targets * width; i += width)
+            entries[i] = UNVISITED;
+        while (propagate(false))
+            ;
+        changed = propagate(true);
+        FREE_ARRAY(int16_t, entries, targets * width + 1);
+
+        liveWords = (maxHeight + 32) / 32;
+        liveIn    = ALLOCATE(uint32_t, count * liveWords);
+        computeLiveness();
+        changed  |= removeDeadStores();
+        FREE_ARRAY(uint32_t, liveIn, count * liveWords);
+    }
+    FREE_ARRAY(int16_t, heights, count);
+    return changed;
+}
+
+// Inlining checks the code of the function called, see compiler.c. Its stack has to be the same
+// on every path, so that each return leaves nothing but the result above its parameters.
+bool canInline(Chunk* chunkToInline, int slots, bool* calls) {
+    Instr* instr;
+    bool   inlinable;
+    int    i;
+
+    chunk    = chunkToInline;
+    instrs   = NULL;
+    indices  = NULL;
+    capacity = 0;
+    *calls   = false;
+
+    inlinable = chunk->count > 0 && decode();
+    if (inlinable) {
+        heights   = ALLOCATE(int16_t, count);
+        inlinable = computeHeights(slots);
+        for (i = 0; inlinable && i < count; i++) {
+            instr = &instrs[i];
+            switch (instr->op) {
+                case OP_GET_LOCAL:
+                    inlinable = OPERAND(instr) > 0 && OPERAND(instr) < slots;
+                    break;
+                case OP_CALL: case OP_CALL0: case OP_CALL1: case OP_CALL2: case OP_INVOKE:
+                    *calls = true;
+                    break;
+                case OP_RETURN:
+                    inlinable = heights[i] == slots + 1;
+                    break;
+                case OP_RETURN_NIL:
+                    inlinable = heights[i] == slots;
+                    break;
+                case OP_CONSTANT: case OP_INT: case OP_ZERO: case OP_NIL: case OP_TRUE:
+                case OP_FALSE: case OP_POP: case OP_SWAP: case OP_DUP: case OP_GET_GLOBAL:
+                case OP_GET_PROPERTY: case OP_EQUAL: case OP_LESS: case OP_ADD: case OP_SUB:
+                case OP_MUL: case OP_DIV: case OP_MOD: case OP_NOT: case OP_JUMP: case OP_JUMP_OR:
+                case OP_JUMP_AND: case OP_JUMP_TRUE: case OP_JUMP_FALSE: case OP_LIST:
+                case OP_GET_INDEX: case OP_GET_SLICE: case OP_GET_ITVAL: case OP_GET_ITKEY:
+                    break;
+                default:
+                    inlinable = false;
+            }
+            inlinable &= heights[i] >= 0;
+        }
+        FREE_ARRAY(int16_t, heights, count);
+    }
+
+    if (instrs) {
+        FREE_ARRAY(Instr, instrs, capacity);
+        FREE_ARRAY(int16_t, indices, capacity + 1);
+    }
+    return inlinable;
+}
+
+#define PASS_LOCALS(slots)  passLocals(slots)
+#else
+#define PASS_LOCALS(slots)  false
+#endif
+
+void optimizeChunk(Chunk* chunkToOptimize, int slots) {
+    bool changed, modified = false;
+    int  before, passes = 0;
+
+    chunk    = chunkToOptimize;
+    instrs   = NULL;
+    indices  = NULL;
+    capacity = 0;
+
+    if (chunk->count > 0 && decode()) {
+        do {
+            do {
+                before    = count;
+                markLive();
+                changed   = rewrite();
+                modified |= changed;
+                if (!compact())
+                    goto done;
+            } while (changed || count < before);
+
+            changed   = passes++ < MAX_PASSES && PASS_LOCALS(slots);
+            modified |= changed;
+        } while (changed);
+
+        if (modified || count < capacity)
+            layout();
+    }
+
+done:
+    if (instrs) {
+        FREE_ARRAY(Instr, instrs, capacity);
+        FREE_ARRAY(int16_t, indices, capacity + 1);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef clox_peephole_h
+#define clox_peephole_h
+
+#include "chunk.h"
+
+// Rewrites the code of a chunk just compiled, before it is frozen: jumps to jumps and returns
+// are threaded, unreachable code is removed and redundant stack operations are dropped. Jump
+// offsets and line starts are rebuilt, constants are left as they are. Slots are the stack slots
+// of the function at its start, itself and its parameters.
+
+void optimizeChunk(Chunk* chunk, int slots);
+
+// Length of the instruction at offset in the code of a chunk, including its operands
+int  instructionLength(const Chunk* chunk, int offset);
+
+#ifndef KIT68K
+// Option -O: also propagate constants and copies of locals and remove dead stores into them
+void setOptimizeLocals(bool enable);
+
+// True if the code of a function can be inlined: it only reads its parameters and globals, and
+// each return leaves its result on top of them. Sets calls if it calls anything.
+bool canInline(Chunk* chunk, int slots, bool* calls);
+#endif
+
+#endif
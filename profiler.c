@@ -0,0 +1,303 @@
+#if defined(LOX_DBG) && !defined(KIT68K)
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "profiler.h"
+#include "vm.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Call tree, built while profiling. Nodes live in the C heap to keep the Lox heap undisturbed.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct ProfNode {
+    const void*      key;       // ObjFunction* or Native* of the callee
+    char*            name;      // copy of callee name, since a function may be collected meanwhile
+    struct ProfNode* parent;    // caller
+    struct ProfNode* child;     // first callee
+    struct ProfNode* sibling;   // next callee of same caller
+    steps_t          calls;     // number of calls along this path
+    steps_t          selfSteps; // VM instructions executed in callee itself
+    double           selfTime;  // wall clock seconds spent in callee itself
+} ProfNode;
+
+typedef struct {
+    ProfNode* node;
+    int       depth;            // vm.frameCount when entered
+    bool      isNative;         // natives don't push a call frame, so leave them explicitly
+} ProfEntry;
+
+#define PROF_STACK_MAX (FRAMES_MAX + 1)
+
+static ProfNode  root;
+static ProfEntry stack[PROF_STACK_MAX];
+static int       stackCount;
+static steps_t   lastSteps;
+static double    lastTime;
+
+// Seconds of a monotonic wall clock, clock() would only count CPU time
+static double now(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER        counter;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static ProfNode* currentNode(void) {
+    return stackCount ? stack[stackCount - 1].node : &root;
+}
+
+static void freeNodes(ProfNode* node) {
+    ProfNode* next;
+    while (node) {
+        next = node->sibling;
+        freeNodes(node->child);
+        free(node->name);
+        free(node);
+        node = next;
+    }
+}
+
+// Attribute instructions and time since the last event to the running callee.
+static void charge(void) {
+    ProfNode* node  = currentNode();
+    steps_t   steps = vm.stepsExecuted;
+    double    time  = now();
+
+    // interpret() restarts counting steps with each evaluation
+    node->selfSteps += (steps >= lastSteps) ? steps - lastSteps : steps;
+    node->selfTime  += time - lastTime;
+    lastSteps = steps;
+    lastTime  = time;
+}
+
+// Drop entries of frames already left by exceptions or interrupts.
+static void unwind(void) {
+    while (stackCount && stack[stackCount - 1].depth > vm.frameCount)
+        stackCount--;
+}
+
+static void enter(const void* key, const char* name, int depth, bool isNative) {
+    ProfNode* parent;
+    ProfNode* node;
+
+    charge();
+    unwind();
+    parent = currentNode();
+
+    for (node = parent->child; node; node = node->sibling)
+        if (node->key == key && !strcmp(node->name, name))
+            break;
+
+    if (node == NULL) {
+        node = (ProfNode*)calloc(1, sizeof(ProfNode));
+        if (node)
+            node->name = (char*)malloc(strlen(name) + 1);
+        if (node == NULL || node->name == NULL) {
+            free(node);
+            putstr("Profiler out of memory, stopped.\n");
+            vm.debug_profile = false;
+            return;
+        }
+        strcpy(node->name, name);
+        node->key      = key;
+        node->parent   = parent;
+        node->sibling  = parent->child;
+        parent->child  = node;
+    }
+    node->calls++;
+
+    if (stackCount < PROF_STACK_MAX) {
+        stack[stackCount].node     = node;
+        stack[stackCount].depth    = depth;
+        stack[stackCount].isNative = isNative;
+        stackCount++;
+    }
+}
+
+void resetProfile(void) {
+    int i;
+
+    freeNodes(root.child);
+    mem_clear(&root, sizeof(root));
+    stackCount = 0;
+    lastSteps  = vm.stepsExecuted;
+    lastTime   = now();
+
+    // Functions already active when profiling starts are entered once.
+    for (i = 0; i < vm.frameCount; i++)
+        enter(vm.frames[i].closure->function, functionName(vm.frames[i].closure->function),
+              i + 1, false);
+}
+
+void profileCall(ObjFunction* function) {
+    enter(function, functionName(function), vm.frameCount, false);
+}
+
+void profileNative(const Native* native) {
+    enter(native, native->name, vm.frameCount, true);
+}
+
+void profileNativeEnd(void) {
+    charge();
+    if (stackCount && stack[stackCount - 1].isNative)
+        stackCount--;
+    unwind();
+}
+
+void profileReturn(void) {
+    charge();
+    unwind();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reporting
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const void* key;
+    const char* name;
+    steps_t     calls;
+    steps_t     selfSteps;
+    steps_t     totalSteps;
+    double      selfTime;
+    double      totalTime;
+} ProfStat;
+
+static char      path[INPUT_SIZE]; // for writing folded stacks
+static ProfStat* stats;
+static int       statCount;
+static int       statCapacity;
+
+static ProfStat* findStat(ProfNode* node) {
+    int i;
+    for (i = 0; i < statCount; i++)
+        if (stats[i].key == node->key && !strcmp(stats[i].name, node->name))
+            return &stats[i];
+
+    if (statCount == statCapacity) {
+        statCapacity = statCapacity ? 2 * statCapacity : 64;
+        stats = (ProfStat*)realloc(stats, statCapacity * sizeof(ProfStat));
+        if (stats == NULL) {
+            fprintf(stderr, "Profiler out of memory.\n");
+            exit(1);
+        }
+    }
+    mem_clear(&stats[statCount], sizeof(ProfStat));
+    stats[statCount].key  = node->key;
+    stats[statCount].name = node->name;
+    return &stats[statCount++];
+}
+
+static bool recursiveCall(ProfNode* node) {
+    ProfNode* caller;
+    for (caller = node->parent; caller != &root; caller = caller->parent)
+        if (caller->key == node->key && !strcmp(caller->name, node->name))
+            return true;
+    return false;
+}
+
+// Sum up subtree of node, inclusive values of recursive calls are counted only at the outermost call.
+static void collectStats(ProfNode* node, steps_t* steps, double* time) {
+    ProfNode* child;
+    ProfStat* stat;
+    steps_t   totalSteps = node->selfSteps;
+    double    totalTime  = node->selfTime;
+
+    for (child = node->child; child; child = child->sibling)
+        collectStats(child, &totalSteps, &totalTime);
+
+    stat = findStat(node);
+    stat->calls     += node->calls;
+    stat->selfSteps += node->selfSteps;
+    stat->selfTime  += node->selfTime;
+    if (!recursiveCall(node)) {
+        stat->totalSteps += totalSteps;
+        stat->totalTime  += totalTime;
+    }
+    *steps += totalSteps;
+    *time  += totalTime;
+}
+
+static int compareStats(const void* a, const void* b) {
+    steps_t stepsA = ((const ProfStat*)a)->selfSteps;
+    steps_t stepsB = ((const ProfStat*)b)->selfSteps;
+    return (stepsA < stepsB) - (stepsA > stepsB);
+}
+
+static void printStats(void) {
+    ProfNode* child;
+    steps_t   steps = root.selfSteps;
+    double    time  = root.selfTime;
+    int       i;
+
+    statCount = 0;
+    for (child = root.child; child; child = child->sibling)
+        collectStats(child, &steps, &time);
+    qsort(stats, statCount, sizeof(ProfStat), compareStats);
+
+    printf("== profile (%llu steps, %.3f sec) ==\n", steps, time);
+    printf("%10s %12s %12s %9s %9s  %s\n",
+           "calls", "self steps", "total steps", "self sec", "total sec", "function");
+    for (i = 0; i < statCount; i++)
+        printf("%10llu %12llu %12llu %9.3f %9.3f  %s\n",
+               stats[i].calls, stats[i].selfSteps, stats[i].totalSteps,
+               stats[i].selfTime, stats[i].totalTime, stats[i].name);
+}
+
+// Folded stacks as used by flamegraph.pl and speedscope, one line per call path,
+// weighted by instructions executed in the last function of the path.
+static void writeFolded(FILE* file, ProfNode* node, char* path, size_t length) {
+    size_t nameLength = strlen(node->name);
+
+    if (length + nameLength + 2 < INPUT_SIZE) {
+        if (length)
+            path[length++] = ';';
+        strcpy(path + length, node->name);
+        length += nameLength;
+    }
+    if (node->selfSteps)
+        fprintf(file, "%s %llu\n", path, node->selfSteps);
+    for (node = node->child; node; node = node->sibling)
+        writeFolded(file, node, path, length);
+    path[length] = '\0';
+}
+
+bool printProfile(const char* foldedFile) {
+    FILE*     file;
+    ProfNode* node;
+
+    if (vm.debug_profile)
+        charge();
+
+    if (foldedFile == NULL) {
+        printStats();
+        return true;
+    }
+
+    file = fopen(foldedFile, "w");
+    if (file == NULL)
+        return false;
+    for (node = root.child; node; node = node->sibling)
+        writeFolded(file, node, path, 0);
+    fclose(file);
+    return true;
+}
+
+#endif
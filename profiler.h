@@ -0,0 +1,31 @@
+#ifndef clox_profiler_h
+#define clox_profiler_h
+
+#include "object.h"
+
+// Deterministic call profiler, only in the debug build on the host.
+// On the Kit, the hooks expand to nothing.
+
+#if defined(LOX_DBG) && !defined(KIT68K)
+
+void resetProfile(void);
+void profileCall(ObjFunction* function);
+void profileNative(const Native* native);
+void profileNativeEnd(void);
+void profileReturn(void);
+bool printProfile(const char* foldedFile);
+
+#define PROFILE_CALL(function) if (vm.debug_profile) profileCall(function)
+#define PROFILE_NATIVE(native) if (vm.debug_profile) profileNative(native)
+#define PROFILE_NATIVE_END()   if (vm.debug_profile) profileNativeEnd()
+#define PROFILE_RETURN()       if (vm.debug_profile) profileReturn()
+
+#else
+
+#define PROFILE_CALL(function)
+#define PROFILE_NATIVE(native)
+#define PROFILE_NATIVE_END()
+#define PROFILE_RETURN()
+
+#endif
+#endif
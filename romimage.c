@@ -0,0 +1,390 @@
+#ifndef KIT68K
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+#include "memory.h"
+#include "romimage.h"
+#include "vm.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Image format
+//
+// The image starts with RomHeader, followed by the objects: each function with its code, line
+// starts and constants, closures without upvalues, then all strings and reals. Pointers are
+// absolute addresses for the place the image is used at, so objects and arrays are used in place
+// without relocation.
+//
+// All objects have a null nextObj and are already marked. The GC doesn't follow marked objects,
+// doesn't remove marked strings from vm.strings and only sweeps objects in vm.objects, so it
+// never writes to the image nor frees anything in it. The only object field set at runtime,
+// the class of a method, is left nil for functions in the image, see defineMethod().
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define ROM_VERSION 2
+
+typedef struct {
+    char         magic[4];
+    uint8_t      version;
+    uint8_t      numOpcodes;
+    uint8_t      pointerSize;
+    uint8_t      unused;
+    uint32_t     size;          // of whole image
+    ObjFunction* script;
+    int32_t      stringCount;
+    ObjString*   strings[];     // all strings of image, interned when opened
+} RomHeader;
+
+static const char  romMagic[4] = {'L', 'X', 'R', 'M'};
+static const char* romStart;
+static const char* romEnd;
+
+bool inRomImage(const void* pointer) {
+    return (const char*)pointer >= romStart && (const char*)pointer < romEnd;
+}
+
+// Image of any version, not a source
+bool isRomImage(const char* image) {
+    return mem_equal(image, romMagic, sizeof(romMagic));
+}
+
+// Interns strings of image, so call before initVM() to share "init" and names of natives.
+// Returns script function or NULL when image doesn't fit this interpreter.
+ObjFunction* openRomImage(const char* image) {
+    const RomHeader* header = (const RomHeader*)image;
+    int              i;
+
+    if (!mem_equal(header->magic, romMagic, sizeof(romMagic)) || header->version != ROM_VERSION
+     || header->numOpcodes != NUM_OPCODES || header->pointerSize != sizeof(void*))
+        return NULL;
+
+    romStart = image;
+    romEnd   = image + header->size;
+    for (i = 0; i < header->stringCount; i++)
+        tableSet(&vm.strings, OBJ_VAL(header->strings[i]), NIL_VAL);
+    return header->script;
+}
+
+#ifndef KIT68K
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writing images for the host or the Kit
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Offsets of fields in RomHeader and objects of target
+typedef struct {
+    bool     bigEndian;
+    int      pointerSize, align;
+    uint32_t base;
+    int      script, stringCount, strings;                              // RomHeader
+    int      type, isMarked;                                            // Obj
+    int      arity, upvalueCount, count, capacity, code, lineCount;     // ObjFunction
+    int      lineCapacity, lines, constCount, constCapacity, constValues;
+    int      name, functionSize;
+    int      closureCount, closureFunction, closureSize;                // ObjClosure
+    int      length, hash, chars;                                       // ObjString
+    int      content, realObjSize;                                      // ObjReal
+} Layout;
+
+// 68000 with IDE68K: big endian, 16 bit alignment, Real in Motorola FFP format
+static const Layout kitLayout = {
+    true, 4, 2, ROM_IMAGE_KIT,
+    12, 16, 20,
+    4, 5,
+    6, 7, 8, 10, 12, 16,
+    18, 20, 24, 26, 28,
+    32, 44,
+    6, 8, 12,
+    6, 8, 12,
+    6, 10
+};
+
+// Native byte order, set when writing
+static Layout hostLayout = {
+    false, sizeof(void*), sizeof(void*), ROM_IMAGE_HOST,
+    offsetof(RomHeader, script), offsetof(RomHeader, stringCount), offsetof(RomHeader, strings),
+    offsetof(Obj, type), offsetof(Obj, isMarked),
+    offsetof(ObjFunction, arity), offsetof(ObjFunction, upvalueCount),
+    offsetof(ObjFunction, chunk.count), offsetof(ObjFunction, chunk.capacity),
+    offsetof(ObjFunction, chunk.code), offsetof(ObjFunction, chunk.lineCount),
+    offsetof(ObjFunction, chunk.lineCapacity), offsetof(ObjFunction, chunk.lines),
+    offsetof(ObjFunction, chunk.constants.count), offsetof(ObjFunction, chunk.constants.capacity),
+    offsetof(ObjFunction, chunk.constants.values),
+    offsetof(ObjFunction, name), sizeof(ObjFunction),
+    offsetof(ObjClosure, upvalueCount), offsetof(ObjClosure, function), sizeof(ObjClosure),
+    offsetof(ObjString, length), offsetof(ObjString, hash), offsetof(ObjString, chars),
+    offsetof(ObjReal, content), sizeof(ObjReal)
+};
+
+typedef struct {
+    Obj*     object;
+    uint32_t address;
+    uint32_t code, lines, values;  // arrays of functions
+} Placed;
+
+static const Layout* layout;
+static Placed*       placed;
+static int           placedCount;
+static int           placedCapacity;
+static int           stringCount;
+static uint8_t*      image;
+
+static int findPlaced(Obj* object) {
+    int i;
+    for (i = 0; i < placedCount; i++)
+        if (placed[i].object == object)
+            return i;
+    return -1;
+}
+
+// Collects all objects reachable from value, false for objects not created by the compiler
+static bool collect(Value value) {
+    Obj*         object;
+    ObjFunction* function;
+    int          i;
+
+    if (!IS_OBJ(value) || findPlaced(AS_OBJ(value)) >= 0)
+        return true;
+    object = AS_OBJ(value);
+    if (object->type != OBJ_FUNCTION && object->type != OBJ_STRING && object->type != OBJ_REAL
+            && (object->type != OBJ_CLOSURE || ((ObjClosure*)object)->upvalueCount > 0))
+        return false;
+
+    if (placedCount == placedCapacity) {
+        placedCapacity = placedCapacity ? 2 * placedCapacity : 64;
+        placed         = (Placed*)realloc(placed, placedCapacity * sizeof(Placed));
+        if (placed == NULL)
+            return false;
+    }
+    placed[placedCount++].object = object;
+    if (object->type == OBJ_STRING)
+        stringCount++;
+
+    if (object->type == OBJ_FUNCTION) {
+        function = (ObjFunction*)object;
+        if (!collect(function->name))
+            return false;
+        for (i = 0; i < function->chunk.constants.count; i++)
+            if (!collect(function->chunk.constants.values[i]))
+                return false;
+    } else if (object->type == OBJ_CLOSURE)
+        return collect(OBJ_VAL(((ObjClosure*)object)->function));
+    return true;
+}
+
+static uint32_t alignUp(uint32_t address) {
+    return (address + layout->align - 1) & ~(uint32_t)(layout->align - 1);
+}
+
+// Assigns addresses to all objects and arrays, returns size of image
+static uint32_t place(void) {
+    uint32_t     top = alignUp(layout->strings + stringCount * layout->pointerSize);
+    ObjFunction* function;
+    int          i;
+
+    for (i = 0; i < placedCount; i++) {
+        Placed* p = &placed[i];
+
+        p->address = layout->base + top;
+        switch (p->object->type) {
+            case OBJ_FUNCTION:
+                function  = (ObjFunction*)p->object;
+                top       = alignUp(top + layout->functionSize);
+                p->code   = layout->base + top;
+                top       = alignUp(top + function->chunk.count);
+                p->lines  = layout->base + top;
+                top       = alignUp(top + function->chunk.lineCount * sizeof(LineStart));
+                p->values = layout->base + top;
+                top       = alignUp(top + function->chunk.constants.count * sizeof(Value));
+                break;
+            case OBJ_CLOSURE:
+                top = alignUp(top + layout->closureSize);
+                break;
+            case OBJ_STRING:
+                top = alignUp(top + layout->chars + ((ObjString*)p->object)->length + 1);
+                break;
+            default:
+                top = alignUp(top + layout->realObjSize);
+                break;
+        }
+    }
+    return top;
+}
+
+static void put(uint32_t address, uint32_t n, int size) {
+    uint8_t* dest = image + (address - layout->base);
+    int      i;
+
+    for (i = 0; i < size; i++)  // addresses are 32 bit, upper bytes of 64 bit pointers zero
+        dest[layout->bigEndian ? size - 1 - i : i] = i < 4 ? (n >> (8 * i)) & 0xff : 0;
+}
+
+static uint32_t addressOf(Value value) {
+    return IS_OBJ(value) ? placed[findPlaced(AS_OBJ(value))].address : (uint32_t)value;
+}
+
+// Motorola FFP: 24 bit mantissa, sign bit, 7 bit exponent excess 64; zero is all zero bits
+static uint32_t realToFFP(double x) {
+    double   mantissa;
+    int      exponent;
+    uint32_t bits;
+
+    if (x == 0)
+        return 0;
+    mantissa = frexp(fabs(x), &exponent);
+    bits     = (uint32_t)(mantissa * 16777216.0 + 0.5);
+    if (bits > 0xffffff) {
+        bits >>= 1;
+        exponent++;
+    }
+    if (exponent < -64)
+        return 0;
+    if (exponent > 63)
+        bits = 0xffffff, exponent = 63;
+    return (bits << 8) | (x < 0 ? 0x80 : 0) | (exponent + 64);
+}
+
+static void emitObject(Placed* p) {
+    uint32_t     at = p->address;
+    ObjFunction* function;
+    ObjString*   string;
+    Real         real;
+    int          i;
+
+    put(at + layout->type, p->object->type, 1);
+    put(at + layout->isMarked, true, 1);
+    switch (p->object->type) {
+        case OBJ_FUNCTION:
+            function = (ObjFunction*)p->object;
+            put(at + layout->arity,         function->arity, 1);
+            put(at + layout->upvalueCount,  function->upvalueCount, 1);
+            put(at + layout->count,         function->chunk.count, 2);
+            put(at + layout->capacity,      function->chunk.count, 2);
+            put(at + layout->code,          p->code, layout->pointerSize);
+            put(at + layout->lineCount,     function->chunk.lineCount, 2);
+            put(at + layout->lineCapacity,  function->chunk.lineCount, 2);
+            put(at + layout->lines,         p->lines, layout->pointerSize);
+            put(at + layout->constCount,    function->chunk.constants.count, 2);
+            put(at + layout->constCapacity, function->chunk.constants.count, 2);
+            put(at + layout->constValues,   p->values, layout->pointerSize);
+            put(at + layout->name,          addressOf(function->name), sizeof(Value));
+
+            mem_copy(image + (p->code - layout->base), function->chunk.code, function->chunk.count);
+            for (i = 0; i < function->chunk.lineCount; i++) {
+                put(p->lines + 4 * i,     function->chunk.lines[i].offset, 2);
+                put(p->lines + 4 * i + 2, function->chunk.lines[i].line, 2);
+            }
+            for (i = 0; i < function->chunk.constants.count; i++)
+                put(p->values + sizeof(Value) * i,
+                    addressOf(function->chunk.constants.values[i]), sizeof(Value));
+            break;
+
+        case OBJ_CLOSURE:
+            function = ((ObjClosure*)p->object)->function;
+            put(at + layout->closureCount,    0, 2);
+            put(at + layout->closureFunction, addressOf(OBJ_VAL(function)), layout->pointerSize);
+            break;
+
+        case OBJ_STRING:
+            string = (ObjString*)p->object;
+            put(at + layout->length, string->length, 2);
+            put(at + layout->hash,   string->hash, 4);
+            mem_copy(image + (at - layout->base) + layout->chars, string->chars, string->length);
+            break;
+
+        default:
+            real = ((ObjReal*)p->object)->content;
+            if (layout == &kitLayout)
+                put(at + layout->content, realToFFP(real), 4);
+            else
+                mem_copy(image + (at - layout->base) + layout->content, &real, sizeof(Real));
+            break;
+    }
+}
+
+// Writes image of script and all its functions for the host or the Kit's ROM.
+bool writeRomImage(ObjFunction* script, const char* path, bool forKit) {
+    union { uint16_t n; uint8_t bytes[2]; } endian;
+    FILE*     file;
+    uint32_t  size;
+    int       i, s;
+    bool      ok;
+
+    endian.n             = 1;
+    hostLayout.bigEndian = endian.bytes[0] == 0;
+    layout               = forKit ? &kitLayout : &hostLayout;
+    placedCount = stringCount = 0;
+    if (!collect(OBJ_VAL(script)))
+        return false;
+    size  = place();
+    image = (uint8_t*)calloc(size, 1);
+    if (image == NULL)
+        return false;
+
+    mem_copy(image, romMagic, sizeof(romMagic));
+    image[4] = ROM_VERSION;
+    image[5] = NUM_OPCODES;
+    image[6] = layout->pointerSize;
+    put(layout->base + 8, size, 4);
+    put(layout->base + layout->script, placed[0].address, layout->pointerSize);
+    put(layout->base + layout->stringCount, stringCount, 4);
+    for (i = s = 0; i < placedCount; i++) {
+        if (placed[i].object->type == OBJ_STRING)
+            put(layout->base + layout->strings + layout->pointerSize * s++,
+                placed[i].address, layout->pointerSize);
+        emitObject(&placed[i]);
+    }
+
+    file = fopen(path, "wb");
+    ok   = file != NULL && fwrite(image, 1, size, file) == size;
+    if (file != NULL && fclose(file) != 0)
+        ok = false;
+    free(image);
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Read-only mapping of images on the host
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+
+const char* mapRomImage(const char* path) {
+    return NULL; // not supported
+}
+
+#else
+
+// Maps image read-only at the address it was written for, NULL on failure
+const char* mapRomImage(const char* path) {
+    void*       address = (void*)(intptr_t)ROM_IMAGE_HOST;
+    struct stat info;
+    void*       mapped;
+    int         fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(RomHeader)) {
+        close(fd);
+        return NULL;
+    }
+    mapped = mmap(address, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return NULL;
+    if (mapped != address) {
+        munmap(mapped, info.st_size);
+        return NULL;
+    }
+    return (const char*)mapped;
+}
+
+#endif
+#endif
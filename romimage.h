@@ -0,0 +1,23 @@
+#ifndef clox_romimage_h
+#define clox_romimage_h
+
+#include "object.h"
+
+// Precompiled script function with all its functions, strings and reals, laid out as objects
+// at a fixed address in read-only memory and used in place: the standard library in the Kit's
+// ROM, or an image mapped read-only on the host. The image objects are never freed and
+// always marked, so the GC never writes to them.
+
+#define ROM_IMAGE_KIT  0x5e000    // address of standard library in ROM, loxlibsrc in cstart_common.asm
+#define ROM_IMAGE_HOST 0x30000000 // address of image mapped on the host
+
+ObjFunction* openRomImage(const char* image);
+bool         isRomImage(const char* image);
+bool         inRomImage(const void* pointer);
+
+#ifndef KIT68K
+bool         writeRomImage(ObjFunction* script, const char* path, bool forKit);
+const char*  mapRomImage(const char* path);
+#endif
+
+#endif
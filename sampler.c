@@ -0,0 +1,216 @@
+#if !defined(KIT68K) && !defined(_WIN32)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "nano_malloc.h"
+#include "object.h"
+#include "sampler.h"
+#include "vm.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ring buffer, filled by the signal handler, emptied by drainSamples()
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SAMPLE_DEPTH 4    // innermost frames recorded per sample
+#define RING_SIZE    1024 // samples buffered between two drains
+
+typedef struct {
+    ObjFunction* functions[SAMPLE_DEPTH];
+    int16_t      offsets[SAMPLE_DEPTH];
+    int16_t      depth;
+} Sample;
+
+static Sample                ring[RING_SIZE];
+static volatile sig_atomic_t ringHead;     // next slot written by handler
+static volatile sig_atomic_t ringTail;     // next slot read by drainSamples()
+static volatile sig_atomic_t ringDropped;  // samples lost since ring was full
+
+bool                  samplerRunning;
+volatile sig_atomic_t samplesPending;      // ring half full, drained at next safe point
+
+// The handler may interrupt the VM while it sets up a frame, so all pointers are validated.
+static ObjFunction* frameFunction(CallFrame* frame, int16_t* offset) {
+    ObjClosure*  closure = frame->closure;
+    ObjFunction* function;
+    ptrdiff_t    delta;
+
+    if (!nano_contains(closure) || closure->type != OBJ_CLOSURE)
+        return NULL;
+    function = closure->function;
+    if (!nano_contains(function) || function->type != OBJ_FUNCTION)
+        return NULL;
+    delta = frame->ip - function->chunk.code;
+    if (delta < 1 || delta > function->chunk.count)
+        return NULL;
+    *offset = (int16_t)(delta - 1); // ip already advanced past opcode
+    return function;
+}
+
+static void sampleHandler(int signal) {
+    int     frameCount = vm.frameCount;
+    int     next       = (ringHead + 1) % RING_SIZE;
+    Sample* sample;
+
+    if (frameCount <= 0 || frameCount > FRAMES_MAX)
+        return;
+    if (next == ringTail) {
+        ringDropped++;
+        return;
+    }
+
+    sample = &ring[ringHead];
+    for (sample->depth = 0; sample->depth < SAMPLE_DEPTH && frameCount > 0; ) {
+        frameCount--;
+        sample->functions[sample->depth] =
+            frameFunction(&vm.frames[frameCount], &sample->offsets[sample->depth]);
+        if (sample->functions[sample->depth])
+            sample->depth++;
+    }
+    if (sample->depth) {
+        ringHead = next;
+        if ((next - ringTail + RING_SIZE) % RING_SIZE >= RING_SIZE / 2)
+            samplesPending = true;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hot spots per source line, resolved from samples in the C heap
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    ObjFunction* function;  // only valid until next sweep, name kept for reporting
+    char*        name;
+    int          line;
+    uint32_t     self;      // samples with this line innermost
+    uint32_t     total;     // samples with this line anywhere in the recorded stack
+} HotSpot;
+
+static HotSpot* spots;
+static int      spotCount;
+static int      spotCapacity;
+static uint32_t sampleCount;
+static uint32_t droppedCount;
+static int      interval;
+
+static HotSpot* findSpot(ObjFunction* function, int line) {
+    const char* name = functionName(function);
+    HotSpot*    spot;
+    int         i;
+
+    for (i = 0; i < spotCount; i++) {
+        spot = &spots[i];
+        if (spot->line == line && spot->function == function && !strcmp(spot->name, name))
+            return spot;
+    }
+
+    if (spotCount == spotCapacity) {
+        spotCapacity = spotCapacity ? 2 * spotCapacity : 256;
+        spots = (HotSpot*)realloc(spots, spotCapacity * sizeof(HotSpot));
+        if (spots == NULL)
+            goto outOfMemory;
+    }
+    spot = &spots[spotCount];
+    spot->name = (char*)malloc(strlen(name) + 1);
+    if (spot->name == NULL)
+        goto outOfMemory;
+    strcpy(spot->name, name);
+    spot->function = function;
+    spot->line     = line;
+    spot->self     = 0;
+    spot->total    = 0;
+    spotCount++;
+    return spot;
+
+outOfMemory:
+    fprintf(stderr, "Sampler out of memory.\n");
+    exit(1);
+}
+
+void drainSamples(void) {
+    Sample*  sample;
+    HotSpot* seen[SAMPLE_DEPTH];
+    HotSpot* spot;
+    int      i, j;
+
+    samplesPending = false;
+    while (ringTail != ringHead) {
+        sample = &ring[ringTail];
+        for (i = 0; i < sample->depth; i++) {
+            spot    = findSpot(sample->functions[i],
+                               getLine(&sample->functions[i]->chunk, sample->offsets[i]));
+            seen[i] = spot;
+            if (i == 0)
+                spot->self++;
+            for (j = 0; j < i && seen[j] != spot; j++)
+                ;
+            if (j == i) // count recursive lines once
+                spot->total++;
+        }
+        sampleCount++;
+        ringTail = (ringTail + 1) % RING_SIZE;
+    }
+    droppedCount += ringDropped;
+    ringDropped   = 0;
+}
+
+bool startSampler(int intervalMicros) {
+    struct sigaction action;
+    struct itimerval timer;
+
+    mem_clear(&action, sizeof(action));
+    action.sa_handler = sampleHandler;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0)
+        return false;
+
+    interval                  = intervalMicros;
+    timer.it_interval.tv_sec  = 0;
+    timer.it_interval.tv_usec = intervalMicros;
+    timer.it_value            = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0)
+        return false;
+
+    samplerRunning = true;
+    return true;
+}
+
+void stopSampler(void) {
+    struct itimerval timer;
+
+    if (!samplerRunning)
+        return;
+    mem_clear(&timer, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    drainSamples();
+    samplerRunning = false;
+}
+
+static int compareSpots(const void* a, const void* b) {
+    uint32_t selfA = ((const HotSpot*)a)->self;
+    uint32_t selfB = ((const HotSpot*)b)->self;
+    if (selfA != selfB)
+        return (selfA < selfB) - (selfA > selfB);
+    return ((const HotSpot*)b)->total - ((const HotSpot*)a)->total;
+}
+
+#define PERCENT(n) (sampleCount ? 100.0 * (n) / sampleCount : 0.0)
+
+void printSamples(void) {
+    int i;
+
+    qsort(spots, spotCount, sizeof(HotSpot), compareSpots);
+    fprintf(stderr, "== samples (%u every %d usec, %u dropped) ==\n",
+            sampleCount, interval, droppedCount);
+    fprintf(stderr, "%7s %7s %6s  %s\n", "self%", "total%", "line", "function");
+    for (i = 0; i < spotCount; i++)
+        fprintf(stderr, "%7.2f %7.2f %6d  %s\n",
+                PERCENT(spots[i].self), PERCENT(spots[i].total), spots[i].line, spots[i].name);
+}
+
+#endif
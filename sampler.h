@@ -0,0 +1,34 @@
+#ifndef clox_sampler_h
+#define clox_sampler_h
+
+#include "machine.h"
+
+// Statistical profiler driven by SIGPROF, available in both builds on POSIX hosts.
+// Elsewhere, the hook expands to nothing.
+
+#if !defined(KIT68K) && !defined(_WIN32)
+
+#include <signal.h>
+
+extern bool                  samplerRunning;
+extern volatile sig_atomic_t samplesPending;
+
+bool startSampler(int intervalMicros);
+void stopSampler(void);
+void drainSamples(void);
+void printSamples(void);
+
+// Samples must be resolved while their functions are still alive, so before any sweep.
+#define DRAIN_SAMPLES() if (samplerRunning) drainSamples()
+
+// The run loop drains the ring at calls, returns and loops once it is half full, so that long
+// runs without garbage collections don't drop samples.
+#define SAMPLES_SAFE_POINT() if (samplesPending) drainSamples()
+
+#else
+
+#define DRAIN_SAMPLES()
+#define SAMPLES_SAFE_POINT()
+
+#endif
+#endif
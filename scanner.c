@@ -18,10 +18,10 @@ typedef struct {
 
 static Scanner scanner;
 
-void initScanner(const char* source) {
+void initScanner(const char* source, int line) {
     scanner.start   = source;
     scanner.current = source;
-    scanner.line    = 1;
+    scanner.line    = line;
 }
 
 #define isAtEnd() (*scanner.current == '\0')
@@ -337,3 +337,11 @@ void scanToken(Token* token) {
     }
     makeToken(token, tType);
 }
+
+// Scans the token after the last one without consuming it
+void peekToken(Token* token) {
+    Scanner saved = scanner; // copy struct
+
+    scanToken(token);
+    scanner = saved;
+}
@@ -51,7 +51,8 @@ typedef struct {
     int16_t     line;    // source line number for error location
 } Token;
 
-void initScanner(const char* source);
+void initScanner(const char* source, int line);
 void scanToken(Token* token);
+void peekToken(Token* token);
 
 #endif
\ No newline at end of file
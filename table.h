@@ -8,6 +8,9 @@ typedef struct {
     Value value;
 } Entry;
 
+// Strings by their hash, all others by their bits, also used by OP_SWITCH
+#define HASH_VALUE(val) (IS_STRING(val) ? AS_STRING(val)->hash : (val))
+
 typedef struct {
     int16_t count;
     int16_t capacity;
@@ -0,0 +1,99 @@
+### Python script to run the Lox68k tests in test/ and check their output
+#
+# python3 test/test.py [options] [<test>.lox ...]
+#
+# Each test runs from source, from source with -O and from bytecode compiled by -c with -O.
+# Its output without banner and "Loading" lines is checked against <test>.out. Leading lines
+#   // options: <option> ...
+#   // before: <source> ...
+#   // compile after: <source> ...
+# give options for every run, sources run before the test, relative to test/, and sources run
+# before compiling it into bytecode instead of those before the test. When there is
+# a <test>_image.lox, it runs with --image after the test saved a heap image and is checked
+# against <test>_image.out.
+#
+#   --llox FILE      build to test
+#   --update         write <test>.out from current output instead of checking it
+
+import argparse, glob, os, subprocess, sys, tempfile
+
+test_dir = os.path.dirname(os.path.abspath(__file__))
+
+parser = argparse.ArgumentParser(description = "Run Lox68k tests.")
+parser.add_argument("files", nargs = "*", help = "tests, default all in test/")
+parser.add_argument("--llox",   default = "./llox", help = "build to test")
+parser.add_argument("--update", action = "store_true", help = "write expected output files")
+args = parser.parse_args()
+
+files = args.files or sorted(f for f in glob.glob(os.path.join(test_dir, "*.lox"))
+                             if not f.endswith("_image.lox"))
+failed = 0
+
+
+## Options and sources named by the leading "// options:", "// before:" and "// compile after:"
+## lines of file.
+def header(file):
+    options  = []
+    sources  = []
+    compiled = None
+    with open(file) as src:
+        for line in src:
+            words = line.split()
+            if words[:2] == ["//", "options:"]:
+                options = words[2:]
+            elif words[:2] == ["//", "before:"]:
+                sources = [os.path.join(test_dir, name) for name in words[2:]]
+            elif words[:3] == ["//", "compile", "after:"]:
+                compiled = [os.path.join(test_dir, name) for name in words[3:]]
+            else:
+                break
+    return options, sources, sources if compiled is None else compiled
+
+
+## Run llox with options, return program output without banner and "Loading" lines.
+def run(*options):
+    proc = subprocess.run([args.llox] + list(options), capture_output = True, text = True)
+    lines = [l for l in proc.stdout.splitlines()[1:] if not l.startswith("Loading ")]
+    return "\n".join(lines) + "\n"
+
+
+def check(file, mode, output):
+    global failed
+    expected_file = os.path.splitext(file)[0] + ".out"
+    if args.update:
+        with open(expected_file, "w") as dest:
+            dest.write(output)
+        return
+    try:
+        with open(expected_file) as src:
+            expected = src.read()
+    except FileNotFoundError:
+        print("{} not found, use --update.".format(expected_file))
+        sys.exit(10)
+    if output != expected:
+        print("{} {}: output differs from {}".format(file, mode, expected_file))
+        failed += 1
+
+
+for file in files:
+    options, sources, compiled = header(file)
+    sources  = options + sources + [file]
+    bytecode = file + "c"
+
+    check(file, "from source", run(*sources))
+    if not args.update:
+        check(file, "with -O", run("-O", *sources))
+        run("-O", *options, *compiled, "-c", file)
+        check(file, "from bytecode", run(*sources))
+        if os.path.exists(bytecode):
+            os.remove(bytecode)
+
+    after = os.path.splitext(file)[0] + "_image.lox"
+    if os.path.exists(after):
+        image = os.path.join(tempfile.gettempdir(), "lox68k_test.img")
+        run("-O", *sources, "--save-image", image)
+        check(after, "from heap image", run(*options, "--image", image, after))
+        os.remove(image)
+
+print("{} tests, {} failed".format(len(files), failed))
+sys.exit(10 if failed else 0)
@@ -0,0 +1,146 @@
+#ifndef KIT68K
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "timeline.h"
+#include "vm.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Trace event file, see "Trace Event Format" of the Chromium project
+//
+// Calls and natives are duration events, closed when their frame is left, also by exceptions.
+// GC and compilation phases are nested duration events, exceptions are instant events.
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    int  depth;      // vm.frameCount of the call, one deeper than caller for natives
+    bool isNative;   // natives don't push a call frame, so leave them explicitly
+} TimelineEntry;
+
+#define TIMELINE_STACK_MAX (FRAMES_MAX + 1)
+
+bool                 timelineRunning;
+static FILE*         file;
+static TimelineEntry stack[TIMELINE_STACK_MAX];
+static int           stackCount;
+static const char*   separator;
+
+// Microseconds of a monotonic clock
+static double now(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER        counter;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * 1e6 / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+}
+
+static void writeString(const char* str) {
+    putc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(file, "\\%c", *str);
+        else if ((unsigned char)*str < ' ')
+            fprintf(file, "\\u%04x", (unsigned char)*str);
+        else
+            putc(*str, file);
+    }
+    putc('"', file);
+}
+
+// Write event with phase 'B' (begin), 'E' (end) or 'i' (instant), name and category if given.
+static void writeEvent(char phase, const char* name, const char* category) {
+    fprintf(file, "%s{\"ph\": \"%c\", \"ts\": %.1f, \"pid\": 1, \"tid\": 1", separator, phase, now());
+    if (name) {
+        fputs(", \"name\": ", file);
+        writeString(name);
+    }
+    if (category)
+        fprintf(file, ", \"cat\": \"%s\"", category);
+    if (phase == 'i')
+        fputs(", \"s\": \"t\"", file);
+    putc('}', file);
+    separator = ",\n";
+}
+
+// Frames and a native can't exceed the stack
+static void enter(const char* name, const char* category, int depth, bool isNative) {
+    writeEvent('B', name, category);
+    stack[stackCount].depth    = depth;
+    stack[stackCount].isNative = isNative;
+    stackCount++;
+}
+
+static void leave(void) {
+    writeEvent('E', NULL, NULL);
+    stackCount--;
+}
+
+bool startTimeline(const char* fileName) {
+    file = fopen(fileName, "w");
+    if (file == NULL)
+        return false;
+    atexit(stopTimeline); // complete file also when exiting on fatal errors
+    fputs("[\n", file);
+    separator       = "";
+    stackCount      = 0;
+    timelineRunning = true;
+    return true;
+}
+
+void stopTimeline(void) {
+    if (!timelineRunning)
+        return;
+    while (stackCount)
+        leave();
+    fputs("\n]\n", file);
+    fclose(file);
+    timelineRunning = false;
+}
+
+void timelineCall(ObjFunction* function) {
+    enter(functionName(function), "lox", vm.frameCount, false);
+}
+
+void timelineNative(const Native* native) {
+    enter(native->name, "native", vm.frameCount + 1, true);
+}
+
+void timelineNativeEnd(void) {
+    if (stackCount && stack[stackCount - 1].isNative)
+        leave();
+}
+
+// Close calls and natives of frames already left by returns, exceptions or interrupts.
+void timelineUnwind(void) {
+    while (stackCount && stack[stackCount - 1].depth > vm.frameCount)
+        leave();
+}
+
+void timelineBegin(const char* name) {
+    writeEvent('B', name, "vm");
+}
+
+void timelineEnd(void) {
+    writeEvent('E', NULL, NULL);
+}
+
+void timelineException(const char* message) {
+    writeEvent('i', message, "exception");
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef clox_timeline_h
+#define clox_timeline_h
+
+#include "object.h"
+
+// Timeline of calls, natives, garbage collections, compilations and exceptions on the host,
+// written as Chrome trace events for chrome://tracing or Perfetto. Available in both builds.
+// On the Kit, the hooks expand to nothing.
+
+#ifndef KIT68K
+
+extern bool timelineRunning;
+
+bool startTimeline(const char* fileName);
+void stopTimeline(void);
+void timelineCall(ObjFunction* function);
+void timelineNative(const Native* native);
+void timelineNativeEnd(void);
+void timelineUnwind(void);
+void timelineBegin(const char* name);
+void timelineEnd(void);
+void timelineException(const char* message);
+
+#define TIMELINE_CALL(function)     if (timelineRunning) timelineCall(function)
+#define TIMELINE_NATIVE(native)     if (timelineRunning) timelineNative(native)
+#define TIMELINE_NATIVE_END()       if (timelineRunning) timelineNativeEnd()
+#define TIMELINE_RETURN()           if (timelineRunning) timelineUnwind()
+#define TIMELINE_BEGIN(name)        if (timelineRunning) timelineBegin(name)
+#define TIMELINE_END()              if (timelineRunning) timelineEnd()
+#define TIMELINE_EXCEPTION(message) if (timelineRunning) timelineException(message)
+
+#else
+
+#define TIMELINE_CALL(function)
+#define TIMELINE_NATIVE(native)
+#define TIMELINE_NATIVE_END()
+#define TIMELINE_RETURN()
+#define TIMELINE_BEGIN(name)
+#define TIMELINE_END()
+#define TIMELINE_EXCEPTION(message)
+
+#endif
+#endif
@@ -4,9 +4,14 @@
 #include <stdarg.h>
 
 #include "compiler.h"
+#include "cycles.h"
 #include "disasm.h"
 #include "memory.h"
 #include "native.h"
+#include "profiler.h"
+#include "romimage.h"
+#include "sampler.h"
+#include "timeline.h"
 #include "vm.h"
 
 VM vm;
@@ -50,6 +55,8 @@ static void resetStack(void) {
     vm.openUpvalues = NULL;
 }
 
+#define TRACE_ON_ERROR 16 // records of trace ring printed before backtrace
+
 static void printBacktrace(void) {
     int          i;
     size_t       instruction;
@@ -57,6 +64,10 @@ static void printBacktrace(void) {
     ObjFunction* function;
 
     putstr("\n");
+#ifdef LOX_DBG
+    if (vm.debug_trace_ring)
+        printTraceRing(TRACE_ON_ERROR);
+#endif
     for (i = vm.frameCount - 1; i >= 0; i--) {
         frame       = &vm.frames[i];
         function    = frame->closure->function;
@@ -89,6 +100,7 @@ void runtimeError(const char* format, ...) {
     va_start(args, format);
     vsprintf(big_buffer, format, args);
     va_end(args);
+    TIMELINE_EXCEPTION(big_buffer);
 
 #ifdef LOX_DBG
     if (vm.log_native_result) {
@@ -115,6 +127,7 @@ void runtimeError(const char* format, ...) {
             closeUpvalues(frame->fp);
             vm.sp         = frame->fp;
             vm.frameCount = i;
+            TIMELINE_RETURN();
             pushUnchecked(frame->handler);
             pushUnchecked(OBJ_VAL(makeString0(big_buffer)));
             vm.handleException = true; 
@@ -131,6 +144,8 @@ void userError(Value exception) {
     int        i;
     CallFrame* frame;
 
+    TIMELINE_EXCEPTION(IS_STRING(exception) ? AS_CSTRING(exception) : valueType(exception));
+
 #ifdef LOX_DBG
     if (vm.log_native_result) {
         putstr("/!\\ ");
@@ -158,6 +173,7 @@ void userError(Value exception) {
             closeUpvalues(frame->fp);
             vm.sp         = frame->fp;
             vm.frameCount = i;
+            TIMELINE_RETURN();
             pushUnchecked(frame->handler);
             pushUnchecked(exception);
             vm.handleException = true; 
@@ -184,6 +200,8 @@ void initVM(void) {
 #ifndef KIT68K
 void freeVM(void) {
     freeTable(&vm.globals);
+    freeTable(&vm.autoloads);
+    freeTable(&vm.constants);
     freeTable(&vm.strings);
     vm.initString = NULL;
     freeObjects();
@@ -218,6 +236,12 @@ if (vm.frameCount == FRAMES_MAX) {              \
     return false;                               \
 }
 
+#define CHECK_FUNCTION_BODY(function)                                    \
+if ((function)->lazy && !compileBody(function)) {                       \
+    runtimeError("'%s' has syntax errors.", functionName(function));     \
+    return false;                                                        \
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Closure calling
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -230,6 +254,7 @@ static bool callClosure(ObjClosure* closure, int argCount) {
     int          arity;
 
     CHECK_LOX_STACK_OVERFLOW()
+    CHECK_FUNCTION_BODY(function)
 
 #ifdef LOX_DBG
     if (vm.debug_trace_calls) {
@@ -262,6 +287,8 @@ static bool callClosure(ObjClosure* closure, int argCount) {
     frame->handler = NIL_VAL;
     frame->ip      = function->chunk.code;
     frame->fp      = vm.sp - arity - 1;
+    PROFILE_CALL(function);
+    TIMELINE_CALL(function);
     return true;
 }
 
@@ -271,6 +298,7 @@ static bool callWithHandler(void) {
     ObjFunction* function = closure->function;
 
     CHECK_LOX_STACK_OVERFLOW()
+    CHECK_FUNCTION_BODY(function)
 
     if (!isCallable(peek(0))) {
         runtimeError("Handler must be callable.");
@@ -291,6 +319,8 @@ static bool callWithHandler(void) {
     frame->handler = pop();
     frame->ip      = function->chunk.code;
     frame->fp      = vm.sp - 1;
+    PROFILE_CALL(function);
+    TIMELINE_CALL(function);
     return true;
 }
 
@@ -301,6 +331,7 @@ static bool callBinding(Value varName) {
     Value        previous = EMPTY_VAL;
 
     CHECK_LOX_STACK_OVERFLOW()
+    CHECK_FUNCTION_BODY(function)
 
 #ifdef LOX_DBG
     if (vm.debug_trace_calls) {
@@ -322,6 +353,8 @@ static bool callBinding(Value varName) {
     drop();
     frame->ip      = function->chunk.code;
     frame->fp      = vm.sp - 1;
+    PROFILE_CALL(function);
+    TIMELINE_CALL(function);
     return true;
 }
 
@@ -330,6 +363,7 @@ static bool callValue(Value callee, int argCount) {
     ObjClass*     klass;
     ObjBound*     bound;
     Value         initializer = NIL_VAL;
+    bool          success;
 
     if (IS_OBJ(callee)) {
         switch (OBJ_TYPE(callee)) {
@@ -367,7 +401,12 @@ static bool callValue(Value callee, int argCount) {
                 }
 #endif
 
-                if (!callNative(native, argCount, vm.sp - argCount)) // don't update vm.sp yet!
+                PROFILE_NATIVE(native);
+                TIMELINE_NATIVE(native);
+                success = callNative(native, argCount, vm.sp - argCount); // don't update vm.sp yet!
+                TIMELINE_NATIVE_END();
+                PROFILE_NATIVE_END();
+                if (!success)
                     return false;
                 vm.sp -= argCount;
 
@@ -433,11 +472,42 @@ static void defineMethod(ObjString* name) {
     ObjClass*   klass  = AS_CLASS(peek(1));
     ObjClosure* clos   = AS_CLOSURE(method);
 
-    clos->function->klass = klass;
+    if (!inRomImage(clos->function)) // read-only, class of method unknown
+        clos->function->klass = klass;
     tableSet(&klass->methods, OBJ_VAL(name), method);
     drop();
 }
 
+// Code to continue with for a case value, just after the OP_CASE entries if no label matches
+static uint8_t* switchCase(Value value, uint8_t* table, int entries, int kind, const Value* consts) {
+    uint8_t* entry = NULL;
+    Value    label;
+    int      index, probes;
+
+    if (kind == SWITCH_DENSE) {
+        if (IS_INT(value)) {
+            index = AS_INT(value) - AS_INT(consts[table[1]]);
+            if (index >= 0 && index < entries)
+                entry = table + index * CASE_SIZE;
+        }
+    } else if (IS_INT(value) || IS_STRING(value)) {
+        index = HASH_VALUE(value) & (entries - 1);
+        for (probes = 0; probes < entries; probes++) {
+            label = consts[table[index * CASE_SIZE + 1]];
+            if (valuesEqual(label, value)) {
+                entry = table + index * CASE_SIZE;
+                break;
+            }
+            if (IS_NIL(label))
+                break;
+            index = (index + 1) & (entries - 1);
+        }
+    }
+    if (entry == NULL)
+        return table + entries * CASE_SIZE;
+    return entry + CASE_SIZE + (int16_t)((entry[2] << 8) | entry[3]);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Upvalue handling
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -487,745 +557,45 @@ static void closeUpvalues(Value* last) {
 #define READ_USHORT() (frame->ip += 2, (frame->ip[-2] << 8) | frame->ip[-1])
 #define CURR_INSTR()  (frame->ip[-1])
 
+#if defined(LOX_DBG) && !defined(KIT68K)
+// The debug build runs as fast as the release build unless instrumentation is switched on
+#define SWITCH_RUN
+#define INSTRUMENTATION() (vm.debug_trace_steps || vm.debug_trace_calls || vm.debug_op_stats || \
+                           vm.debug_statistics || vm.debug_profile || vm.debug_count_steps || \
+                           vm.debug_trace_ring)
+
+#define RUN          runInstrumented
+#define INSTRUMENTED 1
+#include "vm_run.h"
+#undef  RUN
+#undef  INSTRUMENTED
+
+#define RUN          runFast
+#define INSTRUMENTED 0
+#include "vm_run.h"
+#undef  RUN
+#undef  INSTRUMENTED
+
 static EvalResult run(void) {
-    int   index, begin, end, i;
-    Value constant;
-
-    // The IDE68K ancient C compiler generates wrong code for local vars in case branches.
-    // Thus, we declare all needed variables at function start..
-    Int          aInt, bInt;
-    Real         aReal, bReal;
-    Value        aVal=NIL_VAL, bVal, cVal, resVal;
-    ObjString    *aStr, *bStr, *resStr;
-    ObjList      *aLst, *bLst, *resLst;
-    ObjIterator  *aIt;
-    ObjClass     *superclass, *subclass;
-    ObjInstance  *instance;
-    int          slotNr;
-    ObjFunction  *function;
-    ObjClosure   *closure;
-    int          argCount, itemCount;
-    int          offset;
-    int          upvalue;
-    CallFrame    *frame;
-    Value        *consts;
+    EvalResult result;
 
-    vm.hadStackoverflow  = false;
-    vm.handleException   = false;
+    do
+        result = INSTRUMENTATION() ? runInstrumented() : runFast();
+    while (result == EVAL_SWITCH);
+    return result;
+}
 
+#else
+// Only one variant on the Kit, to save memory
+#define RUN run
 #ifdef LOX_DBG
-    vm.log_native_result = false;
-    vm.stepsExecuted     = 0;
-    STATIC_BREAKPOINT();
+#define INSTRUMENTED 1
+#else
+#define INSTRUMENTED 0
 #endif
-
-updateFrame:
-    // Last op changed call frame, update cached values
-    frame  = &vm.frames[vm.frameCount - 1];
-    consts = frame->closure->function->chunk.constants.values;
-
-nextInst:
-    // Last op possibly caused stack overflow, check here
-    if (vm.hadStackoverflow) {
-        runtimeError("Lox value stack overflow.");
-        goto handleError;
-    }
-
-nextInstNoSO:
-    // Last op guaranteed no stack overflow, omit check
-    if (INTERRUPTED()) {
-        (void)READ_BYTE(); // avoid negative ip when interrupting before function start
-        // Make sure all dynvars are restored, but disable exception handlers
-        vm.interrupted = true;
-        runtimeError("Interrupted.");
-        return EVAL_INTERRUPTED;
-    }
-
-#ifdef LOX_DBG
-    if (vm.debug_trace_steps) {
-        printStack();
-        disassembleInst(&frame->closure->function->chunk,
-                        (int)(frame->ip - frame->closure->function->chunk.code));
-    }
-    ++vm.stepsExecuted;
+#include "vm_run.h"
 #endif
 
-    switch (READ_BYTE()) {
-        case OP_CONSTANT:
-            index    = READ_BYTE();
-            constant = consts[index];
-            push(constant);
-            goto nextInst;
-
-        case OP_INT:
-            push(INT_VAL((Int)READ_BYTE()));
-            goto nextInst;
-
-        case OP_ZERO:  push(INT_VAL(0)); goto nextInst;
-        case OP_NIL:   push(NIL_VAL);    goto nextInst;
-        case OP_TRUE:  push(TRUE_VAL);   goto nextInst;
-        case OP_FALSE: push(FALSE_VAL);  goto nextInst;
-        case OP_POP:   drop();           goto nextInstNoSO;
-        case OP_DUP:   push(peek(0));    goto nextInst;
-
-        case OP_SWAP:
-            aVal    = peek(0);
-            peek(0) = peek(1);
-            peek(1) = aVal;
-            goto nextInstNoSO;
-  
-        case OP_GET_LOCAL:
-            slotNr = READ_BYTE();
-            push(frame->fp[slotNr]);
-            goto nextInst;
-
-        case OP_SET_LOCAL:
-            slotNr = READ_BYTE();
-            frame->fp[slotNr] = peek(0);
-            goto nextInstNoSO;
-
-        case OP_GET_GLOBAL:
-            index    = READ_BYTE();
-            constant = consts[index];
-            if (!tableGet(&vm.globals, constant, &aVal)) {
-                runtimeError("Undefined variable '%s'.", AS_CSTRING(constant));
-                goto handleError;
-            }
-            push(aVal);
-            goto nextInst;
-
-        case OP_DEF_GLOBAL:
-            index    = READ_BYTE();
-            constant = consts[index];
-            tableSet(&vm.globals, constant, peek(0));
-            drop();
-            goto nextInstNoSO;
-
-        case OP_SET_GLOBAL:
-            index    = READ_BYTE();
-            constant = consts[index];
-            if (tableSet(&vm.globals, constant, peek(0))) {
-                tableDelete(&vm.globals, constant);
-                runtimeError("Undefined variable '%s'.", AS_CSTRING(constant));
-                goto handleError;
-            }
-            goto nextInstNoSO;
-
-        case OP_GET_UPVALUE:
-            slotNr = READ_BYTE();
-            push(*frame->closure->upvalues[slotNr]->location);
-            goto nextInst;
-
-        case OP_SET_UPVALUE:
-            slotNr = READ_BYTE();
-            *frame->closure->upvalues[slotNr]->location = peek(0);
-            goto nextInstNoSO;
-
-        case OP_GET_PROPERTY:
-            if (!IS_INSTANCE(peek(0))) {
-                runtimeError("Only instances have %s.", "properties");
-                goto handleError;
-            }
-            instance = AS_INSTANCE(peek(0));
-            index    = READ_BYTE();
-            constant = consts[index];
-            if (tableGet(&instance->fields, constant, &aVal)) {
-                dropNpush(1, aVal);
-                goto nextInstNoSO;
-            }
-            aStr = AS_STRING(constant);
-            if (!bindMethod(instance->klass, aStr))
-                goto handleError;
-            goto nextInstNoSO;
-
-        case OP_SET_PROPERTY:
-            if (!IS_INSTANCE(peek(1))) {
-                runtimeError("Only instances have %s.", "properties");
-                goto handleError;
-            }
-            instance = AS_INSTANCE(peek(1));
-            index    = READ_BYTE();
-            constant = consts[index];
-            tableSet(&instance->fields, constant, peek(0));
-            aVal = pop();
-            dropNpush(1, aVal);
-            goto nextInstNoSO;
-
-        case OP_GET_SUPER:
-            index      = READ_BYTE();
-            constant   = consts[index];
-            aStr       = AS_STRING(constant);
-            superclass = AS_CLASS(pop());
-            if (!bindMethod(superclass, aStr))
-                goto handleError;
-            goto nextInstNoSO;
-
-        case OP_EQUAL:
-            bVal = pop(); 
-            dropNpush(1, BOOL_VAL(valuesEqual(peek(0), bVal)));
-            goto nextInstNoSO;
-
-        case OP_LESS:
-            if (IS_INT(peek(0))) {
-                if (IS_INT(peek(1))) {
-                    bVal = pop(); 
-                    dropNpush(1, BOOL_VAL(peek(0) < bVal)); // relying on Value tagging for int
-                    goto nextInstNoSO;
-                } else if (IS_REAL(peek(1))) {
-                    aReal = AS_REAL(peek(1));
-                    bReal = intToReal(AS_INT(peek(0)));
-                    goto lessReals;
-                } else goto typeErrorLess;
-            } else if (IS_REAL(peek(0))) {
-                bReal = AS_REAL(peek(0));
-                if (IS_INT(peek(1)))
-                    aReal = intToReal(AS_INT(peek(1)));
-                else if (IS_REAL(peek(1)))
-                    aReal = AS_REAL(peek(1));
-                else goto typeErrorLess;
-            lessReals: 
-                dropNpush(2, BOOL_VAL(less(aReal,bReal)));
-            } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                bStr = AS_STRING(peek(0));
-                aStr = AS_STRING(peek(1));
-                dropNpush(2, BOOL_VAL(strcmp(aStr->chars, bStr->chars) < 0));
-            } else {
-            typeErrorLess:
-                runtimeError("Can't %s types %s and %s.", "order",
-                             valueType(peek(1)), valueType(peek(0)));
-                goto handleError;
-            }
-            goto nextInstNoSO;
-
-        case OP_ADD:
-            if (IS_INT(peek(0))) {
-                if (IS_INT(peek(1))) {
-                    bVal = pop(); 
-                    dropNpush(1, peek(0) + bVal - 1); // relying on Value tagging for int
-                    goto nextInstNoSO;
-                } else if (IS_REAL(peek(1))) {
-                    aReal = AS_REAL(peek(1));
-                    bReal = intToReal(AS_INT(peek(0)));
-                    goto addReals;
-                } else goto typeErrorAdd;
-            } else if (IS_REAL(peek(0))) {
-                bReal = AS_REAL(peek(0));
-                if (IS_INT(peek(1)))
-                    aReal = intToReal(AS_INT(peek(1)));
-                else if (IS_REAL(peek(1)))
-                    aReal = AS_REAL(peek(1));
-                else goto typeErrorAdd;
-            addReals: 
-                errno = 0;
-                dropNpush(2, makeReal(add(aReal,bReal)));
-                CHECK_ARITH_ERROR("+")
-            } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                bStr = AS_STRING(peek(0));
-                aStr = AS_STRING(peek(1));
-                resStr = concatStrings(aStr, bStr);
-                if (!resStr) {
-                    runtimeError("'%s' stringbuffer overflow.", "+");
-                    goto handleError;
-                }
-                dropNpush(2, OBJ_VAL(resStr));
-            } else if (IS_LIST(peek(0)) && IS_LIST(peek(1))) {
-                bLst = AS_LIST(peek(0));
-                aLst = AS_LIST(peek(1));
-                resLst = concatLists(aLst, bLst);
-                dropNpush(2, OBJ_VAL(resLst));
-            } else {
-            typeErrorAdd:
-                runtimeError("Can't %s types %s and %s.", "add",
-                             valueType(peek(1)), valueType(peek(0)));
-                goto handleError;
-            }
-            goto nextInstNoSO;
-
-        case OP_SUB:
-            if (IS_INT(peek(0))) {
-                if (IS_INT(peek(1))) {
-                    bVal = pop();
-                    dropNpush(1, peek(0) - bVal + 1); // relying on Value tagging for int
-                    goto nextInstNoSO;
-                } else if (IS_REAL(peek(1))) {
-                    aReal = AS_REAL(peek(1));
-                    bReal = intToReal(AS_INT(peek(0)));
-                } else goto typeErrorSub;
-            } else if (IS_REAL(peek(0))) {
-                bReal = AS_REAL(peek(0));
-                if (IS_INT(peek(1)))
-                    aReal = intToReal(AS_INT(peek(1)));
-                else if (IS_REAL(peek(1)))
-                    aReal = AS_REAL(peek(1));
-                else goto typeErrorSub;
-            } else {
-            typeErrorSub:
-                runtimeError("Can't %s types %s and %s.", "subtract",
-                             valueType(peek(1)), valueType(peek(0)));
-                goto handleError;
-            }
-            errno = 0;
-            dropNpush(2, makeReal(sub(aReal,bReal)));
-            CHECK_ARITH_ERROR("-")
-            goto nextInstNoSO;
-
-        case OP_MUL:
-            if (IS_INT(peek(0))) {
-                if (IS_INT(peek(1))) {
-                    bInt = AS_INT(pop());
-                    dropNpush(1, INT_VAL(AS_INT(peek(0)) * bInt));
-                    goto nextInstNoSO;
-                } else if (IS_REAL(peek(1))) {
-                    aReal = AS_REAL(peek(1));
-                    bReal = intToReal(AS_INT(peek(0)));
-                } else goto typeErrorMul;
-            } else if (IS_REAL(peek(0))) {
-                bReal = AS_REAL(peek(0));
-                if (IS_INT(peek(1)))
-                    aReal = intToReal(AS_INT(peek(1)));
-                else if (IS_REAL(peek(1)))
-                    aReal = AS_REAL(peek(1));
-                else goto typeErrorMul;
-            } else {
-            typeErrorMul:
-                runtimeError("Can't %s types %s and %s.", "multiply",
-                             valueType(peek(1)), valueType(peek(0)));
-                goto handleError;
-            }
-            errno = 0;
-            dropNpush(2, makeReal(mul(aReal,bReal)));
-            CHECK_ARITH_ERROR("*")
-            goto nextInstNoSO;
-
-        case OP_DIV:
-        case OP_MOD:
-            if (IS_INT(peek(0))) {
-                if (IS_INT(peek(1))) {
-                    bInt = AS_INT(pop());
-                    aInt = AS_INT(pop());
-                    if (bInt == 0) {
-                        runtimeError("Div by zero.");
-                        goto handleError;
-                    }
-                    if (CURR_INSTR()==OP_DIV) 
-                        aInt = aInt / bInt;
-                    else
-                        aInt = aInt % bInt;
-                    pushUnchecked(INT_VAL(aInt));
-                    goto nextInstNoSO;
-                } else if (IS_REAL(peek(1))) {
-                    aReal = AS_REAL(peek(1));
-                    bReal = intToReal(AS_INT(peek(0)));
-                } else goto typeErrorDiv;
-            } else if (IS_REAL(peek(0))) {
-                bReal = AS_REAL(peek(0));
-                if (IS_INT(peek(1)))
-                    aReal = intToReal(AS_INT(peek(1)));
-                else if (IS_REAL(peek(1)))
-                    aReal = AS_REAL(peek(1));
-                else goto typeErrorDiv;
-            } else {
-            typeErrorDiv:
-                runtimeError("Can't %s types %s and %s.", "divide",
-                             valueType(peek(1)), valueType(peek(0)));
-                goto handleError;
-            }
-            if (bReal == 0) {
-                runtimeError("Div by zero.");
-                goto handleError;
-            }
-            errno = 0;
-            if (CURR_INSTR()==OP_DIV)
-                aReal = div(aReal,bReal);
-            else
-                aReal = mod(aReal,bReal);
-            dropNpush(2, makeReal(aReal));
-            CHECK_ARITH_ERROR("div")
-            goto nextInstNoSO;
-
-        case OP_NOT:
-            peek(0) = BOOL_VAL(IS_FALSEY(peek(0)));
-            goto nextInstNoSO;
-
-        case OP_PRINT:
-            printValue(pop(), PRTF_HUMAN | PRTF_EXPAND);
-            goto nextInstNoSO;
-
-        case OP_PRINTLN:
-            printValue(pop(), PRTF_HUMAN | PRTF_EXPAND);
-            putstr("\n");
-            goto nextInstNoSO;
-
-        case OP_PRINTQ:
-            printValue(pop(), PRTF_MACHINE | PRTF_EXPAND);
-            putstr("\n");
-            goto nextInstNoSO;
-
-        case OP_JUMP:
-            offset = READ_USHORT();
-            frame->ip += offset;
-            goto nextInstNoSO;
-
-        case OP_JUMP_OR:
-            offset = READ_USHORT();
-            if (IS_FALSEY(peek(0)))
-                drop();
-            else
-                frame->ip += offset;
-            goto nextInstNoSO;
-
-        case OP_JUMP_AND:
-            offset = READ_USHORT();
-            if (IS_FALSEY(peek(0)))
-                frame->ip += offset;
-            else
-                drop();
-            goto nextInstNoSO;
-
-        case OP_JUMP_TRUE:
-            offset = READ_USHORT();
-            if (!IS_FALSEY(pop()))
-                frame->ip += offset;
-            goto nextInstNoSO;
-
-        case OP_JUMP_FALSE:
-            offset = READ_USHORT();
-            if (IS_FALSEY(pop()))
-                frame->ip += offset;
-            goto nextInstNoSO;
-
-        case OP_LOOP:
-            offset = READ_USHORT();
-            frame->ip -= offset;
-            goto nextInstNoSO;
-
-        case OP_CALL0:
-            argCount = 0;
-            goto cont_call;
-
-        case OP_CALL1:
-            argCount = 1;
-            goto cont_call;
-
-        case OP_CALL2:
-            argCount = 2;
-            goto cont_call;
-
-        case OP_CALL:
-            argCount = READ_BYTE();
-        cont_call:
-            if (!callValue(peek(argCount), argCount))
-                goto handleError;
-            goto updateFrame;
-
-        case OP_VCALL:
-            argCount = READ_BYTE() + AS_INT(pop());
-            goto cont_call;
-
-        case OP_CALL_HAND:
-            if (!callWithHandler())
-                goto handleError;
-            goto updateFrame;
-
-        case OP_CALL_BIND:
-            index    = READ_BYTE();
-            constant = consts[index];
-            if (!callBinding(constant))
-                goto handleError;
-            goto updateFrame;
-
-        case OP_INVOKE:
-            index    = READ_BYTE();
-            argCount = READ_BYTE();
-        cont_invoke:
-            constant = consts[index];
-            aStr = AS_STRING(constant);
-            if (!invoke(aStr, argCount))
-                goto handleError;
-            goto updateFrame;
-
-        case OP_VINVOKE:
-            index    = READ_BYTE();
-            argCount = READ_BYTE() + AS_INT(pop());
-            goto cont_invoke;
-
-        case OP_SUPER_INVOKE:
-            index      = READ_BYTE();
-            superclass = AS_CLASS(pop());
-            argCount   = READ_BYTE();
-        cont_super_invoke:
-            constant = consts[index];
-            aStr     = AS_STRING(constant);
-            if (!invokeFromClass(superclass, aStr, argCount))
-                goto handleError;
-            goto updateFrame;
-
-        case OP_VSUPER_INVOKE:
-            index      = READ_BYTE();
-            superclass = AS_CLASS(pop());
-            argCount   = READ_BYTE() + AS_INT(pop());
-            goto cont_super_invoke;
-
-        case OP_CLOSURE:
-            index    = READ_BYTE();
-            constant = consts[index];
-            function = AS_FUNCTION(constant);
-            closure  = makeClosure(function);
-            push(OBJ_VAL(closure));
-            for (i = 0; i < closure->upvalueCount; i++) {
-                upvalue = READ_BYTE();
-                if (UV_ISLOC(upvalue))
-                    closure->upvalues[i] = captureUpvalue(frame->fp + UV_INDEX(upvalue));
-                else
-                    closure->upvalues[i] = frame->closure->upvalues[UV_INDEX(upvalue)];
-            }
-            goto nextInst;
-
-        case OP_CLOSE_UPVALUE:
-            closeUpvalues(vm.sp - 1);
-            drop();
-            goto nextInstNoSO;
-
-        case OP_RETURN_NIL:
-            resVal = NIL_VAL;
-            goto cont_ret;
-
-        case OP_RETURN:
-            resVal = pop();
-        cont_ret:
-            closeUpvalues(frame->fp);
-
-            if (IS_DYNVAR(frame->handler))
-                restoreGlobal(frame->handler);
-
-            vm.frameCount--;
-
-#ifdef LOX_DBG
-            if (vm.debug_trace_calls) {
-                indentCallTrace();
-                printf("<-- %s ", functionName(frame->closure->function));
-                printValue(resVal, PRTF_MACHINE | PRTF_EXPAND);
-                putstr("\n");
-            }
-#endif
-
-            if (vm.frameCount == 0) {
-                drop();
-                return EVAL_OK;
-            }
-            vm.sp = frame->fp;
-            pushUnchecked(resVal);
-            goto updateFrame;
-
-        case OP_CLASS:
-            index    = READ_BYTE();
-            constant = consts[index];
-            aStr     = AS_STRING(constant);
-            push(OBJ_VAL(makeClass(aStr)));
-            goto nextInst;
-
-        case OP_INHERIT:
-            aVal = peek(1);
-            if (!IS_CLASS(aVal)) {
-                runtimeError("Can't %s type %s.", "inherit from", valueType(aVal));
-                goto handleError;
-            }
-            superclass = AS_CLASS(aVal);
-            subclass   = AS_CLASS(peek(0));
-            if (superclass == subclass) {
-                runtimeError("Can't %s itself.", "inherit from");
-                goto handleError;
-            }
-            subclass->superClass = superclass;
-            tableAddAll(&superclass->methods, &subclass->methods);
-            drop();
-            goto nextInstNoSO;
-
-        case OP_METHOD:
-            index    = READ_BYTE();
-            constant = consts[index];
-            aStr     = AS_STRING(constant);
-            defineMethod(aStr);
-            goto nextInstNoSO;
-
-        case OP_LIST:
-            argCount = READ_BYTE();
-        cont_list:
-            aLst     = makeList(argCount, vm.sp - argCount, argCount, 1);
-            dropNpush(argCount, OBJ_VAL(aLst));
-            goto nextInst;
-
-        case OP_VLIST:
-            argCount = READ_BYTE() + AS_INT(pop());
-            goto cont_list;
-
-        case OP_UNPACK:
-            aVal     = pop();
-            argCount = AS_INT(pop());
-            if (!IS_LIST(aVal)) {
-                runtimeError("Can't %s type %s.", "unpack", valueType(aVal));
-                goto handleError;
-            }
-            aLst      = AS_LIST(aVal);
-            itemCount = aLst->arr.count;
-            if (vm.sp + itemCount >= vm.stack + (STACK_MAX-1)) {
-                runtimeError("Lox value stack overflow.");
-                goto handleError;
-            }
-            for (i = 0; i < itemCount; i++)
-                vm.sp[i] = aLst->arr.values[i];
-            vm.sp += itemCount;
-            pushUnchecked(INT_VAL(itemCount + argCount));
-            goto nextInstNoSO;
-
-        case OP_GET_INDEX:
-            aVal = peek(0); // index
-            bVal = peek(1); // object
-
-            if (IS_LIST(bVal)) {
-                bLst = AS_LIST(bVal);
-                if (!IS_INT(aVal)) {
-                    runtimeError("%s is not an integer.", "List index");
-                    goto handleError;
-                }
-                index = AS_INT(aVal);
-                if (!validateIndex(bLst->arr.count, &index)) {
-                    runtimeError("%s out of range.", "List index");
-                    goto handleError;
-                }
-                resVal = bLst->arr.values[index];
-                dropNpush(2, resVal);
-                goto nextInstNoSO;
-            } else if (IS_STRING(bVal)) {
-                bStr = AS_STRING(bVal);
-                if (!IS_INT(aVal)) {
-                    runtimeError("%s is not an integer.", "String index");
-                    goto handleError;
-                }
-                index = AS_INT(aVal);
-                if (!validateIndex(bStr->length, &index)) {
-                    runtimeError("%s out of range.", "String index");
-                    goto handleError;
-                }
-                resVal = OBJ_VAL(makeString(bStr->chars + index, 1));
-                dropNpush(2, resVal);
-                goto nextInstNoSO;
-            } else if (IS_INSTANCE(bVal)) {
-                instance = AS_INSTANCE(bVal);
-                resVal   = NIL_VAL;
-                tableGet(&instance->fields, aVal, &resVal); // not found -> nil
-                dropNpush(2, resVal);
-                goto nextInstNoSO;
-            } else {
-                runtimeError("Can't %s type %s.", "index into", valueType(bVal));
-                goto handleError;
-            }
-
-        case OP_SET_INDEX:
-            cVal = peek(0); // item
-            aVal = peek(1); // index
-            bVal = peek(2); // object   
-
-            if (IS_LIST(bVal)) {
-                bLst = AS_LIST(bVal);
-                if (!IS_INT(aVal)) {
-                    runtimeError("%s is not an integer.", "List index");
-                    goto handleError;
-                }
-                index = AS_INT(aVal);
-                if (!validateIndex(bLst->arr.count, &index)) {
-                    runtimeError("%s out of range.", "List index");
-                    goto handleError;
-                }
-                bLst->arr.values[index] = cVal;
-                dropNpush(3, cVal);
-                goto nextInstNoSO;
-            } else if (IS_INSTANCE(bVal)) {
-                instance = AS_INSTANCE(bVal);
-                tableSet(&instance->fields, aVal, cVal);
-                dropNpush(3, cVal);
-                goto nextInstNoSO;
-            } else {
-                runtimeError("Can't %s type %s.", "store into", valueType(bVal));
-                goto handleError;
-            }
-
-        case OP_GET_SLICE:
-            aVal = pop();   // end
-            bVal = pop();   // begin
-            cVal = peek(0); // object
-
-            if (!IS_INT(bVal)) {
-                runtimeError("%s is not an integer.", "Slice begin");
-                goto handleError;
-            }
-            begin = AS_INT(bVal);
-            if (!IS_INT(aVal)) {
-                runtimeError("%s is not an integer.", "Slice end");
-                goto handleError;
-            }
-            end = AS_INT(aVal);
-            if (IS_LIST(cVal)) {
-                aLst   = AS_LIST(cVal);
-                resVal = OBJ_VAL(sliceFromList(aLst, begin, end));
-                dropNpush(1, resVal);
-                goto nextInstNoSO;
-            } else if (IS_STRING(cVal)) {
-                aStr   = AS_STRING(cVal);
-                resVal = OBJ_VAL(sliceFromString(aStr, begin, end));
-                dropNpush(1, resVal);
-                goto nextInstNoSO;
-            } else {
-                runtimeError("Can't %s type %s.", "slice into", valueType(cVal));
-                goto handleError;
-            }
-
-        case OP_GET_ITVAL:
-        case OP_GET_ITKEY:
-            aVal = peek(0); // iterator
-            if (!IS_ITERATOR(aVal)) {
-                runtimeError("Can't %s type %s.", "deref", valueType(aVal));
-                goto handleError;
-            }
-            aIt = AS_ITERATOR(aVal);
-            if (!isValidIterator(aIt)) {
-                runtimeError("Invalid iterator.");
-                goto handleError;
-            }
-            resVal = getIterator(aIt, CURR_INSTR()==OP_GET_ITKEY);
-            dropNpush(1, resVal);
-            goto nextInstNoSO;
-
-        case OP_SET_ITVAL:
-            bVal = peek(0); // item
-            aVal = peek(1); // iterator
-            if (!IS_ITERATOR(aVal)) {
-                runtimeError("Can't %s type %s.", "deref", valueType(aVal));
-                goto handleError;
-            }
-            aIt = AS_ITERATOR(aVal);
-            if (!isValidIterator(aIt)) {
-                runtimeError("Invalid iterator.");
-                goto handleError;
-            }
-            setIterator(aIt, bVal);
-            dropNpush(2, bVal);
-            goto nextInstNoSO;
-
-        default:
-            runtimeError("Invalid byte code $%02x.", CURR_INSTR());
-    }
-
-handleError:
-    if (vm.handleException) {
-        // handler and exception have already been pushed in runtimeError()
-        vm.handleException = false;
-        argCount           = 1;
-        goto cont_call;
-    }
-    return EVAL_RUNTIME_ERROR;
-}
-
 #ifndef KIT68K
 #include <signal.h>
 
@@ -1243,25 +613,41 @@ static void handleInterrupts(bool enable) {
 
 EvalResult interpret(const char* source) {
     ObjFunction* function = compile(source);
-    ObjClosure*  closure;
-    EvalResult   result;
 
     if (function == NULL)
         return EVAL_COMPILE_ERROR;
+    return interpretFunction(function);
+}
+
+// Run a script function, compiled or loaded, not yet reachable by GC.
+EvalResult interpretFunction(ObjFunction* function) {
+    ObjClosure*  closure;
+    EvalResult   result;
 
     pushUnchecked(OBJ_VAL(function));
     closure = makeClosure(function);
     peek(0) = OBJ_VAL(closure);
+
+#ifdef LOX_DBG
+    vm.stepsExecuted = 0;
+    vm.started       = clock();
+    RESET_CYCLES();
+#endif
+
     callClosure(closure, 0);
 
+    vm.hadStackoverflow  = false;
+    vm.handleException   = false;
 #ifdef LOX_DBG
-    vm.started = clock();
+    vm.log_native_result = false;
+    STATIC_BREAKPOINT();
 #endif
 
     vm.interrupted = false;
     handleInterrupts(true);
     result = run();
     handleInterrupts(false);
+    TIMELINE_RETURN(); // frames left by uncaught errors
 
 #ifdef LOX_DBG
     STATIC_BREAKPOINT();
@@ -1269,11 +655,12 @@ EvalResult interpret(const char* source) {
 #ifdef KIT68K
         printf("[%d.%02d sec; %u steps; %d bytes; %d GCs]\n",
                (clock() - vm.started) / 100, (clock() - vm.started) % 100,
-               vm.stepsExecuted, vm.totallyAllocated, vm.numGCs);
+               vm.stepsExecuted, vm.totallyAllocated - vm.allocatedBefore, vm.numGCs - vm.gcsBefore);
 #else
-        printf("[%.3f sec; %llu steps; %d bytes; %d GCs]\n",
+        printf("[%.3f sec; %llu steps; %d bytes; %d GCs; ~%llu cycles = %.2f sec on Kit]\n",
                (double)(clock() - vm.started) / CLOCKS_PER_SEC,
-               vm.stepsExecuted, vm.totallyAllocated, vm.numGCs);
+               vm.stepsExecuted, vm.totallyAllocated - vm.allocatedBefore, vm.numGCs - vm.gcsBefore,
+               estimatedCycles(), (double)estimatedCycles() / KIT_CLOCK);
 #endif
     }
 #endif
@@ -1,6 +1,7 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include "opcodes.h"
 #include "table.h"
 #include "value.h"
 
@@ -11,6 +12,18 @@ typedef struct {
     Value       handler; // exception handler, if callable; unbind dynamic variable, if dynvar
 } CallFrame;
 
+#ifdef LOX_DBG
+#define TRACE_RING_SIZE 256 // records kept by trace ring, see disasm.c
+
+typedef struct {
+    ObjFunction* function;   // function executed
+    uint16_t     offset;     // of instruction in chunk of function
+    uint16_t     depth;      // of value stack before instruction
+    uint8_t      opcode;     // instruction executed
+    uint8_t      tag;        // type of top of stack, nil if empty
+} TraceRecord;
+#endif
+
 typedef struct {
     Value*      sp;                  // stack pointer, keep first for fast addressing without offset
     Value       stack[STACK_MAX];    // value stack
@@ -32,10 +45,19 @@ typedef struct {
     volatile
     bool        interrupted;         // set from signal handler
 
+    size_t      totallyAllocated;    // accumulates total memory allocated since start
+    size_t      peakAllocated;       // maximum heap usage since start
+    int         numGCs;              // accumulates number of garbage collections since start
+    clock_t     gcTime;              // accumulates clock ticks spent in garbage collection
+
+    Table       autoloads;           // offsets of global definitions in autoloadSource
+    const char* autoloadSource;      // library compiled on demand, see compileAutoload()
+    Table       constants;           // values of global constants, substituted by the compiler
+
 #ifdef LOX_DBG
     bool        log_native_result;   // log result of native call?
-    size_t      totallyAllocated;    // accumulates total memory allocated
-    int         numGCs;              // accumulates number of garbage collections
+    size_t      allocatedBefore;     // totallyAllocated at start of evaluation
+    int         gcsBefore;           // numGCs at start of evaluation
     steps_t     stepsExecuted;       // accumulates number of VM instructions executed
     clock_t     started;             // clock at start of evaluation
 
@@ -45,6 +67,23 @@ typedef struct {
     bool        debug_trace_natives; // trace call of natives 
     int16_t     debug_log_gc;        // trace garbage collection to several degrees of detail 
     bool        debug_statistics;    // print accumulated values above after evaluation
+    bool        debug_op_stats;      // count executed opcodes and pairs of opcodes
+#ifndef KIT68K
+    bool        debug_profile;       // record call tree with instructions and time, see profiler.c
+    bool        debug_count_steps;   // count steps without other instrumentation, for --bench
+    steps_t     cycles;              // estimated 68008 cycles without allocations, see cycles.c
+#endif
+
+    int16_t     prevOpcode;                      // opcode executed before, NUM_OPCODES at frame change
+    steps_t     opCounts[NUM_OPCODES];           // histogram of executed opcodes
+#ifndef KIT68K
+    steps_t     opPairs[NUM_OPCODES][NUM_OPCODES]; // histogram of executed opcode pairs, too big for Kit
+#endif
+
+    bool        debug_trace_ring;                // record every VM step in trace ring, cheaper than trace
+    bool        traceFull;                       // trace ring wrapped around
+    int16_t     traceNext;                       // index of next record in trace ring
+    TraceRecord traceRing[TRACE_RING_SIZE];      // last steps recorded
 #endif
 } VM;
 
@@ -53,6 +92,7 @@ typedef enum {
     EVAL_COMPILE_ERROR,
     EVAL_RUNTIME_ERROR,
     EVAL_INTERRUPTED,
+    EVAL_SWITCH,        // internal to run(), continue with other variant of dispatch loop
 } EvalResult;
 
 extern VM vm;
@@ -60,6 +100,7 @@ extern VM vm;
 void       initVM(void);
 void       freeVM(void);
 EvalResult interpret(const char* source);
+EvalResult interpretFunction(ObjFunction* function);
 void       push(Value value);
 void       runtimeError(const char* format, ...);
 void       userError(Value exception);
@@ -0,0 +1,804 @@
+// Main interpreter loop, included by vm.c to define RUN as one of two variants:
+// - INSTRUMENTED 1: traces steps and calls, counts opcodes and steps, profiles, estimates cycles
+//                   and records steps in the trace ring
+// - INSTRUMENTED 0: plain loop of the release build
+// With SWITCH_RUN defined, both variants exist and return EVAL_SWITCH at the next call or return
+// after INSTRUMENTATION() changed, to be continued by the other one.
+
+static EvalResult RUN(void) {
+    int   index, begin, end, i;
+    Value constant;
+
+    // The IDE68K ancient C compiler generates wrong code for local vars in case branches.
+    // Thus, we declare all needed variables at function start..
+    Int          aInt, bInt;
+    Real         aReal, bReal;
+    Value        aVal=NIL_VAL, bVal, cVal, resVal;
+    ObjString    *aStr, *bStr, *resStr;
+    ObjList      *aLst, *bLst, *resLst;
+    ObjIterator  *aIt;
+    ObjClass     *superclass, *subclass;
+    ObjInstance  *instance;
+    int          slotNr;
+    ObjFunction  *function;
+    ObjClosure   *closure;
+    int          argCount, itemCount;
+    int          offset;
+    int          upvalue;
+    CallFrame    *frame;
+    Value        *consts;
+
+updateFrame:
+#ifdef SWITCH_RUN
+    // Calls and returns are safe points to switch between instrumented and fast variant
+    if (INSTRUMENTATION() != INSTRUMENTED)
+        return EVAL_SWITCH;
+#endif
+    SAMPLES_SAFE_POINT();
+    // Last op changed call frame, update cached values
+    frame  = &vm.frames[vm.frameCount - 1];
+    consts = frame->closure->function->chunk.constants.values;
+#if INSTRUMENTED
+    vm.prevOpcode = NUM_OPCODES; // don't count pairs across calls and returns
+#endif
+
+nextInst:
+    // Last op possibly caused stack overflow, check here
+    if (vm.hadStackoverflow) {
+        runtimeError("Lox value stack overflow.");
+        goto handleError;
+    }
+
+nextInstNoSO:
+    // Last op guaranteed no stack overflow, omit check
+    if (INTERRUPTED()) {
+        (void)READ_BYTE(); // avoid negative ip when interrupting before function start
+        // Make sure all dynvars are restored, but disable exception handlers
+        vm.interrupted = true;
+        runtimeError("Interrupted.");
+        return EVAL_INTERRUPTED;
+    }
+
+#if INSTRUMENTED
+    if (vm.debug_trace_steps) {
+        printStack();
+        disassembleInst(&frame->closure->function->chunk,
+                        (int)(frame->ip - frame->closure->function->chunk.code));
+    }
+    if (vm.debug_op_stats) {
+        vm.opCounts[*frame->ip]++;
+#ifndef KIT68K
+        if (vm.prevOpcode < NUM_OPCODES)
+            vm.opPairs[vm.prevOpcode][*frame->ip]++;
+#endif
+        vm.prevOpcode = *frame->ip;
+    }
+    if (vm.debug_trace_ring)
+        traceStep(frame);
+    ESTIMATE_OP(frame);
+    ++vm.stepsExecuted;
+#endif
+
+    switch (READ_BYTE()) {
+        case OP_CONSTANT:
+            index    = READ_BYTE();
+            constant = consts[index];
+            push(constant);
+            goto nextInst;
+
+        case OP_INT:
+            push(INT_VAL((Int)READ_BYTE()));
+            goto nextInst;
+
+        case OP_ZERO:  push(INT_VAL(0)); goto nextInst;
+        case OP_NIL:   push(NIL_VAL);    goto nextInst;
+        case OP_TRUE:  push(TRUE_VAL);   goto nextInst;
+        case OP_FALSE: push(FALSE_VAL);  goto nextInst;
+        case OP_POP:   drop();           goto nextInstNoSO;
+        case OP_DUP:   push(peek(0));    goto nextInst;
+
+        case OP_SWAP:
+            aVal    = peek(0);
+            peek(0) = peek(1);
+            peek(1) = aVal;
+            goto nextInstNoSO;
+  
+        case OP_GET_LOCAL:
+            slotNr = READ_BYTE();
+            push(frame->fp[slotNr]);
+            goto nextInst;
+
+        case OP_SET_LOCAL:
+            slotNr = READ_BYTE();
+            frame->fp[slotNr] = peek(0);
+            goto nextInstNoSO;
+
+        case OP_GET_GLOBAL:
+            index    = READ_BYTE();
+            constant = consts[index];
+            if (!tableGet(&vm.globals, constant, &aVal)) {
+                function = compileAutoload(AS_STRING(constant));
+                if (function) {
+                    // declaration returns value of global, as if it had been found
+                    push(OBJ_VAL(function));
+                    closure = makeClosure(function);
+                    peek(0) = OBJ_VAL(closure);
+                    if (!callClosure(closure, 0))
+                        goto handleError;
+                    goto updateFrame;
+                }
+                runtimeError("Undefined variable '%s'.", AS_CSTRING(constant));
+                goto handleError;
+            }
+            push(aVal);
+            goto nextInst;
+
+        case OP_DEF_GLOBAL:
+            index    = READ_BYTE();
+            constant = consts[index];
+            tableSet(&vm.globals, constant, peek(0));
+            drop();
+            goto nextInstNoSO;
+
+        case OP_DEF_CONST:
+            index    = READ_BYTE();
+            constant = consts[index];
+            if (!tableGet(&vm.constants, constant, &aVal))
+                tableSet(&vm.constants, constant, peek(0));
+            else if (!constantsEqual(aVal, peek(0))) {
+                runtimeError("Can't redefine constant '%s'.", AS_CSTRING(constant));
+                goto handleError;
+            }
+            tableSet(&vm.globals, constant, peek(0));
+            drop();
+            goto nextInstNoSO;
+
+        case OP_SET_GLOBAL:
+            index    = READ_BYTE();
+            constant = consts[index];
+            if (tableSet(&vm.globals, constant, peek(0))) {
+                tableDelete(&vm.globals, constant);
+                runtimeError("Undefined variable '%s'.", AS_CSTRING(constant));
+                goto handleError;
+            }
+            goto nextInstNoSO;
+
+        case OP_GET_UPVALUE:
+            slotNr = READ_BYTE();
+            push(*AS_UPVALUE(frame->closure->upvalues[slotNr])->location);
+            goto nextInst;
+
+        case OP_SET_UPVALUE:
+            slotNr = READ_BYTE();
+            *AS_UPVALUE(frame->closure->upvalues[slotNr])->location = peek(0);
+            goto nextInstNoSO;
+
+        case OP_GET_CAPTURED:
+            slotNr = READ_BYTE();
+            push(frame->closure->upvalues[slotNr]);
+            goto nextInst;
+
+        case OP_GET_PROPERTY:
+            if (!IS_INSTANCE(peek(0))) {
+                runtimeError("Only instances have %s.", "properties");
+                goto handleError;
+            }
+            instance = AS_INSTANCE(peek(0));
+            index    = READ_BYTE();
+            constant = consts[index];
+            if (tableGet(&instance->fields, constant, &aVal)) {
+                dropNpush(1, aVal);
+                goto nextInstNoSO;
+            }
+            aStr = AS_STRING(constant);
+            if (!bindMethod(instance->klass, aStr))
+                goto handleError;
+            goto nextInstNoSO;
+
+        case OP_SET_PROPERTY:
+            if (!IS_INSTANCE(peek(1))) {
+                runtimeError("Only instances have %s.", "properties");
+                goto handleError;
+            }
+            instance = AS_INSTANCE(peek(1));
+            index    = READ_BYTE();
+            constant = consts[index];
+            tableSet(&instance->fields, constant, peek(0));
+            aVal = pop();
+            dropNpush(1, aVal);
+            goto nextInstNoSO;
+
+        case OP_GET_SUPER:
+            index      = READ_BYTE();
+            constant   = consts[index];
+            aStr       = AS_STRING(constant);
+            superclass = AS_CLASS(pop());
+            if (!bindMethod(superclass, aStr))
+                goto handleError;
+            goto nextInstNoSO;
+
+        case OP_EQUAL:
+            bVal = pop(); 
+            dropNpush(1, BOOL_VAL(valuesEqual(peek(0), bVal)));
+            goto nextInstNoSO;
+
+        case OP_LESS:
+            if (IS_INT(peek(0))) {
+                if (IS_INT(peek(1))) {
+                    bVal = pop(); 
+                    dropNpush(1, BOOL_VAL(peek(0) < bVal)); // relying on Value tagging for int
+                    goto nextInstNoSO;
+                } else if (IS_REAL(peek(1))) {
+                    aReal = AS_REAL(peek(1));
+                    bReal = intToReal(AS_INT(peek(0)));
+                    goto lessReals;
+                } else goto typeErrorLess;
+            } else if (IS_REAL(peek(0))) {
+                bReal = AS_REAL(peek(0));
+                if (IS_INT(peek(1)))
+                    aReal = intToReal(AS_INT(peek(1)));
+                else if (IS_REAL(peek(1)))
+                    aReal = AS_REAL(peek(1));
+                else goto typeErrorLess;
+            lessReals: 
+                dropNpush(2, BOOL_VAL(less(aReal,bReal)));
+            } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                bStr = AS_STRING(peek(0));
+                aStr = AS_STRING(peek(1));
+                dropNpush(2, BOOL_VAL(strcmp(aStr->chars, bStr->chars) < 0));
+            } else {
+            typeErrorLess:
+                runtimeError("Can't %s types %s and %s.", "order",
+                             valueType(peek(1)), valueType(peek(0)));
+                goto handleError;
+            }
+            goto nextInstNoSO;
+
+        case OP_ADD:
+            if (IS_INT(peek(0))) {
+                if (IS_INT(peek(1))) {
+                    bVal = pop(); 
+                    dropNpush(1, peek(0) + bVal - 1); // relying on Value tagging for int
+                    goto nextInstNoSO;
+                } else if (IS_REAL(peek(1))) {
+                    aReal = AS_REAL(peek(1));
+                    bReal = intToReal(AS_INT(peek(0)));
+                    goto addReals;
+                } else goto typeErrorAdd;
+            } else if (IS_REAL(peek(0))) {
+                bReal = AS_REAL(peek(0));
+                if (IS_INT(peek(1)))
+                    aReal = intToReal(AS_INT(peek(1)));
+                else if (IS_REAL(peek(1)))
+                    aReal = AS_REAL(peek(1));
+                else goto typeErrorAdd;
+            addReals: 
+                errno = 0;
+                dropNpush(2, makeReal(add(aReal,bReal)));
+                CHECK_ARITH_ERROR("+")
+            } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                bStr = AS_STRING(peek(0));
+                aStr = AS_STRING(peek(1));
+                resStr = concatStrings(aStr, bStr);
+                if (!resStr) {
+                    runtimeError("'%s' stringbuffer overflow.", "+");
+                    goto handleError;
+                }
+                dropNpush(2, OBJ_VAL(resStr));
+            } else if (IS_LIST(peek(0)) && IS_LIST(peek(1))) {
+                bLst = AS_LIST(peek(0));
+                aLst = AS_LIST(peek(1));
+                resLst = concatLists(aLst, bLst);
+                dropNpush(2, OBJ_VAL(resLst));
+            } else {
+            typeErrorAdd:
+                runtimeError("Can't %s types %s and %s.", "add",
+                             valueType(peek(1)), valueType(peek(0)));
+                goto handleError;
+            }
+            goto nextInstNoSO;
+
+        case OP_SUB:
+            if (IS_INT(peek(0))) {
+                if (IS_INT(peek(1))) {
+                    bVal = pop();
+                    dropNpush(1, peek(0) - bVal + 1); // relying on Value tagging for int
+                    goto nextInstNoSO;
+                } else if (IS_REAL(peek(1))) {
+                    aReal = AS_REAL(peek(1));
+                    bReal = intToReal(AS_INT(peek(0)));
+                } else goto typeErrorSub;
+            } else if (IS_REAL(peek(0))) {
+                bReal = AS_REAL(peek(0));
+                if (IS_INT(peek(1)))
+                    aReal = intToReal(AS_INT(peek(1)));
+                else if (IS_REAL(peek(1)))
+                    aReal = AS_REAL(peek(1));
+                else goto typeErrorSub;
+            } else {
+            typeErrorSub:
+                runtimeError("Can't %s types %s and %s.", "subtract",
+                             valueType(peek(1)), valueType(peek(0)));
+                goto handleError;
+            }
+            errno = 0;
+            dropNpush(2, makeReal(sub(aReal,bReal)));
+            CHECK_ARITH_ERROR("-")
+            goto nextInstNoSO;
+
+        case OP_MUL:
+            if (IS_INT(peek(0))) {
+                if (IS_INT(peek(1))) {
+                    bInt = AS_INT(pop());
+                    dropNpush(1, INT_VAL(AS_INT(peek(0)) * bInt));
+                    goto nextInstNoSO;
+                } else if (IS_REAL(peek(1))) {
+                    aReal = AS_REAL(peek(1));
+                    bReal = intToReal(AS_INT(peek(0)));
+                } else goto typeErrorMul;
+            } else if (IS_REAL(peek(0))) {
+                bReal = AS_REAL(peek(0));
+                if (IS_INT(peek(1)))
+                    aReal = intToReal(AS_INT(peek(1)));
+                else if (IS_REAL(peek(1)))
+                    aReal = AS_REAL(peek(1));
+                else goto typeErrorMul;
+            } else {
+            typeErrorMul:
+                runtimeError("Can't %s types %s and %s.", "multiply",
+                             valueType(peek(1)), valueType(peek(0)));
+                goto handleError;
+            }
+            errno = 0;
+            dropNpush(2, makeReal(mul(aReal,bReal)));
+            CHECK_ARITH_ERROR("*")
+            goto nextInstNoSO;
+
+        case OP_DIV:
+        case OP_MOD:
+            if (IS_INT(peek(0))) {
+                if (IS_INT(peek(1))) {
+                    bInt = AS_INT(pop());
+                    aInt = AS_INT(pop());
+                    if (bInt == 0) {
+                        runtimeError("Div by zero.");
+                        goto handleError;
+                    }
+                    if (CURR_INSTR()==OP_DIV) 
+                        aInt = aInt / bInt;
+                    else
+                        aInt = aInt % bInt;
+                    pushUnchecked(INT_VAL(aInt));
+                    goto nextInstNoSO;
+                } else if (IS_REAL(peek(1))) {
+                    aReal = AS_REAL(peek(1));
+                    bReal = intToReal(AS_INT(peek(0)));
+                } else goto typeErrorDiv;
+            } else if (IS_REAL(peek(0))) {
+                bReal = AS_REAL(peek(0));
+                if (IS_INT(peek(1)))
+                    aReal = intToReal(AS_INT(peek(1)));
+                else if (IS_REAL(peek(1)))
+                    aReal = AS_REAL(peek(1));
+                else goto typeErrorDiv;
+            } else {
+            typeErrorDiv:
+                runtimeError("Can't %s types %s and %s.", "divide",
+                             valueType(peek(1)), valueType(peek(0)));
+                goto handleError;
+            }
+            if (bReal == 0) {
+                runtimeError("Div by zero.");
+                goto handleError;
+            }
+            errno = 0;
+            if (CURR_INSTR()==OP_DIV)
+                aReal = div(aReal,bReal);
+            else
+                aReal = mod(aReal,bReal);
+            dropNpush(2, makeReal(aReal));
+            CHECK_ARITH_ERROR("div")
+            goto nextInstNoSO;
+
+        case OP_NOT:
+            peek(0) = BOOL_VAL(IS_FALSEY(peek(0)));
+            goto nextInstNoSO;
+
+        case OP_PRINT:
+            printValue(pop(), PRTF_HUMAN | PRTF_EXPAND);
+            goto nextInstNoSO;
+
+        case OP_PRINTLN:
+            printValue(pop(), PRTF_HUMAN | PRTF_EXPAND);
+            putstr("\n");
+            goto nextInstNoSO;
+
+        case OP_PRINTQ:
+            printValue(pop(), PRTF_MACHINE | PRTF_EXPAND);
+            putstr("\n");
+            goto nextInstNoSO;
+
+        case OP_JUMP:
+            offset = READ_USHORT();
+            frame->ip += offset;
+            goto nextInstNoSO;
+
+        case OP_JUMP_OR:
+            offset = READ_USHORT();
+            if (IS_FALSEY(peek(0)))
+                drop();
+            else
+                frame->ip += offset;
+            goto nextInstNoSO;
+
+        case OP_JUMP_AND:
+            offset = READ_USHORT();
+            if (IS_FALSEY(peek(0)))
+                frame->ip += offset;
+            else
+                drop();
+            goto nextInstNoSO;
+
+        case OP_JUMP_TRUE:
+            offset = READ_USHORT();
+            if (!IS_FALSEY(pop()))
+                frame->ip += offset;
+            goto nextInstNoSO;
+
+        case OP_JUMP_FALSE:
+            offset = READ_USHORT();
+            if (IS_FALSEY(pop()))
+                frame->ip += offset;
+            goto nextInstNoSO;
+
+        case OP_LOOP:
+            offset = READ_USHORT();
+            frame->ip -= offset;
+            SAMPLES_SAFE_POINT();
+            goto nextInstNoSO;
+
+        case OP_CALL0:
+            argCount = 0;
+            goto cont_call;
+
+        case OP_CALL1:
+            argCount = 1;
+            goto cont_call;
+
+        case OP_CALL2:
+            argCount = 2;
+            goto cont_call;
+
+        case OP_CALL:
+            argCount = READ_BYTE();
+        cont_call:
+            if (!callValue(peek(argCount), argCount))
+                goto handleError;
+            goto updateFrame;
+
+        case OP_VCALL:
+            argCount = READ_BYTE() + AS_INT(pop());
+            goto cont_call;
+
+        case OP_CALL_HAND:
+            if (!callWithHandler())
+                goto handleError;
+            goto updateFrame;
+
+        case OP_CALL_BIND:
+            index    = READ_BYTE();
+            constant = consts[index];
+            if (!callBinding(constant))
+                goto handleError;
+            goto updateFrame;
+
+        case OP_INVOKE:
+            index    = READ_BYTE();
+            argCount = READ_BYTE();
+        cont_invoke:
+            constant = consts[index];
+            aStr = AS_STRING(constant);
+            if (!invoke(aStr, argCount))
+                goto handleError;
+            goto updateFrame;
+
+        case OP_VINVOKE:
+            index    = READ_BYTE();
+            argCount = READ_BYTE() + AS_INT(pop());
+            goto cont_invoke;
+
+        case OP_SUPER_INVOKE:
+            index      = READ_BYTE();
+            superclass = AS_CLASS(pop());
+            argCount   = READ_BYTE();
+        cont_super_invoke:
+            constant = consts[index];
+            aStr     = AS_STRING(constant);
+            if (!invokeFromClass(superclass, aStr, argCount))
+                goto handleError;
+            goto updateFrame;
+
+        case OP_VSUPER_INVOKE:
+            index      = READ_BYTE();
+            superclass = AS_CLASS(pop());
+            argCount   = READ_BYTE() + AS_INT(pop());
+            goto cont_super_invoke;
+
+        case OP_CLOSURE:
+            index    = READ_BYTE();
+            constant = consts[index];
+            function = AS_FUNCTION(constant);
+            closure  = makeClosure(function);
+            push(OBJ_VAL(closure));
+            for (i = 0; i < closure->upvalueCount; i++) {
+                upvalue = READ_BYTE();
+                if (UV_ISFLAT(upvalue) && UV_ISLOC(upvalue))
+                    closure->upvalues[i] = frame->fp[UV_INDEX(upvalue)];
+                else if (UV_ISLOC(upvalue))
+                    closure->upvalues[i] = OBJ_VAL(captureUpvalue(frame->fp + UV_INDEX(upvalue)));
+                else
+                    closure->upvalues[i] = frame->closure->upvalues[UV_INDEX(upvalue)];
+            }
+            goto nextInst;
+
+        case OP_CLOSE_UPVALUE:
+            closeUpvalues(vm.sp - 1);
+            drop();
+            goto nextInstNoSO;
+
+        case OP_RETURN_NIL:
+            resVal = NIL_VAL;
+            goto cont_ret;
+
+        case OP_RETURN:
+            resVal = pop();
+        cont_ret:
+            closeUpvalues(frame->fp);
+
+            if (IS_DYNVAR(frame->handler))
+                restoreGlobal(frame->handler);
+
+            vm.frameCount--;
+            TIMELINE_RETURN();
+#if INSTRUMENTED
+            PROFILE_RETURN();
+
+            if (vm.debug_trace_calls) {
+                indentCallTrace();
+                printf("<-- %s ", functionName(frame->closure->function));
+                printValue(resVal, PRTF_MACHINE | PRTF_EXPAND);
+                putstr("\n");
+            }
+#endif
+
+            if (vm.frameCount == 0) {
+                drop();
+                return EVAL_OK;
+            }
+            vm.sp = frame->fp;
+            pushUnchecked(resVal);
+            goto updateFrame;
+
+        case OP_CLASS:
+            index    = READ_BYTE();
+            constant = consts[index];
+            aStr     = AS_STRING(constant);
+            push(OBJ_VAL(makeClass(aStr)));
+            goto nextInst;
+
+        case OP_INHERIT:
+            aVal = peek(1);
+            if (!IS_CLASS(aVal)) {
+                runtimeError("Can't %s type %s.", "inherit from", valueType(aVal));
+                goto handleError;
+            }
+            superclass = AS_CLASS(aVal);
+            subclass   = AS_CLASS(peek(0));
+            if (superclass == subclass) {
+                runtimeError("Can't %s itself.", "inherit from");
+                goto handleError;
+            }
+            subclass->superClass = superclass;
+            tableAddAll(&superclass->methods, &subclass->methods);
+            drop();
+            goto nextInstNoSO;
+
+        case OP_METHOD:
+            index    = READ_BYTE();
+            constant = consts[index];
+            aStr     = AS_STRING(constant);
+            defineMethod(aStr);
+            goto nextInstNoSO;
+
+        case OP_LIST:
+            argCount = READ_BYTE();
+        cont_list:
+            aLst     = makeList(argCount, vm.sp - argCount, argCount, 1);
+            dropNpush(argCount, OBJ_VAL(aLst));
+            goto nextInst;
+
+        case OP_VLIST:
+            argCount = READ_BYTE() + AS_INT(pop());
+            goto cont_list;
+
+        case OP_UNPACK:
+            aVal     = pop();
+            argCount = AS_INT(pop());
+            if (!IS_LIST(aVal)) {
+                runtimeError("Can't %s type %s.", "unpack", valueType(aVal));
+                goto handleError;
+            }
+            aLst      = AS_LIST(aVal);
+            itemCount = aLst->arr.count;
+            if (vm.sp + itemCount >= vm.stack + (STACK_MAX-1)) {
+                runtimeError("Lox value stack overflow.");
+                goto handleError;
+            }
+            for (i = 0; i < itemCount; i++)
+                vm.sp[i] = aLst->arr.values[i];
+            vm.sp += itemCount;
+            pushUnchecked(INT_VAL(itemCount + argCount));
+            goto nextInstNoSO;
+
+        case OP_GET_INDEX:
+            aVal = peek(0); // index
+            bVal = peek(1); // object
+
+            if (IS_LIST(bVal)) {
+                bLst = AS_LIST(bVal);
+                if (!IS_INT(aVal)) {
+                    runtimeError("%s is not an integer.", "List index");
+                    goto handleError;
+                }
+                index = AS_INT(aVal);
+                if (!validateIndex(bLst->arr.count, &index)) {
+                    runtimeError("%s out of range.", "List index");
+                    goto handleError;
+                }
+                resVal = bLst->arr.values[index];
+                dropNpush(2, resVal);
+                goto nextInstNoSO;
+            } else if (IS_STRING(bVal)) {
+                bStr = AS_STRING(bVal);
+                if (!IS_INT(aVal)) {
+                    runtimeError("%s is not an integer.", "String index");
+                    goto handleError;
+                }
+                index = AS_INT(aVal);
+                if (!validateIndex(bStr->length, &index)) {
+                    runtimeError("%s out of range.", "String index");
+                    goto handleError;
+                }
+                resVal = OBJ_VAL(makeString(bStr->chars + index, 1));
+                dropNpush(2, resVal);
+                goto nextInstNoSO;
+            } else if (IS_INSTANCE(bVal)) {
+                instance = AS_INSTANCE(bVal);
+                resVal   = NIL_VAL;
+                tableGet(&instance->fields, aVal, &resVal); // not found -> nil
+                dropNpush(2, resVal);
+                goto nextInstNoSO;
+            } else {
+                runtimeError("Can't %s type %s.", "index into", valueType(bVal));
+                goto handleError;
+            }
+
+        case OP_SET_INDEX:
+            cVal = peek(0); // item
+            aVal = peek(1); // index
+            bVal = peek(2); // object   
+
+            if (IS_LIST(bVal)) {
+                bLst = AS_LIST(bVal);
+                if (!IS_INT(aVal)) {
+                    runtimeError("%s is not an integer.", "List index");
+                    goto handleError;
+                }
+                index = AS_INT(aVal);
+                if (!validateIndex(bLst->arr.count, &index)) {
+                    runtimeError("%s out of range.", "List index");
+                    goto handleError;
+                }
+                bLst->arr.values[index] = cVal;
+                dropNpush(3, cVal);
+                goto nextInstNoSO;
+            } else if (IS_INSTANCE(bVal)) {
+                instance = AS_INSTANCE(bVal);
+                tableSet(&instance->fields, aVal, cVal);
+                dropNpush(3, cVal);
+                goto nextInstNoSO;
+            } else {
+                runtimeError("Can't %s type %s.", "store into", valueType(bVal));
+                goto handleError;
+            }
+
+        case OP_GET_SLICE:
+            aVal = pop();   // end
+            bVal = pop();   // begin
+            cVal = peek(0); // object
+
+            if (!IS_INT(bVal)) {
+                runtimeError("%s is not an integer.", "Slice begin");
+                goto handleError;
+            }
+            begin = AS_INT(bVal);
+            if (!IS_INT(aVal)) {
+                runtimeError("%s is not an integer.", "Slice end");
+                goto handleError;
+            }
+            end = AS_INT(aVal);
+            if (IS_LIST(cVal)) {
+                aLst   = AS_LIST(cVal);
+                resVal = OBJ_VAL(sliceFromList(aLst, begin, end));
+                dropNpush(1, resVal);
+                goto nextInstNoSO;
+            } else if (IS_STRING(cVal)) {
+                aStr   = AS_STRING(cVal);
+                resVal = OBJ_VAL(sliceFromString(aStr, begin, end));
+                dropNpush(1, resVal);
+                goto nextInstNoSO;
+            } else {
+                runtimeError("Can't %s type %s.", "slice into", valueType(cVal));
+                goto handleError;
+            }
+
+        case OP_GET_ITVAL:
+        case OP_GET_ITKEY:
+            aVal = peek(0); // iterator
+            if (!IS_ITERATOR(aVal)) {
+                runtimeError("Can't %s type %s.", "deref", valueType(aVal));
+                goto handleError;
+            }
+            aIt = AS_ITERATOR(aVal);
+            if (!isValidIterator(aIt)) {
+                runtimeError("Invalid iterator.");
+                goto handleError;
+            }
+            resVal = getIterator(aIt, CURR_INSTR()==OP_GET_ITKEY);
+            dropNpush(1, resVal);
+            goto nextInstNoSO;
+
+        case OP_SWITCH:
+            argCount  = READ_BYTE(); // OP_CASE entries following
+            i         = READ_BYTE(); // kind of table
+            frame->ip = switchCase(peek(0), frame->ip, argCount, i, consts);
+            goto nextInstNoSO;
+
+        case OP_INLINE:
+            constant = consts[READ_BYTE()]; // global called
+            bVal     = consts[READ_BYTE()]; // function inlined
+            offset   = READ_USHORT();
+            if (!tableGet(&vm.globals, constant, &aVal) || !IS_CLOSURE(aVal)
+                    || AS_CLOSURE(aVal)->function != AS_FUNCTION(bVal))
+                frame->ip += offset;
+            goto nextInstNoSO;
+
+        case OP_SET_ITVAL:
+            bVal = peek(0); // item
+            aVal = peek(1); // iterator
+            if (!IS_ITERATOR(aVal)) {
+                runtimeError("Can't %s type %s.", "deref", valueType(aVal));
+                goto handleError;
+            }
+            aIt = AS_ITERATOR(aVal);
+            if (!isValidIterator(aIt)) {
+                runtimeError("Invalid iterator.");
+                goto handleError;
+            }
+            setIterator(aIt, bVal);
+            dropNpush(2, bVal);
+            goto nextInstNoSO;
+
+        default:
+            runtimeError("Invalid byte code $%02x.", CURR_INSTR());
+    }
+
+handleError:
+    if (vm.handleException) {
+        // handler and exception have already been pushed in runtimeError()
+        vm.handleException = false;
+        argCount           = 1;
+        goto cont_call;
+    }
+    return EVAL_RUNTIME_ERROR;
+}